@@ -0,0 +1,556 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+
+#include "sim.h"
+#include "sim_topology.h"
+#include "DSDV_protocol.h"
+
+/* Convergence and overhead benchmark. One simulation runs these phases back to back; a convergence
+ * phase ends once every route is a shortest path or after the phase timeout:
+ *   boot       all nodes but the joiner boot, time until every connected pair has a valid route
+ *   link_break a central link goes down, time until routes are valid again (skipped if every link is a bridge)
+ *   node_join  the joiner boots, time until it is reachable from everywhere and vice versa
+ *   restart    the most central node is down for a moment, time from its reboot until routes are valid again
+ *   steady     idle window, routing frames/bytes per node and second
+ *   traffic    random unicast user data, delivery ratio and end-to-end latency; with --flood, mesh
+ *              broadcasts whose delivery ratio counts every node and whose latency is that of the last copy */
+
+enum {
+    FRAME_ROUTING,
+    FRAME_USER,
+};
+
+#define BENCH_MAGIC 0xD5D7BE4Cu
+
+typedef struct {
+    uint32_t magic;
+    uint32_t msg_id;
+} bench_payload_t;
+
+typedef struct {
+    int src;
+    int dst;
+    int expected_hops;
+    int64_t sent_at;
+    int64_t delivered_at;
+    int receipts;            // nodes a flooded message reached
+} bench_msg_t;
+
+typedef struct {
+    bool converged;
+    double time_s;
+    double optimal_time_s;
+} phase_result_t;
+
+typedef struct {
+    double window_s;
+    double routing_frames;   // per node and second
+    double routing_bytes;
+    double user_frames;
+    double user_bytes;
+    double airtime;          // fraction of time the average node is transmitting
+    double radio_on;         // fraction of time the average node has its radio on
+} overhead_t;
+
+static struct {
+    const char *topology;
+    double loss;
+    double loss_spread;
+    uint64_t seed;
+    int nodes;
+    double phase_timeout;
+    double sample_ms;
+    double window;
+    double rate;
+    int payload_len;
+    int flood_ttl;
+    bool compress;
+    int break_a, break_b;
+    int joiner;
+    int restarted;
+    double downtime;
+    phase_result_t boot, link_break, node_join, node_restart;
+    overhead_t steady, traffic_overhead;
+    int64_t traffic_end;
+    bench_msg_t *msgs;
+    int msg_num, msg_cap;
+    int not_sent;
+    double wall_s;
+} bench;
+
+static int classify_frame(const uint8_t *data, int len)
+{
+    if (len < (int)sizeof(example_espnow_data_t))
+        return -1;
+    return ((const example_espnow_data_t *)data)->is_userData ? FRAME_USER : FRAME_ROUTING;
+}
+
+static void on_user_data(uint8_t *data, int data_len)
+{
+    bench_payload_t payload;
+    if (data_len < (int)sizeof(payload))
+        return;
+    memcpy(&payload, data, sizeof(payload));
+    if (payload.magic != BENCH_MAGIC || payload.msg_id >= (uint32_t)bench.msg_num)
+        return;
+    bench_msg_t *msg = &bench.msgs[payload.msg_id];
+    if (bench.flood_ttl > 0 && msg->src != sim_current_node()) {
+        msg->receipts++;
+        msg->delivered_at = sim_now();
+    }
+    else if (msg->dst == sim_current_node() && msg->delivered_at < 0)
+        msg->delivered_at = sim_now();
+}
+
+/* Fills buf with JSON-like sensor records of the node, repeated or cut off to len bytes. */
+static void telemetry(uint64_t *rng, int node, uint8_t *buf, int len)
+{
+    char record[160];
+    *rng = *rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t r = (uint32_t)(*rng >> 32);
+    int n = snprintf(record, sizeof(record),
+                     "{\"node\":%d,\"temperature\":%u.%02u,\"humidity\":%u.%u,\"battery\":3.%02u,\"rssi\":-%u,\"status\":\"ok\"}",
+                     node, 18 + r % 8, (r >> 3) % 100, 40 + (r >> 10) % 20, (r >> 15) % 10, (r >> 18) % 100, 50 + (r >> 25) % 40);
+    for (int i = 0; i < len; i++)
+        buf[i] = record[i % n];
+}
+
+/* Application task on every node: unicast to a random peer, or flood, at the configured rate. */
+static void traffic_task(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    uint64_t rng = bench.seed * 0x9E3779B97F4A7C15ULL + (uint64_t)self;
+    uint8_t *buf = calloc(1, bench.payload_len);
+    TickType_t period = pdMS_TO_TICKS(1000.0 / bench.rate);
+    if (period == 0)
+        period = 1;
+
+    for (;;) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        vTaskDelay(period / 2 + (TickType_t)((rng >> 33) % (period + 1)));
+        if (sim_now() >= bench.traffic_end)
+            break;
+
+        int dst = -1;
+        if (bench.flood_ttl == 0) {
+            dst = (int)((rng >> 17) % (uint64_t)(bench.nodes - 1));
+            if (dst >= self)
+                dst++;
+            if (!sim_node_alive(dst))
+                continue;
+        }
+
+        if (bench.msg_num == bench.msg_cap) {
+            bench.msg_cap = bench.msg_cap ? bench.msg_cap * 2 : 1024;
+            bench.msgs = realloc(bench.msgs, sizeof(bench_msg_t) * bench.msg_cap);
+        }
+        bench_msg_t *msg = &bench.msgs[bench.msg_num];
+        msg->src = self;
+        msg->dst = dst;
+        msg->expected_hops = 0;
+        msg->sent_at = sim_now();
+        msg->delivered_at = -1;
+        msg->receipts = 0;
+        bench_payload_t payload = { BENCH_MAGIC, (uint32_t)bench.msg_num++ };
+        memcpy(buf, &payload, sizeof(payload));
+        int ret;
+        if (bench.flood_ttl > 0)
+            ret = sim_flood_user_data(self, buf, bench.payload_len, bench.flood_ttl);
+        else if (bench.compress) {
+            telemetry(&rng, self, buf + sizeof(payload), bench.payload_len - sizeof(payload));
+            ret = sim_send_compressed_user_data(self, dst, buf, bench.payload_len);
+        }
+        else
+            ret = sim_send_user_data(self, dst, buf, bench.payload_len);
+        if (ret != ESP_OK)
+            bench.not_sent++;
+    }
+    free(buf);
+    vTaskDelete(NULL);
+}
+
+static phase_result_t wait_for_convergence(void)
+{
+    phase_result_t res = { .converged = false, .time_s = -1, .optimal_time_s = -1 };
+    int64_t start = sim_now();
+    int64_t step = (int64_t)(bench.sample_ms * 1000);
+    int64_t deadline = start + (int64_t)(bench.phase_timeout * 1e6);
+    topo_route_report_t report;
+    for (int64_t t = start + step; t <= deadline; t += step) {
+        sim_run_until(t);
+        topo_check_routes(&report);
+        if (!res.converged && report.valid == report.pairs) {
+            res.converged = true;
+            res.time_s = (t - start) / 1e6;
+        }
+        if (report.optimal == report.pairs) {
+            res.optimal_time_s = (t - start) / 1e6;
+            if (!res.converged) {
+                res.converged = true;
+                res.time_s = res.optimal_time_s;
+            }
+            break;
+        }
+    }
+    return res;
+}
+
+static void snapshot(sim_node_stats_t *total)
+{
+    memset(total, 0, sizeof(*total));
+    for (int n = 0; n < bench.nodes; n++) {
+        sim_node_stats_t st;
+        sim_node_stats(n, &st);
+        total->airtime_us += st.airtime_us;
+        total->radio_on_us += st.radio_on_us;
+        for (int c = 0; c < SIM_FRAME_CLASSES; c++) {
+            total->class_frames[c] += st.class_frames[c];
+            total->class_bytes[c] += st.class_bytes[c];
+        }
+    }
+}
+
+/* Rates per node and second of the window; the radio-on fraction is the one of all the time since start,
+ * which also covers the time left for the last messages to arrive. */
+static overhead_t measure_window(double window_s, int64_t start, const sim_node_stats_t *before)
+{
+    sim_node_stats_t after;
+    snapshot(&after);
+    double per = 1.0 / (bench.nodes * window_s);
+    overhead_t o = {
+        .window_s = window_s,
+        .routing_frames = (after.class_frames[FRAME_ROUTING] - before->class_frames[FRAME_ROUTING]) * per,
+        .routing_bytes = (after.class_bytes[FRAME_ROUTING] - before->class_bytes[FRAME_ROUTING]) * per,
+        .user_frames = (after.class_frames[FRAME_USER] - before->class_frames[FRAME_USER]) * per,
+        .user_bytes = (after.class_bytes[FRAME_USER] - before->class_bytes[FRAME_USER]) * per,
+        .airtime = (after.airtime_us - before->airtime_us) * per / 1e6,
+        .radio_on = (double)(after.radio_on_us - before->radio_on_us) / bench.nodes / (sim_now() - start),
+    };
+    return o;
+}
+
+/* Central link whose loss keeps the mesh connected. */
+static void pick_link(void)
+{
+    double cx = 0, cy = 0, best = INFINITY;
+    for (int n = 0; n < bench.nodes; n++) {
+        double x, y;
+        sim_get_position(n, &x, &y);
+        cx += x / bench.nodes;
+        cy += y / bench.nodes;
+    }
+    bench.break_a = bench.break_b = -1;
+    for (int a = 0; a < bench.nodes; a++)
+        for (int b = a + 1; b < bench.nodes; b++) {
+            if (a == bench.joiner || b == bench.joiner || !sim_link_up(a, b))
+                continue;
+            double ax, ay, bx, by;
+            sim_get_position(a, &ax, &ay);
+            sim_get_position(b, &bx, &by);
+            double d = hypot((ax + bx) / 2 - cx, (ay + by) / 2 - cy);
+            if (d >= best)
+                continue;
+            double loss = sim_link_loss(a, b);
+            sim_clear_link(a, b);
+            if (topo_hop_distance(a, b) >= 0) {
+                best = d;
+                bench.break_a = a;
+                bench.break_b = b;
+            }
+            sim_set_link(a, b, loss);
+        }
+}
+
+/* Node closest to the centre of the mesh, routing for the most others. */
+static int pick_central_node(void)
+{
+    double cx = 0, cy = 0, best = INFINITY;
+    for (int n = 0; n < bench.nodes; n++) {
+        double x, y;
+        sim_get_position(n, &x, &y);
+        cx += x / bench.nodes;
+        cy += y / bench.nodes;
+    }
+    int central = 0;
+    for (int n = 0; n < bench.nodes; n++) {
+        double x, y;
+        sim_get_position(n, &x, &y);
+        if (n != bench.joiner && hypot(x - cx, y - cy) < best) {
+            best = hypot(x - cx, y - cy);
+            central = n;
+        }
+    }
+    return central;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_phase_json(FILE *out, const char *name, const phase_result_t *p, const char *extra)
+{
+    fprintf(out, "  \"%s\": {%s\"converged\": %s, \"time_s\": %.3f, \"optimal_time_s\": %.3f},\n",
+            name, extra, p->converged ? "true" : "false", p->time_s, p->optimal_time_s);
+}
+
+static void print_overhead_json(FILE *out, const char *name, const overhead_t *o)
+{
+    fprintf(out, "  \"%s\": {\"window_s\": %.1f, \"routing_frames_per_node_s\": %.4f, \"routing_bytes_per_node_s\": %.2f, "
+            "\"user_frames_per_node_s\": %.4f, \"user_bytes_per_node_s\": %.2f, \"airtime_fraction\": %.6f, "
+            "\"radio_on_fraction\": %.6f},\n",
+            name, o->window_s, o->routing_frames, o->routing_bytes, o->user_frames, o->user_bytes, o->airtime, o->radio_on);
+}
+
+/* Shortest path lengths of the delivered messages, one BFS per destination. */
+static void fill_expected_hops(void)
+{
+    int *dist = malloc(sizeof(int) * bench.nodes);
+    for (int dst = 0; dst < bench.nodes; dst++) {
+        bool needed = false;
+        for (int i = 0; i < bench.msg_num && !needed; i++)
+            needed = bench.msgs[i].dst == dst;
+        if (!needed)
+            continue;
+        topo_distances_to(dst, dist);
+        for (int i = 0; i < bench.msg_num; i++)
+            if (bench.msgs[i].dst == dst)
+                bench.msgs[i].expected_hops = dist[bench.msgs[i].src];
+    }
+    free(dist);
+}
+
+static void report(FILE *out, bool csv)
+{
+    int delivered = 0, timed = 0;
+    double hops = 0;
+    fill_expected_hops();
+    int64_t *lat = malloc(sizeof(int64_t) * (bench.msg_num + 1));
+    for (int i = 0; i < bench.msg_num; i++)
+        if (bench.msgs[i].delivered_at >= 0) {
+            lat[timed++] = bench.msgs[i].delivered_at - bench.msgs[i].sent_at;
+            hops += bench.msgs[i].expected_hops;
+            delivered += bench.flood_ttl > 0 ? bench.msgs[i].receipts : 1;
+        }
+    qsort(lat, timed, sizeof(int64_t), cmp_int64);
+    double mean = 0;
+    for (int i = 0; i < timed; i++)
+        mean += lat[i] / 1000.0;
+    mean = timed ? mean / timed : 0;
+    double p50 = timed ? lat[timed / 2] / 1000.0 : 0;
+    double p95 = timed ? lat[(int)(timed * 0.95)] / 1000.0 : 0;
+    double max = timed ? lat[timed - 1] / 1000.0 : 0;
+    double hops_mean = timed ? hops / timed : 0;
+    // a flooded message is due at every other node
+    int due = bench.msg_num * (bench.flood_ttl > 0 ? bench.nodes - 1 : 1);
+    double pdr = due ? (double)delivered / due : 0;
+    free(lat);
+
+    if (csv) {
+        fprintf(out, "topology,nodes,loss,loss_spread,seed,broadcasting_period_ms,max_broadcasting_period_ms,"
+                "boot_converged,boot_s,boot_optimal_s,break_converged,break_s,break_optimal_s,"
+                "join_converged,join_s,join_optimal_s,restart_converged,restart_s,restart_optimal_s,"
+                "steady_routing_frames_per_node_s,steady_routing_bytes_per_node_s,steady_airtime,steady_radio_on,"
+                "traffic_routing_bytes_per_node_s,traffic_user_frames_per_node_s,traffic_user_bytes_per_node_s,traffic_airtime,traffic_radio_on,"
+                "rate_per_node_s,payload_bytes,flood_ttl,compressed,"
+                "sent,not_sent,delivered,pdr,latency_mean_ms,latency_p50_ms,latency_p95_ms,latency_max_ms,hops_mean,latency_per_hop_ms,wall_s\n");
+        fprintf(out, "%s,%d,%.3f,%.3f,%llu,%d,%d,%d,%.3f,%.3f,%d,%.3f,%.3f,%d,%.3f,%.3f,%d,%.3f,%.3f,%.4f,%.2f,%.6f,%.4f,%.2f,%.4f,%.2f,%.6f,%.4f,"
+                "%.3f,%d,%d,%d,%d,%d,%d,%.4f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                bench.topology, bench.nodes, bench.loss, bench.loss_spread, (unsigned long long)bench.seed, MIN_BROADCASTING_PERIOD, MAX_BROADCASTING_PERIOD,
+                bench.boot.converged, bench.boot.time_s, bench.boot.optimal_time_s,
+                bench.link_break.converged, bench.link_break.time_s, bench.link_break.optimal_time_s,
+                bench.node_join.converged, bench.node_join.time_s, bench.node_join.optimal_time_s,
+                bench.node_restart.converged, bench.node_restart.time_s, bench.node_restart.optimal_time_s,
+                bench.steady.routing_frames, bench.steady.routing_bytes, bench.steady.airtime, bench.steady.radio_on,
+                bench.traffic_overhead.routing_bytes, bench.traffic_overhead.user_frames, bench.traffic_overhead.user_bytes,
+                bench.traffic_overhead.airtime, bench.traffic_overhead.radio_on,
+                bench.rate, bench.payload_len, bench.flood_ttl, bench.compress,
+                bench.msg_num, bench.not_sent, delivered, pdr, mean, p50, p95, max, hops_mean, hops_mean > 0 ? mean / hops_mean : 0, bench.wall_s);
+        return;
+    }
+
+    char extra[64];
+    fprintf(out, "{\n");
+    fprintf(out, "  \"topology\": \"%s\", \"nodes\": %d, \"loss\": %.3f, \"loss_spread\": %.3f, \"seed\": %llu, \"broadcasting_period_ms\": %d, \"max_broadcasting_period_ms\": %d,\n",
+            bench.topology, bench.nodes, bench.loss, bench.loss_spread, (unsigned long long)bench.seed, MIN_BROADCASTING_PERIOD, MAX_BROADCASTING_PERIOD);
+    print_phase_json(out, "boot", &bench.boot, "");
+    if (bench.break_a >= 0)
+        snprintf(extra, sizeof(extra), "\"link\": [%d, %d], ", bench.break_a, bench.break_b);
+    else
+        snprintf(extra, sizeof(extra), "\"link\": null, ");
+    print_phase_json(out, "link_break", &bench.link_break, extra);
+    snprintf(extra, sizeof(extra), "\"node\": %d, ", bench.joiner);
+    print_phase_json(out, "node_join", &bench.node_join, extra);
+    snprintf(extra, sizeof(extra), "\"node\": %d, \"downtime_s\": %.3f, ", bench.restarted, bench.downtime);
+    print_phase_json(out, "restart", &bench.node_restart, extra);
+    print_overhead_json(out, "steady", &bench.steady);
+    print_overhead_json(out, "traffic_overhead", &bench.traffic_overhead);
+    fprintf(out, "  \"traffic\": {\"rate_per_node_s\": %.3f, \"payload_bytes\": %d, \"flood_ttl\": %d, \"compressed\": %s, \"sent\": %d, \"not_sent\": %d, \"delivered\": %d, "
+            "\"pdr\": %.4f, \"latency_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f}, "
+            "\"hops_mean\": %.3f, \"latency_per_hop_ms\": %.3f},\n",
+            bench.rate, bench.payload_len, bench.flood_ttl, bench.compress ? "true" : "false", bench.msg_num, bench.not_sent, delivered, pdr, mean, p50, p95, max,
+            hops_mean, hops_mean > 0 ? mean / hops_mean : 0);
+    fprintf(out, "  \"wall_s\": %.3f\n}\n", bench.wall_s);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -t, --topology SPEC    line:N | grid:WxH | rgg:N:RANGE | full:N (default grid:10x10)\n"
+        "  -l, --loss P           per-frame loss probability on every link (default 0)\n"
+        "  -d, --loss-spread D    draw the loss of each link from P +- D (default 0, not for rgg)\n"
+        "  -s, --seed N           random seed (default 1)\n"
+        "  -P, --phase-timeout S  give up on a convergence phase after S simulated seconds (default 120)\n"
+        "  -p, --sample-ms MS     route check interval (default 250)\n"
+        "  -w, --window S         length of the steady and traffic windows (default 60)\n"
+        "  -R, --downtime S       time the restarted node is down (default 1)\n"
+        "  -r, --rate R           user messages per node and second (default 0.5)\n"
+        "  -b, --payload N        user payload bytes, fragmented above one frame (default 32)\n"
+        "  -F, --flood TTL        flood the user messages to every node within TTL hops instead (default 0, unicast)\n"
+        "  -z, --compress         send unicasts with transmit_compressed_user_data(), the payload filled with\n"
+        "                         JSON-like telemetry (needs CONFIG_DSDV_COMPRESSION)\n"
+        "  -f, --format FMT       json or csv (default json)\n"
+        "  -o, --output FILE      write the report to FILE instead of stdout\n"
+        "  -v, --log-level N      ESP_LOG level of the node code, 0..5 (default 1)\n"
+        "  -L, --node-lib PATH    firmware library (default: the one next to this program)\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "topology",      required_argument, NULL, 't' },
+        { "loss",          required_argument, NULL, 'l' },
+        { "loss-spread",   required_argument, NULL, 'd' },
+        { "seed",          required_argument, NULL, 's' },
+        { "phase-timeout", required_argument, NULL, 'P' },
+        { "sample-ms",     required_argument, NULL, 'p' },
+        { "window",        required_argument, NULL, 'w' },
+        { "downtime",      required_argument, NULL, 'R' },
+        { "rate",          required_argument, NULL, 'r' },
+        { "payload",       required_argument, NULL, 'b' },
+        { "flood",         required_argument, NULL, 'F' },
+        { "compress",      no_argument,       NULL, 'z' },
+        { "format",        required_argument, NULL, 'f' },
+        { "output",        required_argument, NULL, 'o' },
+        { "log-level",     required_argument, NULL, 'v' },
+        { "node-lib",      required_argument, NULL, 'L' },
+        { "help",          no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    sim_config_t cfg;
+    sim_default_config(&cfg);
+    bench.topology = "grid:10x10";
+    bench.phase_timeout = 120;
+    bench.sample_ms = 250;
+    bench.window = 60;
+    bench.downtime = 1;
+    bench.rate = 0.5;
+    bench.payload_len = 32;
+    const char *format = "json", *output = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:l:d:s:P:p:w:R:r:b:F:zf:o:v:L:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 't': bench.topology = optarg; break;
+        case 'l': bench.loss = atof(optarg); break;
+        case 'd': bench.loss_spread = atof(optarg); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        case 'P': bench.phase_timeout = atof(optarg); break;
+        case 'p': bench.sample_ms = atof(optarg); break;
+        case 'w': bench.window = atof(optarg); break;
+        case 'R': bench.downtime = atof(optarg); break;
+        case 'r': bench.rate = atof(optarg); break;
+        case 'b': bench.payload_len = atoi(optarg); break;
+        case 'F': bench.flood_ttl = atoi(optarg); break;
+        case 'z': bench.compress = true; break;
+        case 'f': format = optarg; break;
+        case 'o': output = optarg; break;
+        case 'v': cfg.log_level = atoi(optarg); break;
+        case 'L': cfg.node_lib = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (bench.payload_len < (int)sizeof(bench_payload_t))
+        bench.payload_len = sizeof(bench_payload_t);
+
+    topo_spec_t topo;
+    if (topo_parse(bench.topology, &topo) != 0) {
+        fprintf(stderr, "bad topology '%s'\n", bench.topology);
+        return 1;
+    }
+    cfg.nodes = bench.nodes = topo.nodes;
+    bench.seed = cfg.seed;
+    if (sim_init(&cfg) != 0) {
+        fprintf(stderr, "simulator init failed\n");
+        return 1;
+    }
+    topo.loss_spread = bench.loss_spread;
+    topo_apply(&topo, bench.loss, cfg.seed);
+    sim_set_frame_classifier(classify_frame);
+    sim_set_user_data_handler(on_user_data);
+    bench.joiner = bench.nodes - 1;
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    uint64_t boot_rng = cfg.seed;
+    for (int n = 0; n < bench.nodes; n++) {
+        boot_rng = boot_rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        if (n != bench.joiner)
+            sim_boot_node(n, (int64_t)((boot_rng >> 33) % 1000000));
+    }
+    bench.boot = wait_for_convergence();
+
+    pick_link();
+    bench.link_break = (phase_result_t){ .converged = false, .time_s = -1, .optimal_time_s = -1 };
+    if (bench.break_a >= 0) {
+        sim_clear_link(bench.break_a, bench.break_b);
+        bench.link_break = wait_for_convergence();
+    }
+
+    sim_boot_node(bench.joiner, sim_now());
+    bench.node_join = wait_for_convergence();
+
+    bench.restarted = pick_central_node();
+    sim_stop_node(bench.restarted);
+    sim_run_until(sim_now() + (int64_t)(bench.downtime * 1e6));
+    sim_boot_node(bench.restarted, sim_now());
+    bench.node_restart = wait_for_convergence();
+
+    sim_node_stats_t before;
+    int64_t start = sim_now();
+    snapshot(&before);
+    sim_run_until(sim_now() + (int64_t)(bench.window * 1e6));
+    bench.steady = measure_window(bench.window, start, &before);
+
+    start = sim_now();
+    snapshot(&before);
+    bench.traffic_end = sim_now() + (int64_t)(bench.window * 1e6);
+    for (int n = 0; n < bench.nodes; n++)
+        if (sim_node_alive(n))
+            sim_spawn_task(n, traffic_task, (void *)(intptr_t)n);
+    // leave time for the last messages to arrive
+    sim_run_until(bench.traffic_end + 2000000);
+    bench.traffic_overhead = measure_window(bench.window, start, &before);
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    bench.wall_s = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "cannot open '%s'\n", output);
+        return 1;
+    }
+    report(out, strcmp(format, "csv") == 0);
+    if (output)
+        fclose(out);
+    sim_cleanup();
+    return 0;
+}
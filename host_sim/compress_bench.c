@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+
+/* Compression ratio and CPU cost of compress.c on JSON-like telemetry records, from one record to a batch
+ * filling the largest message, and on random bytes, which don't compress. The CPU cost is the host's, per KB
+ * of uncompressed message. Prints CSV. */
+
+#define MAX_LEN 4096
+#define RUNS    20000
+
+static volatile int sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint64_t *rng)
+{
+    *rng = *rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*rng >> 33);
+}
+
+/* As many records as fit into len bytes, as a JSON array when there are several. */
+static int telemetry(uint64_t *rng, uint8_t *buf, int len)
+{
+    int n = 0;
+    for (int seq = 0;; seq++) {
+        char record[256];
+        int r = snprintf(record, sizeof(record),
+                         "{\"node\":\"a4:cf:12:0b:%02x:%02x\",\"seq\":%d,\"ts\":%u,\"type\":\"telemetry\","
+                         "\"temperature\":%d.%02d,\"humidity\":%d.%d,\"pressure\":%d.%d,\"battery\":3.%02d,"
+                         "\"rssi\":-%d,\"status\":\"ok\"}",
+                         next_random(rng) % 4, next_random(rng) % 256, 1000 + seq, 1700000000u + seq * 10,
+                         18 + next_random(rng) % 8, next_random(rng) % 100, 40 + next_random(rng) % 20,
+                         next_random(rng) % 10, 1005 + next_random(rng) % 15, next_random(rng) % 10,
+                         60 + next_random(rng) % 40, 50 + next_random(rng) % 40);
+        int need = r + (seq == 0 ? 0 : 1) + 2;
+        if (n + need > len)
+            break;
+        buf[n++] = seq == 0 ? '[' : ',';
+        memcpy(&buf[n], record, r);
+        n += r;
+    }
+    if (n == 0)
+        return 0;
+    buf[n++] = ']';
+    return n;
+}
+
+static void report(const char *kind, const uint8_t *data, int len)
+{
+    static uint8_t packed[MAX_LEN * 2];
+    static uint8_t unpacked[MAX_LEN];
+    int runs = RUNS * 256 / len;
+    int packed_len = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < runs; i++)
+        packed_len = compress_encode(data, len, packed, sizeof(packed));
+    double encode_ns = (now_ns() - start) / runs;
+
+    int acc = 0;
+    start = now_ns();
+    for (int i = 0; i < runs; i++)
+        acc += compress_decode(packed, packed_len, unpacked, sizeof(unpacked));
+    double decode_ns = (now_ns() - start) / runs;
+    sink = acc;
+
+    if (compress_decode(packed, packed_len, unpacked, sizeof(unpacked)) != len || memcmp(unpacked, data, len) != 0) {
+        fprintf(stderr, "%s, %d bytes: decoded message differs\n", kind, len);
+        exit(1);
+    }
+    printf("%s,%d,%d,%.3f,%.2f,%.2f\n", kind, len, packed_len, (double)len / packed_len,
+           encode_ns * 1024 / len / 1000, decode_ns * 1024 / len / 1000);
+}
+
+int main(void)
+{
+    static const int sizes[] = { 230, 1024, MAX_LEN };
+    static uint8_t buf[MAX_LEN];
+    uint64_t rng = 1;
+
+    compress_init();
+    printf("data,bytes,compressed_bytes,ratio,encode_us_per_kb,decode_us_per_kb\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        report("telemetry", buf, telemetry(&rng, buf, sizes[s]));
+    for (int i = 0; i < 1024; i++)
+        buf[i] = (uint8_t)next_random(&rng);
+    report("random", buf, 1024);
+    return 0;
+}
@@ -0,0 +1,2 @@
+/* Host simulator stand-in, see sim_idf.h */
+#include "sim_idf.h"
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "sim.h"
+#include "capture.h"
+
+/* Replays a frame capture of CONFIG_DSDV_CAPTURE through one simulated node running the firmware library.
+ * The received frames are handed to its receive callback at their captured times and from their captured
+ * senders, so update_routing_table() and the forwarding path see the real traffic. The node takes the
+ * address of the captured one, and its unicasts are acknowledged. The report compares the frames it sends
+ * with the captured ones and gives the wall time the replay took, to compare builds on the same traffic.
+ * The library must be built with the frame format options of the captured firmware. */
+
+enum {
+    FRAME_ROUTING,
+    FRAME_USER,
+};
+
+typedef struct {
+    int64_t time_us;         // unwrapped uptime of the captured node
+    uint8_t direction;
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    int8_t rssi;
+    uint16_t len;
+    const uint8_t *data;
+} replay_record_t;
+
+typedef struct {
+    uint64_t frames[2];      // per FRAME_ROUTING / FRAME_USER
+    uint64_t bytes;
+} tx_count_t;
+
+static struct {
+    bool node_set;
+    uint8_t node[ESP_NOW_ETH_ALEN];
+    FILE *save;
+    replay_record_t *records;
+    int record_num, record_cap;
+    uint32_t dropped;
+    int chunks, other_chunks, bad_chunks;
+    bool restarted;          // the capture goes on past a restart of the node, which isn't replayed
+    int64_t last_time;
+    uint64_t rx_frames, rx_bytes;
+    tx_count_t captured, replayed;
+    double wall_s;
+} replay;
+
+static int classify_frame(const uint8_t *data, int len)
+{
+    if (len < (int)sizeof(example_espnow_data_t))
+        return -1;
+    return ((const example_espnow_data_t *)data)->is_userData ? FRAME_USER : FRAME_ROUTING;
+}
+
+static bool parse_mac(const char *s, uint8_t *mac)
+{
+    unsigned b[ESP_NOW_ETH_ALEN];
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ESP_NOW_ETH_ALEN)
+        return false;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        mac[i] = (uint8_t)b[i];
+    return true;
+}
+
+static void add_record(const capture_record_t *record)
+{
+    // the uptime wraps every 71 minutes; a step back by less than half of that is a restart
+    int64_t time_us = (replay.last_time & ~0xFFFFFFFFLL) | record->time_us;
+    if (replay.record_num > 0 && time_us < replay.last_time) {
+        if (replay.last_time - time_us < 0x80000000LL) {
+            replay.restarted = true;
+            return;
+        }
+        time_us += 0x100000000LL;
+    }
+    replay.last_time = time_us;
+
+    if (replay.record_num == replay.record_cap) {
+        replay.record_cap = replay.record_cap ? replay.record_cap * 2 : 1024;
+        replay.records = realloc(replay.records, replay.record_cap * sizeof(replay_record_t));
+        if (replay.records == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    replay_record_t *r = &replay.records[replay.record_num++];
+    r->time_us = time_us;
+    r->direction = record->direction;
+    memcpy(r->peer_addr, record->peer_addr, ESP_NOW_ETH_ALEN);
+    r->rssi = record->rssi;
+    r->len = record->len;
+    r->data = record->data;
+
+    if (record->direction == CAPTURE_RX) {
+        replay.rx_frames++;
+        replay.rx_bytes += record->len;
+    }
+    else {
+        int cls = classify_frame(record->data, record->len);
+        if (cls >= 0)
+            replay.captured.frames[cls]++;
+        replay.captured.bytes += record->len;
+    }
+}
+
+/* Takes the records of a chunk of len bytes. The records point into the chunk, which must stay. */
+static void add_chunk(const uint8_t *chunk, size_t len)
+{
+    capture_header_t header;
+    if (len < sizeof(header)) {
+        replay.bad_chunks++;
+        return;
+    }
+    memcpy(&header, chunk, sizeof(header));
+    if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION || sizeof(header) + header.records_len != len) {
+        replay.bad_chunks++;
+        return;
+    }
+    if (!replay.node_set) {
+        memcpy(replay.node, header.own_addr, ESP_NOW_ETH_ALEN);
+        replay.node_set = true;
+    }
+    if (memcmp(header.own_addr, replay.node, ESP_NOW_ETH_ALEN) != 0) {
+        replay.other_chunks++;
+        return;
+    }
+    replay.chunks++;
+    if (header.dropped > replay.dropped)
+        replay.dropped = header.dropped;
+    if (replay.save)
+        fwrite(chunk, 1, len, replay.save);
+
+    for (size_t pos = sizeof(header); !replay.restarted && pos < len; ) {
+        const capture_record_t *record = (const capture_record_t *)(chunk + pos);
+        if (len - pos < sizeof(capture_record_t) || len - pos - sizeof(capture_record_t) < record->len) {
+            replay.bad_chunks++;
+            return;
+        }
+        add_record(record);
+        pos += sizeof(capture_record_t) + record->len;
+    }
+}
+
+static int hex_digit(int c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+/* A capture file is chunks back to back; anything else is taken for a console log with "DCAP:" lines,
+ * which are decoded in place. The magic reads "DCAP" as well: the version byte after it tells them apart. */
+static void load_capture(uint8_t *buf, size_t len)
+{
+    capture_header_t first;
+    if (len >= sizeof(first) && (memcpy(&first, buf, sizeof(first)), first.magic == CAPTURE_MAGIC)
+        && first.version == CAPTURE_VERSION) {
+        for (size_t pos = 0; !replay.restarted && pos + sizeof(capture_header_t) <= len; ) {
+            capture_header_t header;
+            memcpy(&header, buf + pos, sizeof(header));
+            size_t chunk_len = sizeof(header) + header.records_len;
+            if (header.magic != CAPTURE_MAGIC || pos + chunk_len > len) {
+                replay.bad_chunks++;
+                break;
+            }
+            add_chunk(buf + pos, chunk_len);
+            pos += chunk_len;
+        }
+        return;
+    }
+
+    static const char prefix[] = "DCAP:";
+    for (size_t pos = 0; !replay.restarted && pos < len; ) {
+        while (pos + sizeof(prefix) - 1 <= len && memcmp(buf + pos, prefix, sizeof(prefix) - 1) != 0)
+            pos++;
+        if (pos + sizeof(prefix) - 1 > len)
+            break;
+        size_t start = pos + sizeof(prefix) - 1, out = start;
+        pos = start;
+        while (pos + 1 < len && hex_digit(buf[pos]) >= 0 && hex_digit(buf[pos + 1]) >= 0) {
+            buf[out++] = (uint8_t)(hex_digit(buf[pos]) << 4 | hex_digit(buf[pos + 1]));
+            pos += 2;
+        }
+        // a line cut short by a lost character doesn't end here
+        if (pos < len && !isspace(buf[pos])) {
+            replay.bad_chunks++;
+            continue;
+        }
+        add_chunk(buf + start, out - start);
+    }
+}
+
+static void inject(void *arg)
+{
+    const replay_record_t *r = arg;
+    sim_inject_frame(0, r->peer_addr, r->rssi, r->data, r->len);
+}
+
+static void write_report(FILE *out, int64_t end_us)
+{
+    sim_node_stats_t st;
+    sim_node_stats(0, &st);
+    replay.replayed.frames[FRAME_ROUTING] = st.class_frames[FRAME_ROUTING];
+    replay.replayed.frames[FRAME_USER] = st.class_frames[FRAME_USER];
+    replay.replayed.bytes = st.tx_bytes;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"node\": \"%02x:%02x:%02x:%02x:%02x:%02x\",\n", replay.node[0], replay.node[1], replay.node[2],
+            replay.node[3], replay.node[4], replay.node[5]);
+    fprintf(out, "  \"records\": %d, \"chunks\": %d, \"bad_chunks\": %d, \"other_node_chunks\": %d, \"dropped\": %u,"
+            " \"restarted\": %s,\n", replay.record_num, replay.chunks, replay.bad_chunks, replay.other_chunks,
+            (unsigned)replay.dropped, replay.restarted ? "true" : "false");
+    fprintf(out, "  \"duration_s\": %.3f,\n", end_us / 1e6);
+    fprintf(out, "  \"rx\": {\"frames\": %llu, \"bytes\": %llu},\n",
+            (unsigned long long)replay.rx_frames, (unsigned long long)replay.rx_bytes);
+    const tx_count_t *tx[] = { &replay.captured, &replay.replayed };
+    const char *names[] = { "captured_tx", "replayed_tx" };
+    for (int i = 0; i < 2; i++)
+        fprintf(out, "  \"%s\": {\"routing_frames\": %llu, \"user_frames\": %llu, \"bytes\": %llu},\n", names[i],
+                (unsigned long long)tx[i]->frames[FRAME_ROUTING], (unsigned long long)tx[i]->frames[FRAME_USER],
+                (unsigned long long)tx[i]->bytes);
+    fprintf(out, "  \"wall_s\": %.3f, \"wall_us_per_rx_frame\": %.2f,\n", replay.wall_s,
+            replay.rx_frames ? replay.wall_s * 1e6 / replay.rx_frames : 0.0);
+    char json[8192];
+    if (sim_node_stats_json(0, json, sizeof(json)) < 0)
+        strcpy(json, "null");
+    fprintf(out, "  \"stats\": %s\n}\n", json);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options] CAPTURE\n"
+        "  CAPTURE                capture file, or console log with DCAP: lines\n"
+        "  -n, --node MAC         replay the frames captured by this node (default the first one in CAPTURE)\n"
+        "  -S, --save FILE        write the chunks of the node to FILE as a capture file\n"
+        "  -T, --tail S           go on for S simulated seconds after the last frame (default 1)\n"
+        "  -o, --output FILE      write the report to FILE instead of stdout\n"
+        "  -v, --log-level N      ESP_LOG level of the node code, 0..5 (default 1)\n"
+        "  -L, --node-lib PATH    firmware library (default: the one next to this program)\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "node",      required_argument, NULL, 'n' },
+        { "save",      required_argument, NULL, 'S' },
+        { "tail",      required_argument, NULL, 'T' },
+        { "output",    required_argument, NULL, 'o' },
+        { "log-level", required_argument, NULL, 'v' },
+        { "node-lib",  required_argument, NULL, 'L' },
+        { "help",      no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    sim_config_t cfg;
+    sim_default_config(&cfg);
+    const char *output = NULL, *save = NULL;
+    double tail = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:S:T:o:v:L:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            if (!parse_mac(optarg, replay.node)) {
+                fprintf(stderr, "bad address '%s'\n", optarg);
+                return 1;
+            }
+            replay.node_set = true;
+            break;
+        case 'S': save = optarg; break;
+        case 'T': tail = atof(optarg); break;
+        case 'o': output = optarg; break;
+        case 'v': cfg.log_level = atoi(optarg); break;
+        case 'L': cfg.node_lib = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t *buf = malloc(size > 0 ? size : 1);
+    if (buf == NULL || fread(buf, 1, size, in) != (size_t)size) {
+        fprintf(stderr, "reading %s failed\n", argv[optind]);
+        return 1;
+    }
+    fclose(in);
+    if (save && (replay.save = fopen(save, "wb")) == NULL) {
+        perror(save);
+        return 1;
+    }
+    load_capture(buf, size);
+    if (replay.save)
+        fclose(replay.save);
+    if (replay.record_num == 0) {
+        fprintf(stderr, "no frames captured by the node in %s\n", argv[optind]);
+        return 1;
+    }
+    if (replay.restarted)
+        fprintf(stderr, "the node restarted, the frames after that aren't replayed\n");
+
+    cfg.nodes = 1;
+    if (sim_init(&cfg) != 0) {
+        fprintf(stderr, "simulator init failed\n");
+        return 1;
+    }
+    sim_set_frame_classifier(classify_frame);
+    sim_set_external_acks(true);
+    // the capture has the address of the routing entries, the SoftAP one; the simulator takes the STA one
+    uint8_t sta_addr[ESP_NOW_ETH_ALEN];
+    memcpy(sta_addr, replay.node, ESP_NOW_ETH_ALEN);
+    sta_addr[5] -= ESP_MAC_WIFI_SOFTAP;
+    sim_set_node_mac(0, sta_addr);
+    sim_boot_node(0, 0);
+    for (int i = 0; i < replay.record_num; i++)
+        if (replay.records[i].direction == CAPTURE_RX)
+            sim_schedule(replay.records[i].time_us, inject, &replay.records[i]);
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    int64_t end_us = replay.records[replay.record_num - 1].time_us + (int64_t)(tail * 1e6);
+    sim_run_until(end_us);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    replay.wall_s = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    FILE *out = stdout;
+    if (output && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 1;
+    }
+    write_report(out, end_us);
+    if (out != stdout)
+        fclose(out);
+    sim_cleanup();
+    return 0;
+}
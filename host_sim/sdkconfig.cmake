@@ -0,0 +1,17 @@
+# Turns an ESP-IDF sdkconfig file into the sdkconfig.h the firmware sees on the device.
+# Usage: cmake -DSDKCONFIG=<in> -DOUTPUT=<out> -P sdkconfig.cmake
+file(STRINGS "${SDKCONFIG}" lines)
+set(content "/* Generated from ${SDKCONFIG} */\n#pragma once\n")
+foreach(line IN LISTS lines)
+    if(line MATCHES "^(CONFIG_[A-Za-z0-9_]+)=(.*)$")
+        set(name "${CMAKE_MATCH_1}")
+        set(value "${CMAKE_MATCH_2}")
+        if(value STREQUAL "y")
+            set(value 1)
+        endif()
+        string(APPEND content "#define ${name} ${value}\n")
+    endif()
+endforeach()
+file(WRITE "${OUTPUT}.tmp" "${content}")
+file(COPY_FILE "${OUTPUT}.tmp" "${OUTPUT}" ONLY_IF_DIFFERENT)
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,97 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Deterministic discrete-event simulator running N copies of the firmware in main/.
+ * Virtual time is kept in microseconds; nothing ever waits on the wall clock. */
+
+#define SIM_MAX_NODES 4096
+#define SIM_FRAME_CLASSES 4
+
+typedef struct {
+    int nodes;
+    uint64_t seed;
+    double rate_mbps;        // PHY rate used for airtime, ESP-NOW default is 1 Mbps
+    int mac_retries;         // link-layer retransmissions of an unacknowledged unicast
+    int tx_queue_len;        // frames buffered inside the (simulated) WiFi driver
+    int log_level;           // esp_log_level_t of the node code
+    const char *node_lib;    // path of libdsdv_node.so
+} sim_config_t;
+
+typedef struct {
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t tx_failed;      // unicast frames that were never acknowledged
+    uint64_t tx_dropped;     // esp_now_send() rejected because the driver queue was full
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    uint64_t rx_lost;        // frames lost on the link
+    int64_t airtime_us;
+    int64_t radio_on_us;     // awake, or transmitting while asleep; nodes that are down count as off
+    int panics;
+    uint64_t class_frames[SIM_FRAME_CLASSES];   // per sim_frame_classifier_t class, counted per attempt
+    uint64_t class_bytes[SIM_FRAME_CLASSES];
+} sim_node_stats_t;
+
+typedef void (*sim_event_fn_t)(void *arg);
+typedef void (*sim_task_fn_t)(void *arg);
+typedef int (*sim_frame_classifier_t)(const uint8_t *data, int len);
+typedef void (*sim_user_data_handler_t)(uint8_t *data, int data_len);
+
+void sim_default_config(sim_config_t *config);
+int sim_init(const sim_config_t *config);
+void sim_cleanup(void);
+
+int64_t sim_now(void);
+void sim_schedule(int64_t at_us, sim_event_fn_t fn, void *arg);
+void sim_run_until(int64_t until_us);
+
+void sim_boot_node(int node, int64_t at_us);
+void sim_stop_node(int node);
+bool sim_node_alive(int node);
+void sim_node_mac(int node, uint8_t *mac);
+int sim_node_by_mac(const uint8_t *mac);
+/* Gives the node the STA address of another, e.g. a real node whose capture it replays. Before its first boot. */
+void sim_set_node_mac(int node, const uint8_t *mac);
+void sim_spawn_task(int node, sim_task_fn_t fn, void *arg);
+void sim_node_stats(int node, sim_node_stats_t *stats);
+int sim_current_node(void);
+
+/* Sorts transmitted frames into classes for the per-class counters. */
+void sim_set_frame_classifier(sim_frame_classifier_t classify);
+/* Installed through register_user_data_handler() on every node at each boot. */
+void sim_set_user_data_handler(sim_user_data_handler_t handler);
+
+/* Links are symmetric; loss is the per-attempt frame loss probability in [0, 1). */
+void sim_set_link(int a, int b, double loss);
+void sim_clear_link(int a, int b);
+bool sim_link_up(int a, int b);
+double sim_link_loss(int a, int b);
+int sim_neighbour_count(int node);
+int sim_neighbour(int node, int index);
+
+/* Geometric placement. With a radio range set, links follow distance. */
+void sim_set_range(double range, double loss);
+void sim_get_position(int node, double *x, double *y);
+void sim_set_position(int node, double x, double y);
+
+/* Route query through the node's own routing table. Returns false if no finite route. With zone routing,
+ * *head is the cluster head a message is routed to beyond the zone, -1 to let the node choose it as a
+ * source does, which sets it. head, next_hop and hop_count may be NULL. */
+bool sim_lookup_route(int node, int dest, int *head, int *next_hop, int *hop_count);
+int sim_send_user_data(int node, int dest, const uint8_t *data, int len);
+/* With transmit_compressed_user_data(). Fails on node libraries built without CONFIG_DSDV_COMPRESSION. */
+int sim_send_compressed_user_data(int node, int dest, const uint8_t *data, int len);
+/* Mesh broadcast with flood_user_data(). Fails on node libraries that predate it. */
+int sim_flood_user_data(int node, const uint8_t *data, int len, int ttl);
+/* Hands a frame to the node's receive callback as if src_addr had sent it, for replaying captured traffic. */
+void sim_inject_frame(int node, const uint8_t *src_addr, int rssi, const uint8_t *data, int len);
+/* Unicasts to addresses outside the simulation are acknowledged instead of failing. */
+void sim_set_external_acks(bool acked);
+/* Snapshot of the node's stats.h counters as JSON, counted since its last boot. Returns the length or -1. */
+int sim_node_stats_json(int node, char *buf, size_t len);
+
+#endif
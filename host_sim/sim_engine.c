@@ -0,0 +1,1511 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ucontext.h>
+
+#include "sim_idf.h"
+#include "sim.h"
+
+#define TICK_US          (1000000 / CONFIG_FREERTOS_HZ)
+#define TASK_STACK_MIN   (64 * 1024)
+#define BOOT_DELAY_US    300000   // time a panicked node needs to come back up
+#define PHY_PREAMBLE_US  192      // long preamble, 802.11b
+#define ESPNOW_OVERHEAD  43       // MAC header, FCS and ESP-NOW vendor specific element
+#define ACK_US           (PHY_PREAMBLE_US + 14 * 8 + 10)
+#define DIFS_US          50
+#define SLOT_US          20
+#define CW_MIN           15
+
+/* ---------- events ---------- */
+typedef enum {
+    EV_CALLBACK,
+    EV_TASK_WAKE,
+    EV_TX_END,
+    EV_BOOT,
+} sim_event_kind_t;
+
+typedef struct {
+    int64_t time;
+    uint64_t seq;
+    sim_event_kind_t kind;
+    sim_event_fn_t fn;
+    void *arg;
+    uint64_t token;
+    int node;
+} sim_event_t;
+
+/* ---------- tasks and queues ---------- */
+struct sim_queue {
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    bool deleted;
+    struct sim_task *rx_waiters;
+    struct sim_task *tx_waiters;
+};
+
+struct sim_task {
+    ucontext_t ctx;
+    void *stack;
+    int node;
+    TaskFunction_t fn;
+    void *param;
+    char name[24];
+    bool finished;
+    uint64_t wake_token;
+    struct sim_queue *waiting_on;
+    struct sim_task *next_waiter;
+    struct sim_task *next_in_node;
+    struct sim_queue notify;      // task notification value as a counting semaphore
+};
+
+/* ---------- radio ---------- */
+typedef struct {
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    int len;
+    int attempts;
+    bool delivered;               // the MAC drops retransmissions of a frame that already arrived
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} sim_frame_t;
+
+typedef struct {
+    uint8_t addr[ESP_NOW_ETH_ALEN];
+    bool encrypt;
+} sim_peer_t;
+
+/* NVS item. The store of a node is kept across its restarts. */
+typedef struct sim_nvs_item {
+    struct sim_nvs_item *next;
+    int ns;                       // index into nvs_namespaces
+    char key[16];
+    int type;                     // NVS_TYPE_*
+    size_t len;
+    uint8_t data[];
+} sim_nvs_item_t;
+
+enum {
+    NVS_TYPE_U16,
+    NVS_TYPE_BLOB,
+};
+
+typedef struct {
+    void (*start_dsdv_routing)(void);
+    esp_err_t (*transmit_user_data)(uint8_t *mac_addr, uint8_t *data, int data_len);
+    esp_err_t (*flood_user_data)(uint8_t *data, int data_len, uint8_t ttl);   // optional
+    esp_err_t (*transmit_compressed_user_data)(uint8_t *mac_addr, uint8_t *data, int data_len); // optional
+    esp_err_t (*lookup_route)(uint8_t *mac_addr, uint8_t *nextHop_addr, uint8_t *hop_count);
+    esp_err_t (*lookup_zone_route)(uint8_t *mac_addr, uint8_t *head_addr, uint8_t *nextHop_addr, uint8_t *hop_count); // optional
+    void (*register_user_data_handler)(sim_user_data_handler_t handler);
+    void (*stats_snapshot)(void *snapshot);
+    int (*stats_to_json)(const void *snapshot, char *buf, size_t len);
+} sim_node_api_t;
+
+typedef struct {
+    bool alive;
+    uint32_t generation;
+    int64_t boot_time;
+    void *lib;
+    sim_node_api_t api;
+    struct sim_task *tasks;
+
+    uint64_t rng;
+    double x, y;
+    int *neighbours;
+    int neighbour_num;
+    int neighbour_cap;
+
+    bool espnow_ready;
+    esp_now_recv_cb_t recv_cb;
+    esp_now_send_cb_t send_cb;
+    sim_peer_t peers[ESP_NOW_MAX_TOTAL_PEER_NUM];
+    int peer_num;
+
+    sim_frame_t *tx_ring;
+    int tx_head;
+    int tx_count;
+    bool tx_busy;
+
+    uint16_t wake_window;                 // [ms] radio on at the start of each wake interval, 65535 for always
+    uint16_t wake_interval;               // [ms]
+    int64_t wake_since;                   // when they were set, the start of the first interval
+    uint8_t channel;                      // set with esp_wifi_set_channel(); frames are heard on the same channel only
+    bool mac_set;
+    uint8_t mac[ESP_NOW_ETH_ALEN];        // STA address given with sim_set_node_mac()
+
+    sim_node_stats_t stats;
+    sim_nvs_item_t *nvs;
+} sim_node_t;
+
+esp_log_level_t sim_log_level = ESP_LOG_ERROR;
+
+static sim_config_t cfg;
+static sim_node_t *nodes;
+static float *link_loss;               // n*n, negative when there is no link
+static double radio_range;
+static double range_loss;
+static uint64_t radio_rng;
+static char lib_dir[64];
+static unsigned lib_copies;
+static sim_frame_classifier_t frame_classifier;
+static sim_user_data_handler_t user_data_handler;
+static bool external_acks;
+static int mac_overrides;                 // nodes whose address was set with sim_set_node_mac()
+
+static sim_event_t *heap;
+static size_t heap_len, heap_cap;
+static uint64_t event_seq;
+static int64_t now_us;
+
+static ucontext_t sched_ctx;
+static struct sim_task *cur_task;
+static int cur_node = -1;
+
+static const char *TAG = "sim";
+
+/* ---------- helpers ---------- */
+static uint64_t rng_next(uint64_t *state)
+{
+    // splitmix64, good enough and fully reproducible
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state)
+{
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void fatal(const char *msg)
+{
+    fprintf(stderr, "sim: fatal: %s\n", msg);
+    exit(2);
+}
+
+static void *xcalloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+    if (p == NULL)
+        fatal("out of memory");
+    return p;
+}
+
+static sim_node_t *current(void)
+{
+    if (cur_node < 0)
+        fatal("ESP-IDF call outside of a node context");
+    return &nodes[cur_node];
+}
+
+/* ---------- radio sleep ---------- */
+/* Time the radio was on under the current wake window, from when it was set up to t. */
+static int64_t wake_on_time(const sim_node_t *node, int64_t t)
+{
+    int64_t elapsed = t - node->wake_since;
+    if (node->wake_window == 65535 || node->wake_window >= node->wake_interval)
+        return elapsed;
+    int64_t interval = node->wake_interval * 1000LL, window = node->wake_window * 1000LL;
+    return elapsed / interval * window + (elapsed % interval < window ? elapsed % interval : window);
+}
+
+/* Sleeping nodes receive nothing; they still wake up to transmit. */
+static bool radio_awake(int n)
+{
+    const sim_node_t *node = &nodes[n];
+    if (node->wake_window == 65535 || node->wake_window >= node->wake_interval)
+        return true;
+    return (now_us - node->wake_since) % (node->wake_interval * 1000LL) < node->wake_window * 1000LL;
+}
+
+/* Adds up the radio-on time before the wake window changes. */
+static void radio_account(sim_node_t *node)
+{
+    node->stats.radio_on_us += wake_on_time(node, now_us);
+    node->wake_since = now_us;
+}
+
+/* ---------- event heap ---------- */
+static bool event_before(const sim_event_t *a, const sim_event_t *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void push_event(sim_event_t ev)
+{
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = realloc(heap, heap_cap * sizeof(sim_event_t));
+        if (heap == NULL)
+            fatal("out of memory");
+    }
+    ev.seq = event_seq++;
+    size_t i = heap_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!event_before(&ev, &heap[parent]))
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = ev;
+}
+
+static sim_event_t pop_event(void)
+{
+    sim_event_t top = heap[0];
+    sim_event_t last = heap[--heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap_len)
+            break;
+        if (child + 1 < heap_len && event_before(&heap[child + 1], &heap[child]))
+            child++;
+        if (!event_before(&heap[child], &last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_len > 0)
+        heap[i] = last;
+    return top;
+}
+
+void sim_schedule(int64_t at_us, sim_event_fn_t fn, void *arg)
+{
+    sim_event_t ev = { .time = at_us < now_us ? now_us : at_us, .kind = EV_CALLBACK, .fn = fn, .arg = arg, .node = -1 };
+    push_event(ev);
+}
+
+int64_t sim_now(void)
+{
+    return now_us;
+}
+
+/* ---------- cooperative tasks ---------- */
+static void schedule_wake(struct sim_task *task, int64_t at_us)
+{
+    sim_event_t ev = { .time = at_us, .kind = EV_TASK_WAKE, .arg = task, .token = task->wake_token, .node = task->node };
+    push_event(ev);
+}
+
+static void task_trampoline(void)
+{
+    struct sim_task *self = cur_task;
+    self->fn(self->param);
+    self->finished = true;
+    swapcontext(&self->ctx, &sched_ctx);
+}
+
+static struct sim_task *task_create(int node, TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param)
+{
+    struct sim_task *task = xcalloc(1, sizeof(*task));
+    size_t stack_size = (size_t)stack_depth * 4;
+    if (stack_size < TASK_STACK_MIN)
+        stack_size = TASK_STACK_MIN;
+    task->stack = malloc(stack_size);
+    if (task->stack == NULL)
+        fatal("out of memory");
+    task->node = node;
+    task->fn = fn;
+    task->param = param;
+    task->notify.length = UINT_MAX;
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "task");
+
+    getcontext(&task->ctx);
+    task->ctx.uc_stack.ss_sp = task->stack;
+    task->ctx.uc_stack.ss_size = stack_size;
+    task->ctx.uc_link = &sched_ctx;
+    makecontext(&task->ctx, task_trampoline, 0);
+
+    task->next_in_node = nodes[node].tasks;
+    nodes[node].tasks = task;
+    schedule_wake(task, now_us);
+    return task;
+}
+
+static void unlink_waiter(struct sim_task *task)
+{
+    struct sim_queue *q = task->waiting_on;
+    if (q == NULL)
+        return;
+    struct sim_task **lists[2] = { &q->rx_waiters, &q->tx_waiters };
+    for (int l = 0; l < 2; l++)
+        for (struct sim_task **it = lists[l]; *it; it = &(*it)->next_waiter)
+            if (*it == task) {
+                *it = task->next_waiter;
+                break;
+            }
+    task->waiting_on = NULL;
+    task->next_waiter = NULL;
+}
+
+/* Only the stack is released: pending wake events may still point at the task. */
+static void task_release(struct sim_task *task)
+{
+    sim_node_t *node = &nodes[task->node];
+    for (struct sim_task **it = &node->tasks; *it; it = &(*it)->next_in_node)
+        if (*it == task) {
+            *it = task->next_in_node;
+            break;
+        }
+    free(task->stack);
+    task->stack = NULL;
+}
+
+static void task_kill(struct sim_task *task)
+{
+    unlink_waiter(task);
+    task->finished = true;
+    task->wake_token++;
+}
+
+static void run_task(struct sim_task *task)
+{
+    int prev_node = cur_node;
+    cur_task = task;
+    cur_node = task->node;
+    task->wake_token++;
+    swapcontext(&sched_ctx, &task->ctx);
+    cur_task = NULL;
+    cur_node = prev_node;
+    if (task->finished)
+        task_release(task);
+}
+
+/* Give control back to the scheduler; returns once one of the pending wake events fires. */
+static void task_yield(void)
+{
+    struct sim_task *self = cur_task;
+    swapcontext(&self->ctx, &sched_ctx);
+}
+
+static void task_block(struct sim_queue *q, bool sending, int64_t deadline)
+{
+    struct sim_task *self = cur_task;
+    struct sim_task **list = sending ? &q->tx_waiters : &q->rx_waiters;
+    while (*list)
+        list = &(*list)->next_waiter;
+    *list = self;
+    self->waiting_on = q;
+    if (deadline != INT64_MAX)
+        schedule_wake(self, deadline);
+    task_yield();
+    unlink_waiter(self);
+}
+
+static void wake_first(struct sim_task **list)
+{
+    struct sim_task *task = *list;
+    if (task == NULL)
+        return;
+    *list = task->next_waiter;
+    task->next_waiter = NULL;
+    task->waiting_on = NULL;
+    schedule_wake(task, now_us);
+}
+
+static int64_t deadline_after(TickType_t ticks)
+{
+    return ticks == portMAX_DELAY ? INT64_MAX : now_us + (int64_t)ticks * TICK_US;
+}
+
+/* ---------- FreeRTOS ---------- */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *q = xcalloc(1, sizeof(*q));
+    q->length = length;
+    q->item_size = item_size;
+    q->items = xcalloc(length ? length : 1, item_size ? item_size : 1);
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct sim_queue *q = xQueueCreate(1, 0);
+    q->count = 1;
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    struct sim_queue *q = xQueueCreate(max_count, 0);
+    q->count = initial_count;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    // the storage is kept alive: firmware error paths may still touch a deleted queue
+    if (q != NULL)
+        q->deleted = true;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks_to_wait)
+{
+    if (q == NULL || q->deleted)
+        return pdFALSE;
+    int64_t deadline = deadline_after(ticks_to_wait);
+    while (q->count == q->length) {
+        if (ticks_to_wait == 0 || cur_task == NULL || now_us >= deadline)
+            return pdFALSE;
+        task_block(q, true, deadline);
+    }
+    if (q->item_size && item)
+        memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    q->count++;
+    wake_first(&q->rx_waiters);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *buffer, TickType_t ticks_to_wait)
+{
+    if (q == NULL || q->deleted)
+        return pdFALSE;
+    int64_t deadline = deadline_after(ticks_to_wait);
+    while (q->count == 0) {
+        if (ticks_to_wait == 0 || cur_task == NULL || now_us >= deadline)
+            return pdFALSE;
+        task_block(q, false, deadline);
+        if (q->deleted)
+            return pdFALSE;
+    }
+    if (q->item_size && buffer)
+        memcpy(buffer, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    wake_first(&q->tx_waiters);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    return q ? q->count : 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id)
+{
+    (void)priority;
+    (void)core_id;
+    struct sim_task *task = task_create(current() - nodes, fn, name, stack_depth, param);
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (cur_task == NULL)
+        fatal("vTaskDelay() outside of a task");
+    schedule_wake(cur_task, now_us + (int64_t)ticks * TICK_US);
+    task_yield();
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == cur_task) {
+        if (cur_task == NULL)
+            fatal("vTaskDelete(NULL) outside of a task");
+        cur_task->finished = true;
+        task_yield();
+        fatal("deleted task resumed");
+    }
+    task_kill(task);
+    task_release(task);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return cur_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    xQueueSend(&task->notify, NULL, 0);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    struct sim_queue *q = &cur_task->notify;
+    if (xQueueReceive(q, NULL, ticks_to_wait) != pdTRUE)
+        return 0;
+    uint32_t value = q->count + 1;
+    if (clear_count_on_exit)
+        q->count = 0;
+    return value;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / TICK_US);
+}
+
+/* ---------- misc ESP-IDF ---------- */
+void sim_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+    fprintf(stderr, "[%12.6f] n%-4d %c (%s) ", now_us / 1e6, cur_node, letters[level], tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void sim_error_check_failed(esp_err_t rc, const char *file, int line, const char *expr)
+{
+    if (cur_node < 0) {
+        fprintf(stderr, "sim: ESP_ERROR_CHECK failed (0x%x) at %s:%d: %s\n", rc, file, line, expr);
+        abort();
+    }
+    // the device would abort() and reset: stop the node and reboot it
+    int node = cur_node;
+    fprintf(stderr, "[%12.6f] n%-4d ESP_ERROR_CHECK failed (0x%x) at %s:%d: %s -> reboot\n",
+            now_us / 1e6, node, rc, file, line, expr);
+    nodes[node].stats.panics++;
+    sim_stop_node(node);
+    sim_boot_node(node, now_us + BOOT_DELAY_US);
+    if (cur_task != NULL) {
+        task_yield();
+        fatal("panicked task resumed");
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    if (cur_node < 0)
+        return now_us;
+    return now_us - nodes[cur_node].boot_time;
+}
+
+uint32_t esp_random(void)
+{
+    return (uint32_t)rng_next(&current()->rng);
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    for (size_t i = 0; i < len; i++)
+        out[i] = (uint8_t)esp_random();
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+uint16_t esp_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len)
+{
+    // same as the ROM crc16_le(): reflected CCITT polynomial with inverted in/out
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+    return ~crc;
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+
+esp_err_t nvs_flash_erase(void)
+{
+    sim_node_t *node = current();
+    while (node->nvs) {
+        sim_nvs_item_t *next = node->nvs->next;
+        free(node->nvs);
+        node->nvs = next;
+    }
+    return ESP_OK;
+}
+
+/* ---------- nvs ---------- */
+#define NVS_MAX_NAMESPACES 16
+
+static char nvs_namespaces[NVS_MAX_NAMESPACES][16];
+static int nvs_namespace_num;
+
+/* A handle is the namespace index + 1 above the node index, so a node can't use another node's handle. */
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    if (strlen(name) >= sizeof(nvs_namespaces[0]))
+        return ESP_ERR_NVS_INVALID_NAME;
+    int ns = 0;
+    while (ns < nvs_namespace_num && strcmp(nvs_namespaces[ns], name) != 0)
+        ns++;
+    if (ns == nvs_namespace_num) {
+        if (nvs_namespace_num == NVS_MAX_NAMESPACES)
+            return ESP_ERR_NVS_INVALID_NAME;
+        strcpy(nvs_namespaces[nvs_namespace_num++], name);
+    }
+    *out_handle = ((nvs_handle_t)(ns + 1) << 16) | (nvs_handle_t)cur_node;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+esp_err_t nvs_commit(nvs_handle_t handle) { (void)handle; return ESP_OK; }
+
+static sim_nvs_item_t **nvs_find(nvs_handle_t handle, const char *key)
+{
+    sim_nvs_item_t **item = &current()->nvs;
+    int ns = (int)(handle >> 16) - 1;
+    while (*item && ((*item)->ns != ns || strcmp((*item)->key, key) != 0))
+        item = &(*item)->next;
+    return item;
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, int type, void *out, size_t *len)
+{
+    if ((handle & 0xFFFF) != (nvs_handle_t)cur_node || (handle >> 16) == 0)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    sim_nvs_item_t *item = *nvs_find(handle, key);
+    if (item == NULL)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (item->type != type)
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    if (out != NULL && *len < item->len) {
+        *len = item->len;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (out != NULL)
+        memcpy(out, item->data, item->len);
+    *len = item->len;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, int type, const void *value, size_t len)
+{
+    if ((handle & 0xFFFF) != (nvs_handle_t)cur_node || (handle >> 16) == 0)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (strlen(key) >= sizeof(((sim_nvs_item_t *)0)->key))
+        return ESP_ERR_NVS_INVALID_NAME;
+    sim_nvs_item_t **slot = nvs_find(handle, key);
+    sim_nvs_item_t *item = realloc(*slot, sizeof(sim_nvs_item_t) + len);
+    if (item == NULL)
+        fatal("out of memory");
+    if (*slot == NULL) {
+        item->next = NULL;
+        item->ns = (int)(handle >> 16) - 1;
+        strcpy(item->key, key);
+    }
+    item->type = type;
+    item->len = len;
+    memcpy(item->data, value, len);
+    *slot = item;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value)
+{
+    size_t len = sizeof(*out_value);
+    return nvs_get(handle, key, NVS_TYPE_U16, out_value, &len);
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return nvs_set(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return nvs_get(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) { (void)config; return ESP_OK; }
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) { (void)storage; return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { (void)mode; return ESP_OK; }
+esp_err_t esp_wifi_start(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+    (void)second;
+    if (primary < 1 || primary > 14)
+        return ESP_ERR_INVALID_ARG;
+    current()->channel = primary;
+    return ESP_OK;
+}
+esp_err_t esp_wifi_set_protocol(wifi_interface_t ifx, uint8_t protocol_bitmap) { (void)ifx; (void)protocol_bitmap; return ESP_OK; }
+
+esp_err_t esp_wifi_connectionless_module_set_wake_interval(uint16_t wake_interval)
+{
+    sim_node_t *node = current();
+    radio_account(node);
+    node->wake_interval = wake_interval;
+    return ESP_OK;
+}
+
+void sim_node_mac(int node, uint8_t *mac)
+{
+    if (nodes[node].mac_set) {
+        memcpy(mac, nodes[node].mac, ESP_NOW_ETH_ALEN);
+        return;
+    }
+    // STA address; byte 5 stays even so the SoftAP address (+1) never carries
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    mac[2] = (uint8_t)(node >> 16);
+    mac[3] = (uint8_t)(node >> 8);
+    mac[4] = (uint8_t)node;
+    mac[5] = 0x00;
+}
+
+int sim_node_by_mac(const uint8_t *mac)
+{
+    for (int n = 0; mac_overrides > 0 && n < cfg.nodes; n++)
+        if (nodes[n].mac_set && memcmp(nodes[n].mac, mac, ESP_NOW_ETH_ALEN) == 0)
+            return n;
+    if (mac[0] != 0x02 || mac[1] != 0x00 || mac[5] != 0x00)
+        return -1;
+    int node = (mac[2] << 16) | (mac[3] << 8) | mac[4];
+    return node < cfg.nodes && !nodes[node].mac_set ? node : -1;
+}
+
+void sim_set_node_mac(int node, const uint8_t *mac)
+{
+    if (!nodes[node].mac_set)
+        mac_overrides++;
+    nodes[node].mac_set = true;
+    memcpy(nodes[node].mac, mac, ESP_NOW_ETH_ALEN);
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    sim_node_mac(current() - nodes, mac);
+    mac[5] += (uint8_t)type;
+    return ESP_OK;
+}
+
+/* ---------- ESP-NOW ---------- */
+static bool is_broadcast(const uint8_t *mac)
+{
+    static const uint8_t bcast[ESP_NOW_ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    return memcmp(mac, bcast, ESP_NOW_ETH_ALEN) == 0;
+}
+
+static sim_peer_t *find_peer(sim_node_t *node, const uint8_t *addr)
+{
+    for (int i = 0; i < node->peer_num; i++)
+        if (memcmp(node->peers[i].addr, addr, ESP_NOW_ETH_ALEN) == 0)
+            return &node->peers[i];
+    return NULL;
+}
+
+esp_err_t esp_now_init(void)
+{
+    sim_node_t *node = current();
+    node->espnow_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void)
+{
+    sim_node_t *node = current();
+    node->espnow_ready = false;
+    node->recv_cb = NULL;
+    node->send_cb = NULL;
+    node->peer_num = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    node->recv_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    node->send_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_set_pmk(const uint8_t *pmk)
+{
+    (void)pmk;
+    return current()->espnow_ready ? ESP_OK : ESP_ERR_ESPNOW_NOT_INIT;
+}
+
+esp_err_t esp_now_set_wake_window(uint16_t window)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    radio_account(node);
+    node->wake_window = window;
+    return ESP_OK;
+}
+
+static int encrypted_peers(sim_node_t *node)
+{
+    int n = 0;
+    for (int i = 0; i < node->peer_num; i++)
+        n += node->peers[i].encrypt;
+    return n;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    if (peer == NULL)
+        return ESP_ERR_ESPNOW_ARG;
+    if (find_peer(node, peer->peer_addr))
+        return ESP_ERR_ESPNOW_EXIST;
+    if (node->peer_num == ESP_NOW_MAX_TOTAL_PEER_NUM)
+        return ESP_ERR_ESPNOW_FULL;
+    if (peer->encrypt && encrypted_peers(node) == ESP_NOW_MAX_ENCRYPT_PEER_NUM)
+        return ESP_ERR_ESPNOW_FULL;
+    sim_peer_t *slot = &node->peers[node->peer_num++];
+    memcpy(slot->addr, peer->peer_addr, ESP_NOW_ETH_ALEN);
+    slot->encrypt = peer->encrypt;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    sim_peer_t *slot = find_peer(node, peer_addr);
+    if (slot == NULL)
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    *slot = node->peers[--node->peer_num];
+    return ESP_OK;
+}
+
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t *peer)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    sim_peer_t *slot = find_peer(node, peer->peer_addr);
+    if (slot == NULL)
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    if (peer->encrypt && !slot->encrypt && encrypted_peers(node) == ESP_NOW_MAX_ENCRYPT_PEER_NUM)
+        return ESP_ERR_ESPNOW_FULL;
+    slot->encrypt = peer->encrypt;
+    return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr)
+{
+    return find_peer(current(), peer_addr) != NULL;
+}
+
+esp_err_t esp_now_get_peer_num(esp_now_peer_num_t *num)
+{
+    sim_node_t *node = current();
+    num->total_num = node->peer_num;
+    num->encrypt_num = encrypted_peers(node);
+    return ESP_OK;
+}
+
+static int64_t frame_airtime(int len)
+{
+    return PHY_PREAMBLE_US + (int64_t)llround((ESPNOW_OVERHEAD + len) * 8 / cfg.rate_mbps);
+}
+
+static void tx_start(int n)
+{
+    sim_node_t *node = &nodes[n];
+    if (node->tx_busy || node->tx_count == 0)
+        return;
+    sim_frame_t *frame = &node->tx_ring[node->tx_head];
+    int64_t backoff = DIFS_US + (int64_t)(rng_next(&radio_rng) % (CW_MIN + 1)) * SLOT_US;
+    int64_t airtime = frame_airtime(frame->len) + (is_broadcast(frame->dest) ? 0 : ACK_US);
+    node->tx_busy = true;
+    node->stats.tx_frames++;
+    node->stats.tx_bytes += frame->len;
+    if (frame_classifier) {
+        int cls = frame_classifier(frame->data, frame->len);
+        if (cls >= 0 && cls < SIM_FRAME_CLASSES) {
+            node->stats.class_frames[cls]++;
+            node->stats.class_bytes[cls] += frame->len;
+        }
+    }
+    node->stats.airtime_us += airtime;
+    if (!radio_awake(n))
+        node->stats.radio_on_us += airtime;
+    sim_event_t ev = { .time = now_us + backoff + airtime, .kind = EV_TX_END, .node = n, .token = node->generation };
+    push_event(ev);
+}
+
+static int rssi_between(int a, int b)
+{
+    if (radio_range > 0) {
+        double d = hypot(nodes[a].x - nodes[b].x, nodes[a].y - nodes[b].y);
+        return -40 - (int)lround(50.0 * d / radio_range);
+    }
+    return -60 - (int)lround(30.0 * sim_link_loss(a, b));
+}
+
+static void deliver(int src, int dst, const sim_frame_t *frame)
+{
+    sim_node_t *rx = &nodes[dst];
+    if (!rx->alive || !rx->espnow_ready || rx->recv_cb == NULL)
+        return;
+    uint8_t src_addr[ESP_NOW_ETH_ALEN];
+    uint8_t des_addr[ESP_NOW_ETH_ALEN];
+    wifi_pkt_rx_ctrl_t rx_ctrl = { 0 };
+    sim_node_mac(src, src_addr);
+    memcpy(des_addr, frame->dest, ESP_NOW_ETH_ALEN);
+    rx_ctrl.rssi = rssi_between(src, dst);
+    rx_ctrl.channel = rx->channel;
+    rx_ctrl.sig_len = frame->len;
+    esp_now_recv_info_t info = { .src_addr = src_addr, .des_addr = des_addr, .rx_ctrl = &rx_ctrl };
+
+    rx->stats.rx_frames++;
+    rx->stats.rx_bytes += frame->len;
+    int prev_node = cur_node;
+    cur_node = dst;
+    rx->recv_cb(&info, frame->data, frame->len);
+    cur_node = prev_node;
+}
+
+void sim_inject_frame(int n, const uint8_t *src_addr, int rssi, const uint8_t *data, int len)
+{
+    sim_node_t *rx = &nodes[n];
+    if (!rx->alive || !rx->espnow_ready || rx->recv_cb == NULL || len <= 0 || len > ESP_NOW_MAX_DATA_LEN)
+        return;
+    uint8_t src[ESP_NOW_ETH_ALEN], des_addr[ESP_NOW_ETH_ALEN];
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+    wifi_pkt_rx_ctrl_t rx_ctrl = { 0 };
+    memcpy(src, src_addr, ESP_NOW_ETH_ALEN);
+    sim_node_mac(n, des_addr);
+    memcpy(frame, data, len);
+    rx_ctrl.rssi = rssi;
+    rx_ctrl.channel = rx->channel;
+    rx_ctrl.sig_len = len;
+    esp_now_recv_info_t info = { .src_addr = src, .des_addr = des_addr, .rx_ctrl = &rx_ctrl };
+
+    rx->stats.rx_frames++;
+    rx->stats.rx_bytes += len;
+    int prev_node = cur_node;
+    cur_node = n;
+    rx->recv_cb(&info, frame, len);
+    cur_node = prev_node;
+}
+
+void sim_set_external_acks(bool acked)
+{
+    external_acks = acked;
+}
+
+static bool attempt_succeeds(int a, int b)
+{
+    if (!sim_link_up(a, b))
+        return false;
+    if (rng_uniform(&radio_rng) < sim_link_loss(a, b)) {
+        nodes[b].stats.rx_lost++;
+        return false;
+    }
+    return true;
+}
+
+static void tx_end(int n)
+{
+    sim_node_t *node = &nodes[n];
+    sim_frame_t *frame = &node->tx_ring[node->tx_head];
+    esp_now_send_status_t status = ESP_NOW_SEND_SUCCESS;
+    node->tx_busy = false;
+
+    if (is_broadcast(frame->dest)) {
+        for (int i = 0; i < node->neighbour_num; i++) {
+            int m = node->neighbours[i];
+            if (nodes[m].alive && radio_awake(m) && nodes[m].channel == node->channel && attempt_succeeds(n, m))
+                deliver(n, m, frame);
+        }
+    }
+    else {
+        // the acknowledgement crosses the same link: when it is lost, the frame arrived but counts as failed
+        int dst = sim_node_by_mac(frame->dest);
+        bool acked = false;
+        if (dst >= 0 && nodes[dst].alive && radio_awake(dst) && nodes[dst].channel == node->channel
+            && attempt_succeeds(n, dst)) {
+            if (!frame->delivered)
+                deliver(n, dst, frame);
+            frame->delivered = true;
+            acked = nodes[dst].alive && attempt_succeeds(dst, n);
+        }
+        else if (dst < 0 && external_acks)
+            acked = true;
+        if (!acked) {
+            if (frame->attempts++ < cfg.mac_retries) {
+                tx_start(n);
+                return;
+            }
+            status = ESP_NOW_SEND_FAIL;
+            node->stats.tx_failed++;
+        }
+    }
+    if (!node->alive)
+        return;   // the receive path may have crashed this node
+
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    memcpy(dest, frame->dest, ESP_NOW_ETH_ALEN);
+    node->tx_head = (node->tx_head + 1) % cfg.tx_queue_len;
+    node->tx_count--;
+    tx_start(n);
+
+    if (node->send_cb) {
+        int prev_node = cur_node;
+        cur_node = n;
+        node->send_cb(dest, status);
+        cur_node = prev_node;
+    }
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+    sim_node_t *node = current();
+    if (!node->espnow_ready)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    if (peer_addr == NULL || data == NULL || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+        return ESP_ERR_ESPNOW_ARG;
+    if (find_peer(node, peer_addr) == NULL)
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    if (node->tx_count == cfg.tx_queue_len) {
+        node->stats.tx_dropped++;
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+    sim_frame_t *frame = &node->tx_ring[(node->tx_head + node->tx_count++) % cfg.tx_queue_len];
+    memcpy(frame->dest, peer_addr, ESP_NOW_ETH_ALEN);
+    memcpy(frame->data, data, len);
+    frame->len = (int)len;
+    frame->attempts = 0;
+    frame->delivered = false;
+    tx_start(node - nodes);
+    return ESP_OK;
+}
+
+/* ---------- topology ---------- */
+static float *link_at(int a, int b)
+{
+    return &link_loss[(size_t)a * cfg.nodes + b];
+}
+
+static void neighbour_add(sim_node_t *node, int m)
+{
+    for (int i = 0; i < node->neighbour_num; i++)
+        if (node->neighbours[i] == m)
+            return;
+    if (node->neighbour_num == node->neighbour_cap) {
+        node->neighbour_cap = node->neighbour_cap ? node->neighbour_cap * 2 : 8;
+        node->neighbours = realloc(node->neighbours, sizeof(int) * node->neighbour_cap);
+        if (node->neighbours == NULL)
+            fatal("out of memory");
+    }
+    node->neighbours[node->neighbour_num++] = m;
+}
+
+static void neighbour_remove(sim_node_t *node, int m)
+{
+    for (int i = 0; i < node->neighbour_num; i++)
+        if (node->neighbours[i] == m) {
+            node->neighbours[i] = node->neighbours[--node->neighbour_num];
+            return;
+        }
+}
+
+void sim_set_link(int a, int b, double loss)
+{
+    if (a == b)
+        return;
+    *link_at(a, b) = (float)loss;
+    *link_at(b, a) = (float)loss;
+    if (loss >= 0) {
+        neighbour_add(&nodes[a], b);
+        neighbour_add(&nodes[b], a);
+    }
+    else {
+        neighbour_remove(&nodes[a], b);
+        neighbour_remove(&nodes[b], a);
+    }
+}
+
+void sim_clear_link(int a, int b)
+{
+    sim_set_link(a, b, -1.0);
+}
+
+bool sim_link_up(int a, int b)
+{
+    return a != b && *link_at(a, b) >= 0.0f;
+}
+
+double sim_link_loss(int a, int b)
+{
+    return *link_at(a, b);
+}
+
+int sim_neighbour_count(int node)
+{
+    return nodes[node].neighbour_num;
+}
+
+int sim_neighbour(int node, int index)
+{
+    return nodes[node].neighbours[index];
+}
+
+void sim_set_range(double range, double loss)
+{
+    radio_range = range;
+    range_loss = loss;
+}
+
+void sim_get_position(int node, double *x, double *y)
+{
+    *x = nodes[node].x;
+    *y = nodes[node].y;
+}
+
+void sim_set_position(int node, double x, double y)
+{
+    nodes[node].x = x;
+    nodes[node].y = y;
+    if (radio_range <= 0)
+        return;
+    for (int m = 0; m < cfg.nodes; m++) {
+        if (m == node)
+            continue;
+        if (hypot(nodes[m].x - x, nodes[m].y - y) <= radio_range)
+            sim_set_link(node, m, range_loss);
+        else
+            sim_clear_link(node, m);
+    }
+}
+
+/* ---------- node life cycle ---------- */
+static void load_node_library(int n)
+{
+    // each node gets a private copy of the library, hence private static state
+    char path[128];
+    snprintf(path, sizeof(path), "%s/node%u.so", lib_dir, lib_copies++);
+    int in = open(cfg.node_lib, O_RDONLY);
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    if (in < 0 || out < 0)
+        fatal("cannot copy node library");
+    char buf[65536];
+    ssize_t got;
+    while ((got = read(in, buf, sizeof(buf))) > 0)
+        if (write(out, buf, got) != got)
+            fatal("cannot copy node library");
+    close(in);
+    close(out);
+
+    sim_node_t *node = &nodes[n];
+    node->lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+    if (node->lib == NULL) {
+        fprintf(stderr, "sim: %s\n", dlerror());
+        fatal("cannot load node library");
+    }
+    node->api.start_dsdv_routing = (void (*)(void))dlsym(node->lib, "start_dsdv_routing");
+    node->api.transmit_user_data = (esp_err_t (*)(uint8_t *, uint8_t *, int))dlsym(node->lib, "transmit_user_data");
+    node->api.flood_user_data = (esp_err_t (*)(uint8_t *, int, uint8_t))dlsym(node->lib, "flood_user_data");
+    node->api.transmit_compressed_user_data = (esp_err_t (*)(uint8_t *, uint8_t *, int))dlsym(node->lib, "transmit_compressed_user_data");
+    node->api.lookup_route = (esp_err_t (*)(uint8_t *, uint8_t *, uint8_t *))dlsym(node->lib, "lookup_route");
+    node->api.lookup_zone_route = (esp_err_t (*)(uint8_t *, uint8_t *, uint8_t *, uint8_t *))dlsym(node->lib, "lookup_zone_route");
+    node->api.register_user_data_handler = (void (*)(sim_user_data_handler_t))dlsym(node->lib, "register_user_data_handler");
+    node->api.stats_snapshot = (void (*)(void *))dlsym(node->lib, "stats_snapshot");
+    node->api.stats_to_json = (int (*)(const void *, char *, size_t))dlsym(node->lib, "stats_to_json");
+    if (node->api.start_dsdv_routing == NULL || node->api.transmit_user_data == NULL || node->api.lookup_route == NULL
+            || node->api.register_user_data_handler == NULL || node->api.stats_snapshot == NULL || node->api.stats_to_json == NULL)
+        fatal("node library misses the DSDV API");
+}
+
+static void boot_node(int n)
+{
+    sim_node_t *node = &nodes[n];
+    if (node->alive)
+        return;
+    if (node->lib)
+        dlclose(node->lib);
+    load_node_library(n);
+    node->alive = true;
+    node->boot_time = now_us;
+    node->espnow_ready = false;
+    node->recv_cb = NULL;
+    node->send_cb = NULL;
+    node->peer_num = 0;
+    node->tx_head = 0;
+    node->tx_count = 0;
+    node->tx_busy = false;
+    node->wake_window = 65535;
+    node->wake_interval = 100;
+    node->wake_since = now_us;
+    node->channel = CONFIG_ESPNOW_CHANNEL;
+
+    int prev_node = cur_node;
+    cur_node = n;
+    node->api.register_user_data_handler(user_data_handler);
+    xTaskCreate((TaskFunction_t)node->api.start_dsdv_routing, "start_dsdv_routing", 4096, NULL, 4, NULL);
+    cur_node = prev_node;
+}
+
+void sim_boot_node(int node, int64_t at_us)
+{
+    sim_event_t ev = { .time = at_us < now_us ? now_us : at_us, .kind = EV_BOOT, .node = node };
+    push_event(ev);
+}
+
+void sim_stop_node(int n)
+{
+    sim_node_t *node = &nodes[n];
+    if (!node->alive)
+        return;
+    radio_account(node);
+    node->alive = false;
+    node->generation++;
+    node->espnow_ready = false;
+    node->tx_busy = false;
+    struct sim_task *task = node->tasks;
+    while (task) {
+        struct sim_task *next = task->next_in_node;
+        task_kill(task);
+        if (task != cur_task)
+            task_release(task);
+        task = next;
+    }
+}
+
+bool sim_node_alive(int node)
+{
+    return nodes[node].alive;
+}
+
+void sim_spawn_task(int n, sim_task_fn_t fn, void *arg)
+{
+    task_create(n, fn, "sim_task", 4096, arg);
+}
+
+void sim_node_stats(int node, sim_node_stats_t *stats)
+{
+    *stats = nodes[node].stats;
+    if (nodes[node].alive)
+        stats->radio_on_us += wake_on_time(&nodes[node], now_us);
+}
+
+int sim_current_node(void)
+{
+    return cur_node;
+}
+
+void sim_set_frame_classifier(sim_frame_classifier_t classify)
+{
+    frame_classifier = classify;
+}
+
+void sim_set_user_data_handler(sim_user_data_handler_t handler)
+{
+    user_data_handler = handler;
+}
+
+bool sim_lookup_route(int n, int dest, int *head, int *next_hop, int *hop_count)
+{
+    sim_node_t *node = &nodes[n];
+    if (!node->alive)
+        return false;
+    uint8_t dest_mac[ESP_NOW_ETH_ALEN], nh_mac[ESP_NOW_ETH_ALEN], hops;
+    sim_node_mac(dest, dest_mac);
+    int prev_node = cur_node;
+    cur_node = n;
+    esp_err_t ret;
+    if (head != NULL && node->api.lookup_zone_route != NULL) {
+        uint8_t head_mac[ESP_NOW_ETH_ALEN] = {0};
+        if (*head >= 0)
+            sim_node_mac(*head, head_mac);
+        ret = node->api.lookup_zone_route(dest_mac, head_mac, nh_mac, &hops);
+        *head = sim_node_by_mac(head_mac);
+    }
+    else
+        ret = node->api.lookup_route(dest_mac, nh_mac, &hops);
+    cur_node = prev_node;
+    if (ret != ESP_OK)
+        return false;
+    if (next_hop)
+        *next_hop = sim_node_by_mac(nh_mac);
+    if (hop_count)
+        *hop_count = hops;
+    return true;
+}
+
+static int send_user_data(int n, int dest, const uint8_t *data, int len, bool compressed)
+{
+    sim_node_t *node = &nodes[n];
+    if (!node->alive || (compressed && node->api.transmit_compressed_user_data == NULL))
+        return ESP_FAIL;
+    uint8_t dest_mac[ESP_NOW_ETH_ALEN];
+    if (dest < 0)
+        memset(dest_mac, 0xFF, ESP_NOW_ETH_ALEN);
+    else
+        sim_node_mac(dest, dest_mac);
+    int prev_node = cur_node;
+    cur_node = n;
+    esp_err_t ret = compressed ? node->api.transmit_compressed_user_data(dest_mac, (uint8_t *)data, len)
+                               : node->api.transmit_user_data(dest_mac, (uint8_t *)data, len);
+    cur_node = prev_node;
+    return ret;
+}
+
+int sim_send_user_data(int n, int dest, const uint8_t *data, int len)
+{
+    return send_user_data(n, dest, data, len, false);
+}
+
+int sim_send_compressed_user_data(int n, int dest, const uint8_t *data, int len)
+{
+    return send_user_data(n, dest, data, len, true);
+}
+
+int sim_flood_user_data(int n, const uint8_t *data, int len, int ttl)
+{
+    sim_node_t *node = &nodes[n];
+    if (!node->alive || node->api.flood_user_data == NULL)
+        return ESP_FAIL;
+    int prev_node = cur_node;
+    cur_node = n;
+    esp_err_t ret = node->api.flood_user_data((uint8_t *)data, len, ttl);
+    cur_node = prev_node;
+    return ret;
+}
+
+int sim_node_stats_json(int n, char *buf, size_t len)
+{
+    sim_node_t *node = &nodes[n];
+    if (node->lib == NULL)
+        return -1;
+    // large enough for stats_snapshot_t, which the engine doesn't know
+    uint64_t snapshot[256];
+    int prev_node = cur_node;
+    cur_node = n;
+    node->api.stats_snapshot(snapshot);
+    int ret = node->api.stats_to_json(snapshot, buf, len);
+    cur_node = prev_node;
+    return ret;
+}
+
+/* ---------- main loop ---------- */
+void sim_run_until(int64_t until_us)
+{
+    while (heap_len > 0 && heap[0].time <= until_us) {
+        sim_event_t ev = pop_event();
+        now_us = ev.time;
+        switch (ev.kind) {
+        case EV_CALLBACK:
+            ev.fn(ev.arg);
+            break;
+        case EV_TASK_WAKE:
+        {
+            struct sim_task *task = ev.arg;
+            // a stale token means the task was already woken (or killed) by another event
+            if (ev.token == task->wake_token && !task->finished)
+                run_task(task);
+            break;
+        }
+        case EV_TX_END:
+            if (nodes[ev.node].alive && ev.token == nodes[ev.node].generation)
+                tx_end(ev.node);
+            break;
+        case EV_BOOT:
+            boot_node(ev.node);
+            break;
+        }
+    }
+    if (now_us < until_us)
+        now_us = until_us;
+}
+
+/* libdsdv_node.so is built next to the tools, so they find it wherever they are started from. */
+static const char *default_node_lib(void)
+{
+    static char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0)
+        return "./libdsdv_node.so";
+    path[len] = '\0';
+    char *slash = strrchr(path, '/');
+    if (slash == NULL || (size_t)(slash - path) + sizeof("/libdsdv_node.so") > sizeof(path))
+        return "./libdsdv_node.so";
+    strcpy(slash, "/libdsdv_node.so");
+    return path;
+}
+
+void sim_default_config(sim_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->nodes = 16;
+    config->seed = 1;
+    config->rate_mbps = 1.0;
+    config->mac_retries = 4;
+    config->tx_queue_len = 16;
+    config->log_level = ESP_LOG_ERROR;
+    config->node_lib = default_node_lib();
+}
+
+int sim_init(const sim_config_t *config)
+{
+    cfg = *config;
+    if (cfg.nodes <= 0 || cfg.nodes > SIM_MAX_NODES || cfg.tx_queue_len <= 0)
+        return -1;
+    sim_log_level = (esp_log_level_t)cfg.log_level;
+    nodes = xcalloc(cfg.nodes, sizeof(sim_node_t));
+    link_loss = xcalloc((size_t)cfg.nodes * cfg.nodes, sizeof(float));
+    for (size_t i = 0; i < (size_t)cfg.nodes * cfg.nodes; i++)
+        link_loss[i] = -1.0f;
+    radio_rng = cfg.seed ^ 0xD1B54A32D192ED03ULL;
+    for (int n = 0; n < cfg.nodes; n++) {
+        nodes[n].rng = cfg.seed * 0x100000001B3ULL + (uint64_t)n;
+        nodes[n].tx_ring = xcalloc(cfg.tx_queue_len, sizeof(sim_frame_t));
+    }
+    snprintf(lib_dir, sizeof(lib_dir), "/tmp/dsdv_sim.XXXXXX");
+    if (mkdtemp(lib_dir) == NULL)
+        return -1;
+    ESP_LOGI(TAG, "%d nodes, seed %llu", cfg.nodes, (unsigned long long)cfg.seed);
+    return 0;
+}
+
+void sim_cleanup(void)
+{
+    // node libraries stay mapped: their tasks' stacks are released with the process
+    rmdir(lib_dir);
+}
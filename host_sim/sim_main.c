@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "sim.h"
+#include "sim_topology.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -t, --topology SPEC    line:N | grid:WxH | rgg:N:RANGE | full:N (default grid:10x10)\n"
+        "  -l, --loss P           per-frame loss probability on every link (default 0)\n"
+        "  -d, --duration SEC     simulated time (default 60)\n"
+        "  -s, --seed N           random seed (default 1)\n"
+        "  -j, --boot-jitter MS   nodes boot uniformly within this window (default 1000)\n"
+        "  -T, --trace FILE       link/mobility trace, see sim_topology.h\n"
+        "  -S, --stats FILE       write the counters of every node as a JSON array at the end\n"
+        "  -p, --sample-ms MS     route check interval (default 100)\n"
+        "  -v, --log-level N      ESP_LOG level of the node code, 0..5 (default 1)\n"
+        "  -L, --node-lib PATH    firmware library (default: the one next to this program)\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "topology",    required_argument, NULL, 't' },
+        { "loss",        required_argument, NULL, 'l' },
+        { "duration",    required_argument, NULL, 'd' },
+        { "seed",        required_argument, NULL, 's' },
+        { "boot-jitter", required_argument, NULL, 'j' },
+        { "trace",       required_argument, NULL, 'T' },
+        { "stats",       required_argument, NULL, 'S' },
+        { "sample-ms",   required_argument, NULL, 'p' },
+        { "log-level",   required_argument, NULL, 'v' },
+        { "node-lib",    required_argument, NULL, 'L' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    sim_config_t cfg;
+    sim_default_config(&cfg);
+    const char *topo_spec = "grid:10x10";
+    const char *trace = NULL, *stats = NULL;
+    double loss = 0.0, duration = 60.0, jitter_ms = 1000.0, sample_ms = 100.0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:l:d:s:j:T:S:p:v:L:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 't': topo_spec = optarg; break;
+        case 'l': loss = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+        case 'j': jitter_ms = atof(optarg); break;
+        case 'T': trace = optarg; break;
+        case 'S': stats = optarg; break;
+        case 'p': sample_ms = atof(optarg); break;
+        case 'v': cfg.log_level = atoi(optarg); break;
+        case 'L': cfg.node_lib = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    topo_spec_t topo;
+    if (topo_parse(topo_spec, &topo) != 0) {
+        fprintf(stderr, "bad topology '%s'\n", topo_spec);
+        return 1;
+    }
+    cfg.nodes = topo.nodes;
+    if (sim_init(&cfg) != 0) {
+        fprintf(stderr, "simulator init failed\n");
+        return 1;
+    }
+    topo_apply(&topo, loss, cfg.seed);
+    if (trace && topo_load_trace(trace) != 0) {
+        fprintf(stderr, "cannot load trace '%s'\n", trace);
+        return 1;
+    }
+
+    uint64_t boot_rng = cfg.seed;
+    for (int n = 0; n < cfg.nodes; n++) {
+        boot_rng = boot_rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        sim_boot_node(n, (int64_t)((boot_rng >> 33) % (uint64_t)(jitter_ms * 1000 + 1)));
+    }
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    int64_t end_us = (int64_t)(duration * 1e6), step_us = (int64_t)(sample_ms * 1000);
+    int64_t converged_at = -1;
+    topo_route_report_t report = { 0 };
+    printf("time_s,pairs,valid,optimal\n");
+    for (int64_t t = step_us; t <= end_us; t += step_us) {
+        sim_run_until(t);
+        topo_check_routes(&report);
+        printf("%.3f,%d,%d,%d\n", t / 1e6, report.pairs, report.valid, report.optimal);
+        if (report.valid == report.pairs && converged_at < 0)
+            converged_at = t;
+        else if (report.valid != report.pairs)
+            converged_at = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    uint64_t frames = 0, bytes = 0, failed = 0, dropped = 0, lost = 0;
+    int64_t radio_on = 0;
+    int panics = 0;
+    for (int n = 0; n < cfg.nodes; n++) {
+        sim_node_stats_t st;
+        sim_node_stats(n, &st);
+        frames += st.tx_frames;
+        bytes += st.tx_bytes;
+        failed += st.tx_failed;
+        dropped += st.tx_dropped;
+        lost += st.rx_lost;
+        radio_on += st.radio_on_us;
+        panics += st.panics;
+    }
+    fprintf(stderr, "nodes %d, simulated %.1f s in %.2f s wall (%.0fx)\n", cfg.nodes, duration, wall, duration / wall);
+    if (converged_at >= 0)
+        fprintf(stderr, "routes valid since %.3f s\n", converged_at / 1e6);
+    else
+        fprintf(stderr, "not converged: %d/%d pairs valid\n", report.valid, report.pairs);
+    fprintf(stderr, "tx frames %llu, tx bytes %llu, unacked %llu, driver drops %llu, lost %llu, panics %d\n",
+            (unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)failed,
+            (unsigned long long)dropped, (unsigned long long)lost, panics);
+    fprintf(stderr, "radio on %.1f%% of the time\n", 100.0 * radio_on / (cfg.nodes * duration * 1e6));
+
+    if (stats) {
+        FILE *out = fopen(stats, "w");
+        if (out == NULL) {
+            fprintf(stderr, "cannot write '%s'\n", stats);
+            return 1;
+        }
+        static char json[8192];
+        fprintf(out, "[\n");
+        for (int n = 0; n < cfg.nodes; n++) {
+            if (sim_node_stats_json(n, json, sizeof(json)) < 0)
+                snprintf(json, sizeof(json), "null");
+            fprintf(out, "  {\"node\": %d, \"stats\": %s}%s\n", n, json, n + 1 < cfg.nodes ? "," : "");
+        }
+        fprintf(out, "]\n");
+        fclose(out);
+    }
+    sim_cleanup();
+    return 0;
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "sim_topology.h"
+
+typedef enum {
+    TRACE_DOWN,
+    TRACE_UP,
+    TRACE_LOSS,
+    TRACE_MOVE,
+    TRACE_KILL,
+    TRACE_BOOT,
+} trace_op_t;
+
+typedef struct {
+    trace_op_t op;
+    int a;
+    int b;
+    double x;
+    double y;
+} trace_event_t;
+
+static int node_count;
+static int *bfs_dist;
+static int *bfs_queue;
+static int *adj_start;     // CSR adjacency of the live graph, rebuilt per check
+static int *adj;
+static int *route_next;
+static int *route_hops;
+static int *route_len;     // hops to the destination along next hops, <0 when broken
+static int *route_head;    // cluster head a source routes to with zone routing, -1 for none
+
+int topo_parse(const char *spec, topo_spec_t *topo)
+{
+    memset(topo, 0, sizeof(*topo));
+    if (sscanf(spec, "line:%d", &topo->nodes) == 1)
+        topo->kind = TOPO_LINE;
+    else if (sscanf(spec, "grid:%dx%d", &topo->width, &topo->height) == 2) {
+        topo->kind = TOPO_GRID;
+        topo->nodes = topo->width * topo->height;
+    }
+    else if (sscanf(spec, "rgg:%d:%lf", &topo->nodes, &topo->range) == 2)
+        topo->kind = TOPO_RGG;
+    else if (sscanf(spec, "full:%d", &topo->nodes) == 1)
+        topo->kind = TOPO_FULL;
+    else
+        return -1;
+    return topo->nodes > 1 && topo->nodes <= SIM_MAX_NODES ? 0 : -1;
+}
+
+static double spread_loss(const topo_spec_t *topo, double loss, uint64_t *state)
+{
+    if (topo->loss_spread <= 0)
+        return loss;
+    *state ^= *state << 13; *state ^= *state >> 7; *state ^= *state << 17;
+    double u = (*state >> 11) * (1.0 / 9007199254740992.0);
+    double p = loss + (2 * u - 1) * topo->loss_spread;
+    return p < 0 ? 0 : p > 0.95 ? 0.95 : p;
+}
+
+void topo_apply(const topo_spec_t *topo, double loss, uint64_t seed)
+{
+    uint64_t state = seed * 0x2545F4914F6CDD1DULL + 1;
+    node_count = topo->nodes;
+    free(bfs_dist);
+    free(bfs_queue);
+    free(adj_start);
+    bfs_dist = malloc(sizeof(int) * node_count);
+    bfs_queue = malloc(sizeof(int) * node_count);
+    adj_start = malloc(sizeof(int) * (node_count + 1));
+    route_next = realloc(route_next, sizeof(int) * node_count);
+    route_hops = realloc(route_hops, sizeof(int) * node_count);
+    route_len = realloc(route_len, sizeof(int) * node_count);
+    route_head = realloc(route_head, sizeof(int) * node_count);
+
+    switch (topo->kind) {
+    case TOPO_LINE:
+        for (int n = 0; n + 1 < node_count; n++) {
+            sim_set_position(n, n, 0);
+            sim_set_link(n, n + 1, spread_loss(topo, loss, &state));
+        }
+        sim_set_position(node_count - 1, node_count - 1, 0);
+        break;
+    case TOPO_GRID:
+        for (int y = 0; y < topo->height; y++)
+            for (int x = 0; x < topo->width; x++) {
+                int n = y * topo->width + x;
+                sim_set_position(n, x, y);
+                if (x + 1 < topo->width)
+                    sim_set_link(n, n + 1, spread_loss(topo, loss, &state));
+                if (y + 1 < topo->height)
+                    sim_set_link(n, n + topo->width, spread_loss(topo, loss, &state));
+            }
+        break;
+    case TOPO_RGG:
+    {
+        sim_set_range(topo->range, loss);
+        for (int n = 0; n < node_count; n++) {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            double x = (state >> 11) * (1.0 / 9007199254740992.0);
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            double y = (state >> 11) * (1.0 / 9007199254740992.0);
+            sim_set_position(n, x, y);
+        }
+        break;
+    }
+    case TOPO_FULL:
+        for (int a = 0; a < node_count; a++)
+            for (int b = a + 1; b < node_count; b++)
+                sim_set_link(a, b, spread_loss(topo, loss, &state));
+        break;
+    }
+}
+
+static void apply_trace_event(void *arg)
+{
+    trace_event_t *ev = arg;
+    switch (ev->op) {
+    case TRACE_DOWN:
+        sim_clear_link(ev->a, ev->b);
+        break;
+    case TRACE_UP:
+    case TRACE_LOSS:
+        sim_set_link(ev->a, ev->b, ev->x);
+        break;
+    case TRACE_MOVE:
+        sim_set_position(ev->a, ev->x, ev->y);
+        break;
+    case TRACE_KILL:
+        sim_stop_node(ev->a);
+        break;
+    case TRACE_BOOT:
+        sim_boot_node(ev->a, sim_now());
+        break;
+    }
+    free(ev);
+}
+
+int topo_load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    char line[256];
+    int line_nbr = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_nbr++;
+        char op[16];
+        double t_ms;
+        trace_event_t ev = { 0 };
+        if (line[0] == '#' || sscanf(line, "%lf %15s", &t_ms, op) != 2)
+            continue;
+        const char *args = line;
+        int fields = 0;
+        if (strcmp(op, "down") == 0) {
+            ev.op = TRACE_DOWN;
+            fields = sscanf(args, "%*f %*s %d %d", &ev.a, &ev.b) == 2;
+        }
+        else if (strcmp(op, "up") == 0) {
+            ev.op = TRACE_UP;
+            int n = sscanf(args, "%*f %*s %d %d %lf", &ev.a, &ev.b, &ev.x);
+            if (n == 2)
+                ev.x = 0.0;
+            fields = n >= 2;
+        }
+        else if (strcmp(op, "loss") == 0) {
+            ev.op = TRACE_LOSS;
+            fields = sscanf(args, "%*f %*s %d %d %lf", &ev.a, &ev.b, &ev.x) == 3;
+        }
+        else if (strcmp(op, "move") == 0) {
+            ev.op = TRACE_MOVE;
+            fields = sscanf(args, "%*f %*s %d %lf %lf", &ev.a, &ev.x, &ev.y) == 3;
+        }
+        else if (strcmp(op, "kill") == 0) {
+            ev.op = TRACE_KILL;
+            fields = sscanf(args, "%*f %*s %d", &ev.a) == 1;
+        }
+        else if (strcmp(op, "boot") == 0) {
+            ev.op = TRACE_BOOT;
+            fields = sscanf(args, "%*f %*s %d", &ev.a) == 1;
+        }
+        if (!fields || ev.a < 0 || ev.a >= node_count || ev.b < 0 || ev.b >= node_count) {
+            fprintf(stderr, "%s:%d: bad trace line\n", path, line_nbr);
+            fclose(f);
+            return -1;
+        }
+        trace_event_t *copy = malloc(sizeof(*copy));
+        *copy = ev;
+        sim_schedule((int64_t)(t_ms * 1000), apply_trace_event, copy);
+    }
+    fclose(f);
+    return 0;
+}
+
+static void build_adjacency(void)
+{
+    int edges = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        edges = 0;
+        for (int n = 0; n < node_count; n++) {
+            adj_start[n] = edges;
+            if (!sim_node_alive(n))
+                continue;
+            for (int i = 0; i < sim_neighbour_count(n); i++) {
+                int m = sim_neighbour(n, i);
+                if (sim_node_alive(m)) {
+                    if (pass)
+                        adj[edges] = m;
+                    edges++;
+                }
+            }
+        }
+        adj_start[node_count] = edges;
+        if (pass == 0) {
+            free(adj);
+            adj = malloc(sizeof(int) * (edges + 1));
+        }
+    }
+}
+
+/* Hop distance over links that are up between alive nodes, -1 if unreachable. */
+static void bfs_from(int from)
+{
+    for (int n = 0; n < node_count; n++)
+        bfs_dist[n] = -1;
+    int head = 0, tail = 0;
+    bfs_dist[from] = 0;
+    bfs_queue[tail++] = from;
+    while (head < tail) {
+        int n = bfs_queue[head++];
+        for (int e = adj_start[n]; e < adj_start[n + 1]; e++) {
+            int m = adj[e];
+            if (bfs_dist[m] < 0) {
+                bfs_dist[m] = bfs_dist[n] + 1;
+                bfs_queue[tail++] = m;
+            }
+        }
+    }
+}
+
+int topo_hop_distance(int from, int to)
+{
+    build_adjacency();
+    bfs_from(to);
+    return bfs_dist[from];
+}
+
+void topo_distances_to(int dest, int *dist)
+{
+    build_adjacency();
+    bfs_from(dest);
+    memcpy(dist, bfs_dist, sizeof(int) * node_count);
+}
+
+void topo_check_routes(topo_route_report_t *report)
+{
+    memset(report, 0, sizeof(*report));
+    build_adjacency();
+    for (int dest = 0; dest < node_count; dest++) {
+        if (!sim_node_alive(dest))
+            continue;
+        bfs_from(dest);
+
+        // with zone routing, a message follows the head its source chose: the sources that chose the same
+        // head are checked together, each node looked up once towards it and the next-hop chains resolved
+        // with memoisation
+        for (int n = 0; n < node_count; n++) {
+            route_head[n] = -1;
+            if (n != dest && bfs_dist[n] >= 0)
+                sim_lookup_route(n, dest, &route_head[n], NULL, NULL);
+        }
+        for (int group = 0; group < node_count; group++) {
+            if (group == dest || bfs_dist[group] < 0 || route_head[group] == -2)
+                continue;
+            int head = route_head[group];
+            for (int n = 0; n < node_count; n++) {
+                route_len[n] = -1;
+                if (n == dest) {
+                    route_len[n] = 0;
+                    continue;
+                }
+                int via = head;
+                if (bfs_dist[n] < 0 || !sim_lookup_route(n, dest, &via, &route_next[n], &route_hops[n])
+                        || route_next[n] < 0 || !sim_link_up(n, route_next[n]) || bfs_dist[route_next[n]] < 0)
+                    route_len[n] = -2;
+            }
+            for (int src = group; src < node_count; src++) {
+                if (src == dest || bfs_dist[src] < 0 || route_head[src] != head)
+                    continue;
+                route_head[src] = -2;   // checked
+                report->pairs++;
+
+                int at = src, depth = 0;
+                while (route_len[at] == -1 && depth <= node_count) {
+                    bfs_queue[depth++] = at;
+                    route_len[at] = -3;   // on the current chain: meeting it again is a loop
+                    at = route_next[at];
+                }
+                int len = route_len[at] >= 0 ? route_len[at] : -2;
+                while (depth > 0) {
+                    int n = bfs_queue[--depth];
+                    len = len >= 0 ? len + 1 : -2;
+                    route_len[n] = len;
+                }
+                if (route_len[src] < 0)
+                    continue;
+                report->valid++;
+                if (route_len[src] == bfs_dist[src] && route_hops[src] == route_len[src])
+                    report->optimal++;
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SIM_TOPOLOGY_H
+#define SIM_TOPOLOGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Topology specs:
+ *   line:N          chain of N nodes
+ *   grid:WxH        4-neighbour grid
+ *   rgg:N:R         random geometric graph in the unit square, radio range R
+ *   full:N          every node hears every other node
+ */
+typedef enum {
+    TOPO_LINE,
+    TOPO_GRID,
+    TOPO_RGG,
+    TOPO_FULL,
+} topo_kind_t;
+
+typedef struct {
+    topo_kind_t kind;
+    int nodes;
+    int width;
+    int height;
+    double range;
+    double loss_spread;      // per-link loss drawn from loss +- loss_spread (line, grid and full)
+} topo_spec_t;
+
+typedef struct {
+    int pairs;               // ordered pairs of alive nodes that are connected
+    int valid;               // ... with a loop-free route that reaches the destination
+    int optimal;             // ... whose route is also a shortest path
+} topo_route_report_t;
+
+int topo_parse(const char *spec, topo_spec_t *topo);
+void topo_apply(const topo_spec_t *topo, double loss, uint64_t seed);
+
+/* Trace lines: "<t_ms> down A B", "<t_ms> up A B [loss]", "<t_ms> loss A B P",
+ * "<t_ms> move N X Y", "<t_ms> kill N", "<t_ms> boot N". Lines starting with '#' are ignored. */
+int topo_load_trace(const char *path);
+
+void topo_check_routes(topo_route_report_t *report);
+int topo_hop_distance(int from, int to);
+void topo_distances_to(int dest, int *dist);
+
+#endif
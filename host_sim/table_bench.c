@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "routing_table.h"
+
+/* Lookup cost of the hashed routing table against the linear memcmp scan it replaced,
+ * for hits and misses at several table sizes. Prints CSV. */
+
+#define LOOKUPS 2000000
+
+static RoutingEntry_t linear_table[MAX_NODES];
+static int linear_entries;
+static volatile int sink;
+
+static int linear_find(const uint8_t *mac_addr)
+{
+    for (int index = 0; index < linear_entries; index++)
+        if (memcmp(linear_table[index].destination_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+            return index;
+    return -1;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void random_mac(uint64_t *rng, uint8_t *mac)
+{
+    *rng = *rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t bits = *rng >> 16;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        mac[i] = (uint8_t)(bits >> (8 * i));
+    mac[0] &= 0xFC;
+}
+
+static double time_lookups(int (*find)(const uint8_t *), uint8_t (*keys)[ESP_NOW_ETH_ALEN], int key_num)
+{
+    double start = now_ns();
+    int acc = 0;
+    for (int i = 0; i < LOOKUPS; i++)
+        acc += find(keys[i % key_num]);
+    sink = acc;
+    return (now_ns() - start) / LOOKUPS;
+}
+
+int main(void)
+{
+    static const int sizes[] = { 10, 100, 1000 };
+    static uint8_t hits[MAX_NODES][ESP_NOW_ETH_ALEN];
+    static uint8_t misses[MAX_NODES][ESP_NOW_ETH_ALEN];
+
+    printf("entries,linear_hit_ns,hash_hit_ns,linear_miss_ns,hash_miss_ns\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        uint64_t rng = 42;
+        routing_table_init();
+        linear_entries = 0;
+        for (int i = 0; i < n; i++) {
+            random_mac(&rng, hits[i]);
+            random_mac(&rng, misses[i]);
+            misses[i][0] |= 0x02;   // locally administered, hits are not: a miss never matches
+            routing_table_add(hits[i]);
+            memcpy(linear_table[linear_entries++].destination_addr, hits[i], ESP_NOW_ETH_ALEN);
+        }
+
+        printf("%d,%.1f,%.1f,%.1f,%.1f\n", n,
+               time_lookups(linear_find, hits, n), time_lookups(routing_table_find, hits, n),
+               time_lookups(linear_find, misses, n), time_lookups(routing_table_find, misses, n));
+    }
+    return 0;
+}
@@ -3,90 +3,397 @@
 #include "DSDV_protocol.h"
 
 
+enum {
+    DSDV_FULL_DUMP,
+    DSDV_INCREMENTAL_UPDATE,
+    DSDV_ZONE_SUMMARY,
+};
+
+/* Which entries go into an advertisement. */
+enum {
+    ADVERTISE_ALL,
+    ADVERTISE_CHANGED,                    // changed entries whose settling time has passed
+    ADVERTISE_URGENT,                     // changed entries that broke or were repaired
+};
+
+/* On-air form of a routing entry. The next hop is the sender of the frame. */
 typedef struct {
     uint8_t destination_addr[ESP_NOW_ETH_ALEN];
-    uint8_t nextHop_addr[ESP_NOW_ETH_ALEN];
     uint8_t hop_count;
     uint16_t seq_num;
-    int64_t last_update_time;
-} __attribute__((packed)) RoutingEntry_t;
+#if CONFIG_DSDV_METRIC_ETX
+    uint16_t metric;                      // [1/ETX_ONE] expected transmissions to the destination
+#endif
+#if CONFIG_DSDV_ZONE_ROUTING
+    uint8_t flags;                        // ADVERT_FLAG_*
+#endif
+} __attribute__((packed)) RoutingAdvert_t;
+
+#define ADVERT_FLAG_HEAD    0x01         // the destination is a cluster head
+
+/* Routing advertisement: as many entries as fit into one ESP-NOW frame. */
+typedef struct {
+    uint8_t type;                         // full dump or incremental update.
+    uint8_t entries_nbr;                  // number of routing entries that follow.
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+    uint16_t period;                      // [ms] sender's current advertisement period
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+    uint8_t channel;                      // sender's data channel
+#endif
+    RoutingAdvert_t entries[0];
+} __attribute__((packed)) RoutingPacket_t;
+
+#define MAX_ENTRIES_PER_PACKET ((ESP_NOW_MAX_DATA_LEN - sizeof(example_espnow_data_t) - sizeof(RoutingPacket_t)) / sizeof(RoutingAdvert_t))
+
+/* Destinations within a cluster head's zone, passed on by every node once. A zone too large for one frame is
+ * announced in several parts. */
+typedef struct {
+    uint8_t type;                         // DSDV_ZONE_SUMMARY
+    uint8_t members_nbr;
+    uint8_t part;
+    uint8_t head_addr[ESP_NOW_ETH_ALEN];
+    uint16_t seq_num;                     // head's sequence number when it sent the summary
+    uint8_t members[0][ESP_NOW_ETH_ALEN];
+} __attribute__((packed)) ZoneSummary_t;
+
+#define MAX_MEMBERS_PER_PACKET ((ESP_NOW_MAX_DATA_LEN - sizeof(example_espnow_data_t) - sizeof(ZoneSummary_t)) / ESP_NOW_ETH_ALEN)
+#define MAX_SUMMARY_PARTS   32
+
+
+/* Values of example_espnow_data_t.is_userData for user data. */
+enum {
+    USER_DATA_MESSAGE= 1,
+    USER_DATA_FRAGMENT,
+    USER_DATA_FLOOD,
+    USER_DATA_BUNDLE,                     // small messages for the same next hop, see bundle.h
+};
 
+// flag of is_userData: the message, or the one the fragment belongs to, is compressed; see compress.h
+#define USER_DATA_COMPRESSED 0x80
 
 typedef struct {
     uint8_t dest_mac[ESP_NOW_ETH_ALEN];
+#if CONFIG_DSDV_ZONE_ROUTING
+    uint8_t head_mac[ESP_NOW_ETH_ALEN];   // head the source routes to beyond the zone, all zeros if none
+#endif
     uint8_t payload[0];
 } __attribute__((packed)) user_data_t;
 
+/* Fragment of a message too large for one frame. It starts like user_data_t, so relays forward both alike. */
+typedef struct {
+    uint8_t dest_mac[ESP_NOW_ETH_ALEN];
+#if CONFIG_DSDV_ZONE_ROUTING
+    uint8_t head_mac[ESP_NOW_ETH_ALEN];
+#endif
+    uint8_t src_mac[ESP_NOW_ETH_ALEN];    // with msg_id, tells the messages being reassembled apart
+    uint16_t msg_id;
+    uint8_t frag_index;
+    uint8_t frag_count;
+    uint8_t payload[0];
+} __attribute__((packed)) user_fragment_t;
+
+// every fragment but the last one carries this much of the message
+#define FRAGMENT_PAYLOAD_LEN (ESP_NOW_MAX_DATA_LEN - sizeof(example_espnow_data_t) - sizeof(user_fragment_t))
+
+/* Frame of a message flooded through the whole mesh, fragmented like user_fragment_t. It goes to all
+ * neighbours, so it has no destination. */
+typedef struct {
+    uint8_t src_mac[ESP_NOW_ETH_ALEN];    // originator
+    uint16_t msg_id;
+    uint8_t frag_index;
+    uint8_t frag_count;
+    uint8_t ttl;                          // hops the frame may still travel
+    uint8_t payload[0];
+} __attribute__((packed)) user_flood_t;
+
+#define FLOOD_PAYLOAD_LEN (ESP_NOW_MAX_DATA_LEN - sizeof(example_espnow_data_t) - sizeof(user_flood_t))
+
+#if CONFIG_DSDV_ZONE_ROUTING
+#define USER_DATA_HEAD(user_data) ((user_data)->head_mac)
+#else
+#define USER_DATA_HEAD(user_data) NULL
+#endif
+
 
 static const char *TAG = "DSDV_protocol";
 
 static uint8_t s_example_broadcast_mac[ESP_NOW_ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 static uint8_t own_mac_addr[ESP_NOW_ETH_ALEN];
 
-static RoutingEntry_t routing_table[MAX_NODES]= {0};
-static RoutingEntry_t routing_table_old[MAX_NODES]= {0};
-static int entries_nbr= 0;
+static user_data_handler_t user_data_handler= NULL;
+static TaskHandle_t routing_task= NULL;
+// the routing table is shared by the routing task and the control and data consumer tasks
+static SemaphoreHandle_t table_lock= NULL;
+static atomic_uint next_msg_id;
+// the flood cache is shared by the data consumer task, the relay task and flood_user_data()
+static SemaphoreHandle_t flood_lock= NULL;
+static TaskHandle_t flood_relay_task= NULL;
+#if CONFIG_DSDV_COMPRESSION
+static SemaphoreHandle_t compress_lock= NULL;
+#endif
+#if CONFIG_DSDV_AGGREGATION
+static SemaphoreHandle_t bundle_lock= NULL;
+static TaskHandle_t bundle_send_task= NULL;
+#endif
+static int advert_period= MIN_BROADCASTING_PERIOD; // [ms] until the next periodic advert
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+static bool routes_changed= true;         // since the last periodic advert, which then comes early
+#endif
+#if CONFIG_DSDV_PERSISTENT_STATE
+static bool seq_num_stored= false;        // NVS is usable, the own sequence number is kept below seq_num_limit
+static uint16_t seq_num_limit= 0;         // own sequence numbers from here on aren't reserved in NVS yet
+static uint32_t stored_routes_hash= 0;
+static int64_t next_store_time= 0;
+static StoredRoute_t stored_routes[MAX_NODES];
+#endif
     
-static void update_routing_table(RoutingEntry_t recvd_routing_entry, uint8_t *nextHop_addr);
+static void update_routing_table(RoutingAdvert_t recvd_routing_entry, uint8_t *nextHop_addr, int neighbour);
+static void break_route(int index);
+static void note_route_change();
+static bool fail_over(int index);
+static int break_routes_via(int neighbour);
+static esp_err_t find_next_hop(const uint8_t *mac_addr, const uint8_t *head_addr, const uint8_t *prev_hop, uint8_t *nextHop_addr, uint8_t *hop_count);
+static void salvage_user_data(frame_buffer_t *frame, const uint8_t *failed_hop);
+static esp_err_t send_user_message(uint8_t *next_hop, frame_buffer_t *frame);
+#if CONFIG_DSDV_AGGREGATION
+static esp_err_t bundle_message(const uint8_t *next_hop, const uint8_t *message, int len, int64_t rx_time);
+static void receive_bundle(frame_buffer_t *frame, const uint8_t *prev_hop, uint8_t *payload, int len);
+static void salvage_bundle(frame_buffer_t *frame, const uint8_t *failed_hop);
+static void send_bundles(void *pvParameter);
+#endif
+static void deliver_user_data(uint8_t *data, int len, bool compressed);
+static void receive_fragment(const uint8_t *src_mac, uint16_t msg_id, int frag_index, int frag_count, int offset, const uint8_t *data, int len, bool compressed);
+static esp_err_t transmit_fragments(uint8_t *mac_addr, uint8_t *data, int data_len, uint8_t flags);
+static void receive_flood(frame_buffer_t *frame, user_flood_t *flood, int len);
+static void relay_floods(void *pvParameter);
+static void send_full_dump();
 static void send_incremental_updates();
+static void send_triggered_updates();
+#if CONFIG_DSDV_ZONE_ROUTING
+static void find_head(const uint8_t *mac_addr, uint8_t *head_addr);
+static uint8_t zone_hop_count(int index);
+static bool elect_head(int periods);
+static void send_zone_summary(bool full_dump);
+static void receive_zone_summary(frame_buffer_t *frame, const ZoneSummary_t *summary);
+#endif
+#if CONFIG_DSDV_PERSISTENT_STATE
+static void restore_routing_state();
+static int advance_seq_num();
+static void reserve_seq_nums(uint16_t limit);
+static int snapshot_routes(int64_t current_time);
+#endif
 inline static void print_routing_table();
 
 
 static void do_on_send_event(example_espnow_event_send_cb_t *send_cb)
 {
-	return;
-    ESP_LOGI(TAG, "Sent data to "MACSTR", status1: %d", MAC2STR(send_cb->mac_addr), send_cb->status);
+    PACKET_LOGD(TAG, "Sent data to "MACSTR", status: %d, attempts: %d", MAC2STR(send_cb->mac_addr), send_cb->status, send_cb->attempts);
+
+    // link statistics of the neighbour
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    int neighbour= routing_table_neighbour(send_cb->mac_addr);
+    if (neighbour >= 0)
+    {
+        NeighbourStats_t *stats= routing_table_neighbour_stats(neighbour);
+        stats->tx_frames++;
+        stats->tx_attempts += send_cb->attempts;
+        link_quality_unicast_sent(&stats->link, send_cb->status == ESP_NOW_SEND_SUCCESS, send_cb->attempts);
+        if (send_cb->status != ESP_NOW_SEND_SUCCESS)
+        {
+            stats->tx_failures++;
+            // the neighbour didn't acknowledge even after retries: the link is gone, its routes move to alternates
+            if (break_routes_via(neighbour) > 0)
+                ESP_LOGW(TAG, "Link to "MACSTR" broken", MAC2STR(send_cb->mac_addr));
+        }
+    }
+    xSemaphoreGive(table_lock);
+
+    if (send_cb->frame != NULL)
+        salvage_user_data(send_cb->frame, send_cb->mac_addr);
+}
+
+/* Type and length fields of a received frame, checked before it is dispatched. Every fragment but the last
+ * one must be full, as receivers place fragments by their index. */
+static bool frame_valid(const example_espnow_data_t *data, int payload_len)
+{
+    uint8_t type= data->is_userData & ~USER_DATA_COMPRESSED;
+    if (type != data->is_userData && type != USER_DATA_MESSAGE && type != USER_DATA_FRAGMENT)
+        return false;
+    switch (type)
+    {
+    case 0:
+    {
+        const RoutingPacket_t *packet= (const RoutingPacket_t*) data->payload;
+        if (payload_len < sizeof(RoutingPacket_t))
+            return false;
+#if CONFIG_DSDV_ZONE_ROUTING
+        if (packet->type == DSDV_ZONE_SUMMARY)
+        {
+            const ZoneSummary_t *summary= (const ZoneSummary_t*) data->payload;
+            return payload_len >= sizeof(ZoneSummary_t) && summary->part < MAX_SUMMARY_PARTS
+                && payload_len >= sizeof(ZoneSummary_t) + summary->members_nbr * ESP_NOW_ETH_ALEN;
+        }
+#endif
+        return packet->type <= DSDV_INCREMENTAL_UPDATE
+            && payload_len >= sizeof(RoutingPacket_t) + packet->entries_nbr * sizeof(RoutingAdvert_t);
+    }
+    case USER_DATA_MESSAGE:
+        return payload_len >= sizeof(user_data_t);
+    case USER_DATA_FRAGMENT:
+    {
+        const user_fragment_t *fragment= (const user_fragment_t*) data->payload;
+        return payload_len >= sizeof(user_fragment_t) && fragment->frag_index < fragment->frag_count
+            && (fragment->frag_index == fragment->frag_count - 1 || payload_len == sizeof(user_fragment_t) + FRAGMENT_PAYLOAD_LEN);
+    }
+    case USER_DATA_FLOOD:
+    {
+        const user_flood_t *flood= (const user_flood_t*) data->payload;
+        return payload_len >= sizeof(user_flood_t) && flood->frag_index < flood->frag_count
+            && (flood->frag_index == flood->frag_count - 1 || payload_len == sizeof(user_flood_t) + FLOOD_PAYLOAD_LEN);
+    }
+#if CONFIG_DSDV_AGGREGATION
+    case USER_DATA_BUNDLE:
+        return bundle_valid(data->payload, payload_len, sizeof(user_data_t));
+#endif
+    default:
+        return false;
+    }
 }
 
 static void do_on_receive_event(example_espnow_event_recv_cb_t *recv_cb)
 {   
-    // parse received data
+    // parse received data in place
     uint8_t *nextHop_addr = recv_cb->mac_addr;
-    example_espnow_data_t *data = (example_espnow_data_t *)recv_cb->data;
-    uint8_t is_userData= data->is_userData;
-    int payload_len = recv_cb->data_len - sizeof(example_espnow_data_t);
-    uint8_t *payload= malloc(payload_len);
-    if (payload==NULL) {
-        ESP_LOGW(TAG, "do_on_receive_event(): ERROR: malloc failed");
+    frame_buffer_t *frame= recv_cb->frame;
+    example_espnow_data_t *data = (example_espnow_data_t *)frame->data;
+    uint8_t is_userData= data->is_userData & ~USER_DATA_COMPRESSED;
+    bool compressed= data->is_userData & USER_DATA_COMPRESSED;
+    int payload_len = frame->len - sizeof(example_espnow_data_t);
+    uint8_t *payload= data->payload;
+
+    if (!frame_valid(data, payload_len))
+    {
+        stats_count(STATS_RX_MALFORMED);
+        PACKET_LOGW(TAG, "Received malformed frame from: "MACSTR", type: %d, len: %d", MAC2STR(recv_cb->mac_addr), is_userData, payload_len);
         return;
     }
-    memcpy(payload, data->payload, payload_len);
 
     if (is_userData) // forward user message if necessary
     {
         user_data_t *recvd_user_data= (user_data_t*) payload;
-        if (memcmp(own_mac_addr, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0 || memcmp(s_example_broadcast_mac, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0)
-            ESP_LOGW(TAG, "Received user message from: "MACSTR", len: %d, content: %s", MAC2STR(recv_cb->mac_addr), payload_len-sizeof(user_data_t), ((char*)recvd_user_data)+ESP_NOW_ETH_ALEN);//(char*)recvd_user_data->payload);
+        if (is_userData == USER_DATA_FLOOD)
+        {
+            receive_flood(frame, (user_flood_t*) payload, payload_len);
+        }
+#if CONFIG_DSDV_AGGREGATION
+        else if (is_userData == USER_DATA_BUNDLE)
+        {
+            receive_bundle(frame, nextHop_addr, payload, payload_len);
+        }
+#endif
+        else if ((memcmp(own_mac_addr, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0 || memcmp(s_example_broadcast_mac, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0)
+                && is_userData == USER_DATA_FRAGMENT)
+        {
+            user_fragment_t *fragment= (user_fragment_t*) payload;
+            receive_fragment(fragment->src_mac, fragment->msg_id, fragment->frag_index, fragment->frag_count,
+                fragment->frag_index * FRAGMENT_PAYLOAD_LEN, fragment->payload, payload_len - sizeof(user_fragment_t), compressed);
+        }
+        else if (memcmp(own_mac_addr, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0 || memcmp(s_example_broadcast_mac, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0)
+        {
+            PACKET_LOGW(TAG, "Received user message from: "MACSTR", len: %d, content: %s", MAC2STR(recv_cb->mac_addr), payload_len-sizeof(user_data_t), ((char*)recvd_user_data)+ESP_NOW_ETH_ALEN);//(char*)recvd_user_data->payload);
+            deliver_user_data(recvd_user_data->payload, payload_len - sizeof(user_data_t), compressed);
+        }
         else
         {
-            int index;
-            for (index= 1; index < entries_nbr; index++)
-                if (memcmp(routing_table[index].destination_addr, recvd_user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0)
-                    break;
-            
-            if (index == entries_nbr || routing_table[index].hop_count == UINT8_MAX)
-                ESP_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(recvd_user_data->dest_mac));
+            uint8_t next_hop[ESP_NOW_ETH_ALEN];
+            uint8_t hop_count;
+            if (find_next_hop(recvd_user_data->dest_mac, USER_DATA_HEAD(recvd_user_data), nextHop_addr, next_hop, &hop_count) != ESP_OK)
+            {
+                stats_count(STATS_NO_ROUTE);
+                PACKET_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(recvd_user_data->dest_mac));
+            }
             else
             {
-                ESP_LOGW(TAG, "Forwarding user message to "MACSTR". Number of hops left: %d", MAC2STR(routing_table[index].nextHop_addr), routing_table[index].hop_count);
-                transmit_data(routing_table[index].nextHop_addr, payload, payload_len, true, true);
+                PACKET_LOGW(TAG, "Forwarding user message to "MACSTR". Number of hops left: %d", MAC2STR(next_hop), hop_count);
+                // the received frame goes out unchanged
+                frame_ref(frame);
+                if (send_user_message(next_hop, frame) == ESP_OK)
+                    stats_count(STATS_TX_FORWARDED);
             }
         }
     }
     else // update table if necessary
     {
-        RoutingEntry_t *recvd_routing_entry= (RoutingEntry_t*) payload;
-        update_routing_table(*recvd_routing_entry, nextHop_addr);
+        RoutingPacket_t *recvd_packet= (RoutingPacket_t*) payload;
+#if CONFIG_DSDV_ZONE_ROUTING
+        if (recvd_packet->type == DSDV_ZONE_SUMMARY)
+        {
+            receive_zone_summary(frame, (ZoneSummary_t*) payload);
+            return;
+        }
+#endif
+        xSemaphoreTake(table_lock, portMAX_DELAY);
+        int neighbour= routing_table_neighbour(nextHop_addr);
+        if (neighbour < 0)
+        {
+            xSemaphoreGive(table_lock);
+            stats_count(STATS_NEIGHBOUR_TABLE_FULL);
+            PACKET_LOGW(TAG, "Neighbour table full, ignoring routing packet from: "MACSTR"", MAC2STR(recv_cb->mac_addr));
+            return;
+        }
 
-        ESP_LOGI(TAG, "Received routing entry from: "MACSTR", len: %d, content:", MAC2STR(recv_cb->mac_addr), payload_len);
-        ESP_LOGI("", "| "MACSTR" | "MACSTR" | %-10d | %-10d |", 
-            MAC2STR(recvd_routing_entry->destination_addr),
-            MAC2STR(recvd_routing_entry->nextHop_addr),
-            recvd_routing_entry->hop_count,
-            recvd_routing_entry->seq_num
-        );
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+        // a neighbour heard for the first time, or again after it was given up, is a new link
+        NeighbourStats_t *neighbour_stats= routing_table_neighbour_stats(neighbour);
+        if (neighbour_stats->advert_period == 0)
+            note_route_change();
+        neighbour_stats->advert_period= recvd_packet->period;
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+        channel_heard(nextHop_addr, recvd_packet->channel);
+#endif
+
+        // a periodic advert starts with the sender's own entry
+        if (recvd_packet->entries_nbr > 0 && memcmp(recvd_packet->entries[0].destination_addr, nextHop_addr, ESP_NOW_ETH_ALEN) == 0)
+            link_quality_advert_received(&routing_table_neighbour_stats(neighbour)->link, recv_cb->rssi, recvd_packet->entries[0].seq_num);
+
+        stats_count(recvd_packet->type == DSDV_FULL_DUMP ? STATS_RX_FULL_DUMPS : STATS_RX_UPDATES);
+        PACKET_LOGI(TAG, "Received %s from: "MACSTR", entries: %d, content:", recvd_packet->type == DSDV_FULL_DUMP ? "full dump" : "incremental update", MAC2STR(recv_cb->mac_addr), recvd_packet->entries_nbr);
+        for (int i = 0; i < recvd_packet->entries_nbr; i++)
+        {
+            RoutingAdvert_t *recvd_routing_entry= &recvd_packet->entries[i];
+            update_routing_table(*recvd_routing_entry, nextHop_addr, neighbour);
+            PACKET_LOGI("", "| "MACSTR" | %-10d | %-10d |", 
+                MAC2STR(recvd_routing_entry->destination_addr),
+                recvd_routing_entry->hop_count,
+                recvd_routing_entry->seq_num
+            );
+        }
+        xSemaphoreGive(table_lock);
     }
-    free(payload);
+}
+
+/* Period with jitter, which keeps neighbours from broadcasting in lockstep. */
+static int jittered_period(int period)
+{
+    int jitter= period * BROADCAST_JITTER / 100;
+    return period - jitter + esp_random() % (2 * jitter + 1);
+}
+
+/* [us] time without an advert after which the neighbour is given up. With the adaptive period, one lost advert
+ * is tolerated, after which the neighbour's period may have doubled. */
+static int64_t neighbour_timeout(int neighbour)
+{
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+    int period= routing_table_neighbour_stats(neighbour)->advert_period;
+    if (period == 0)
+        period= MAX_BROADCASTING_PERIOD;
+    int next_period= 2 * period < MAX_BROADCASTING_PERIOD ? 2 * period : MAX_BROADCASTING_PERIOD;
+    return ((int64_t)(period + next_period) * (100 + BROADCAST_JITTER) / 100 + ADVERT_DELAY) * 1000;
+#else
+    return ((int64_t)BROADCASTING_PERIOD * 2 + ADVERT_DELAY) * 1000;
+#endif
 }
 
 
@@ -95,56 +402,193 @@ void start_dsdv_routing(void)
     // add own routing entry to table
     esp_read_mac(own_mac_addr, ESP_MAC_WIFI_SOFTAP);
     own_mac_addr[5]--;
-    RoutingEntry_t *own_routing_entry= &routing_table[0];
-    memcpy(own_routing_entry->destination_addr, own_mac_addr, ESP_NOW_ETH_ALEN);
-    memcpy(own_routing_entry->nextHop_addr, own_mac_addr, ESP_NOW_ETH_ALEN);
+    routing_table_init();
+    routing_task= xTaskGetCurrentTaskHandle();
+    table_lock= xSemaphoreCreateMutex();
+    // a message ID from before a reboot mustn't be mistaken for a new one
+    atomic_store(&next_msg_id, esp_random());
+    flood_cache_init();
+    flood_lock= xSemaphoreCreateMutex();
+#if CONFIG_DSDV_ZONE_ROUTING
+    zone_init();
+#endif
+    xTaskCreate(relay_floods, "dsdv_flood", 3072, NULL, FLOOD_TASK_PRIORITY, &flood_relay_task);
+#if CONFIG_DSDV_COMPRESSION
+    compress_init();
+    compress_lock= xSemaphoreCreateMutex();
+#endif
+#if CONFIG_DSDV_AGGREGATION
+    bundle_init();
+    bundle_lock= xSemaphoreCreateMutex();
+    xTaskCreate(send_bundles, "dsdv_bundle", 3072, NULL, BUNDLE_TASK_PRIORITY, &bundle_send_task);
+#endif
+    RoutingEntry_t *own_routing_entry= &routing_table[routing_table_add(own_mac_addr)];
+    routing_table_set_next_hop(0, routing_table_neighbour(own_mac_addr));
     own_routing_entry->hop_count= 0;
+    own_routing_entry->metric= 0;
     own_routing_entry->seq_num= 0;
-    own_routing_entry->last_update_time= 0;
-    entries_nbr++;
+#if CONFIG_DSDV_PERSISTENT_STATE
+    restore_routing_state();
+#endif
 
     // start wifi
     setup_connectivity();
 
-    // create task to handle send and receive events
+    // create the tasks to handle send and receive events
     event_handler_t event_handler;
     event_handler.do_on_send_event= &do_on_send_event;
     event_handler.do_on_receive_event= &do_on_receive_event;
-    xTaskCreate(handle_communication_events, "handle_communication_events", 4096, (void*)&event_handler, 4, NULL);
+    start_event_handlers(&event_handler);
     
+    int periods_since_full_dump= FULL_DUMP_INTERVAL;
+#if CONFIG_DSDV_ZONE_ROUTING
+    int periods_since_boot= 0;
+#endif
+    int64_t next_broadcast_time= esp_timer_get_time();
     while(true)
     {
-        // broadcast own routing entry
-        own_routing_entry->seq_num += 2;
-        print_routing_table();
-        transmit_data(s_example_broadcast_mac, (uint8_t*)own_routing_entry, sizeof(RoutingEntry_t), false, false);
-        vTaskDelay(BROADCASTING_PERIOD / portTICK_PERIOD_MS);
+        int64_t current_time= esp_timer_get_time();
+        int routes_to_store= -1;
+#if CONFIG_DSDV_PERSISTENT_STATE
+        int seq_num_to_reserve= -1;
+#endif
+        xSemaphoreTake(table_lock, portMAX_DELAY);
+        if (current_time >= next_broadcast_time)
+        {
+            stats_peak(STATS_PEAK_ROUTING_ENTRIES, entries_nbr);
+
+            // drop the restored routes no advert confirmed
+            for (int i = entries_nbr - 1; i > 0; i--)
+                if (routing_info[i].provisional && current_time - routing_info[i].last_update_time > (int64_t)PROVISIONAL_TIMEOUT * 1000)
+                {
+                    routing_table_remove(i);
+                    stats_count(STATS_ROUTES_UNCONFIRMED);
+                }
 
-        // send incremental routing table updates
-        send_incremental_updates();
+            // check for stale neighbours: their routes move to alternates, or break if they have none
+            for (int i = 1; i < entries_nbr; i++)
+                if (routing_table[i].hop_count == 1)
+                    if (current_time - routing_info[i].last_update_time > neighbour_timeout(routing_table[i].next_hop))
+                    {
+                        int neighbour= routing_table[i].next_hop;
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+                        routing_table_neighbour_stats(neighbour)->advert_period= 0;
+#endif
+                        note_route_change();
+                        break_routes_via(neighbour);
+                    }
 
-        // check for stale neighbours
-        int64_t current_time= esp_timer_get_time();
-        for (int i = 0; i < entries_nbr; i++)
-            if (routing_table[i].hop_count == 1)
-                if (current_time - routing_table[i].last_update_time > BROADCASTING_PERIOD * 2 * 1000) {
+            // forget destinations that have been unreachable for long
+            routing_table_expire(current_time, (int64_t)ROUTE_EXPIRY_TIME * 1000);
+
+#if CONFIG_DSDV_ZONE_ROUTING
+            // routes that left the zone are given up, unless they lead to a head or a head's demotion still has to be
+            // passed on; they are advertised as broken, so that the nodes routing through this one don't lose the
+            // destination without notice, and expire as unreachable entries
+            routing_info[0].head= elect_head(periods_since_boot++);
+            for (int i = 1; i < entries_nbr; i++)
+            {
+                if (routing_table[i].hop_count == UINT8_MAX || routing_info[i].provisional)
+                    continue;
+                if (zone_hop_count(i) > ZONE_RADIUS && !routing_info[i].head && !routing_info[i].advertised_head)
+                {
                     routing_table[i].hop_count= UINT8_MAX;
-                    routing_table[i].seq_num += 1;
+                    routing_table[i].metric= METRIC_INFINITY;
+                    routing_table[i].seq_num += routing_table[i].seq_num % 2 ? 2 : 1;
+                    stats_count(STATS_ROUTES_LEFT_ZONE);
                 }
+                // the neighbours pass on every route they keep with each new sequence number; one that no longer
+                // comes in went through a link that failed with the destination just out of the other neighbours' zones
+                else if (current_time - routing_info[i].last_update_time > (int64_t)ZONE_ROUTE_TIMEOUT * 1000)
+                    break_route(i);
+            }
+            zone_expire(current_time, (int64_t)ROUTE_EXPIRY_TIME * 1000);
+#endif
+
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+            // the period starts again from the shortest after a change and doubles while the routes stay the same;
+            // it goes out with the adverts, as the neighbours time out on it
+            advert_period= routes_changed ? MIN_BROADCASTING_PERIOD : 2 * advert_period;
+            if (advert_period > MAX_BROADCASTING_PERIOD)
+                advert_period= MAX_BROADCASTING_PERIOD;
+            routes_changed= false;
+#endif
+
+            // advertise the new own sequence number along with all changed entries,
+            // the whole table every FULL_DUMP_INTERVAL periods
+#if CONFIG_DSDV_PERSISTENT_STATE
+            seq_num_to_reserve= advance_seq_num();
+            routes_to_store= snapshot_routes(current_time);
+#else
+            own_routing_entry->seq_num += 2;
+#endif
+            print_routing_table();
+            if (periods_since_full_dump >= FULL_DUMP_INTERVAL)
+            {
+                send_full_dump();
+                periods_since_full_dump= 0;
+            }
+            else
+            {
+                send_incremental_updates();
+                periods_since_full_dump++;
+            }
+#if CONFIG_DSDV_ZONE_ROUTING
+            send_zone_summary(periods_since_full_dump == 0);
+#endif
+
+            next_broadcast_time= current_time + (int64_t)jittered_period(advert_period) * 1000;
+        }
+        else
+        {
+            send_triggered_updates();
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+            // a change cuts a long period short
+            if (routes_changed && next_broadcast_time - current_time > (int64_t)MIN_BROADCASTING_PERIOD * 1000)
+                next_broadcast_time= current_time + (int64_t)jittered_period(MIN_BROADCASTING_PERIOD) * 1000;
+#endif
+        }
+        xSemaphoreGive(table_lock);
+#if CONFIG_DSDV_PERSISTENT_STATE
+        // the flash writes may take a while, they are made without holding up the other tasks
+        if (seq_num_to_reserve >= 0)
+            reserve_seq_nums(seq_num_to_reserve);
+        if (routes_to_store >= 0 && route_store_save_routes(stored_routes, routes_to_store) == ESP_OK)
+            stats_count(STATS_NVS_WRITES);
+#endif
+
+        // sleep until the next periodic broadcast or until a route breaks or is repaired
+        int64_t tick_us= portTICK_PERIOD_MS * 1000;
+        int64_t sleep_us= next_broadcast_time - esp_timer_get_time();
+        TickType_t ticks= sleep_us > 0 ? (sleep_us + tick_us - 1) / tick_us : 0;
+        if (ulTaskNotifyTake(pdTRUE, ticks) > 0)
+        {
+            // neighbours that noticed the same change shouldn't answer at the same time
+            vTaskDelay(esp_random() % (TRIGGER_JITTER / portTICK_PERIOD_MS + 1));
+        }
     }
 }
 
-esp_err_t transmit_user_data(uint8_t *mac_addr, uint8_t *data, int data_len)
+/* flags are OR-ed into is_userData of every frame of the message. */
+static esp_err_t transmit_message(uint8_t *mac_addr, uint8_t *data, int data_len, uint8_t flags)
 {
     esp_err_t ret=ESP_FAIL;
 
-    user_data_t *user_data = malloc(sizeof(user_data_t) + data_len);
-    if (user_data == NULL) {
-        ESP_LOGW(TAG, "transmit_user_data(): ERROR: malloc failed");
+    if (sizeof(example_espnow_data_t) + sizeof(user_data_t) + data_len > ESP_NOW_MAX_DATA_LEN)
+        return transmit_fragments(mac_addr, data, data_len, flags);
+    frame_buffer_t *frame= frame_alloc(true);
+    if (frame == NULL) {
+        ESP_LOGW(TAG, "transmit_user_data(): ERROR: frame pool exhausted");
         return ret;
     }
+    ((example_espnow_data_t*)frame->data)->is_userData |= flags;
+    user_data_t *user_data = (user_data_t*) ((example_espnow_data_t*)frame->data)->payload;
     memcpy(user_data->dest_mac, mac_addr, ESP_NOW_ETH_ALEN);
+#if CONFIG_DSDV_ZONE_ROUTING
+    find_head(mac_addr, user_data->head_mac);
+#endif
     memcpy(user_data->payload, data, data_len);
+    frame->len += sizeof(user_data_t) + data_len;
     
     if (memcmp(own_mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
     {
@@ -152,112 +596,1286 @@ esp_err_t transmit_user_data(uint8_t *mac_addr, uint8_t *data, int data_len)
     }
     else if (memcmp(s_example_broadcast_mac, mac_addr, ESP_NOW_ETH_ALEN) == 0)
     {
-        ESP_LOGW(TAG, "Broadcasting user message");
-        ret= transmit_data(s_example_broadcast_mac, (uint8_t*)user_data, sizeof(user_data_t) + data_len, false, true);
+        PACKET_LOGW(TAG, "Broadcasting user message");
+        ret= transmit_frame(s_example_broadcast_mac, frame, false);
+        if (ret == ESP_OK)
+            stats_count(STATS_TX_USER);
+        return ret;
     }
     else
     {
-        int index;
-        for (index= 1; index < entries_nbr; index++)
-            if (memcmp(routing_table[index].destination_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
-                break;
-        
-        if (index == entries_nbr || routing_table[index].hop_count == UINT8_MAX)
-            ESP_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(mac_addr));
+        uint8_t next_hop[ESP_NOW_ETH_ALEN];
+        uint8_t hop_count;
+        if (find_next_hop(mac_addr, USER_DATA_HEAD(user_data), own_mac_addr, next_hop, &hop_count) != ESP_OK)
+        {
+            stats_count(STATS_NO_ROUTE);
+            PACKET_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(mac_addr));
+        }
         else
         {
-            ESP_LOGW(TAG, "Forwarding user message to "MACSTR". Number of hops left: %d", MAC2STR(routing_table[index].nextHop_addr), routing_table[index].hop_count);
-            ret= transmit_data(routing_table[index].nextHop_addr, (uint8_t*)user_data, sizeof(user_data_t) + data_len, true, true);
+            PACKET_LOGW(TAG, "Forwarding user message to "MACSTR". Number of hops left: %d", MAC2STR(next_hop), hop_count);
+            ret= send_user_message(next_hop, frame);
+            if (ret == ESP_OK)
+                stats_count(STATS_TX_USER);
+            return ret;
         }
     }
-    free(user_data);
+    frame_release(frame);
     return ret;
 }
 
+esp_err_t transmit_user_data(uint8_t *mac_addr, uint8_t *data, int data_len)
+{
+    return transmit_message(mac_addr, data, data_len, 0);
+}
+
+#if CONFIG_DSDV_COMPRESSION
+esp_err_t transmit_compressed_user_data(uint8_t *mac_addr, uint8_t *data, int data_len)
+{
+    // one buffer for all senders: it is only needed until the last frame of the message is queued
+    static uint8_t compressed[MAX_MESSAGE_SIZE];
+    xSemaphoreTake(compress_lock, portMAX_DELAY);
+    int len= data_len <= MAX_MESSAGE_SIZE ? compress_encode(data, data_len, compressed, data_len - 1) : -1;
+    esp_err_t ret;
+    if (len < 0 || len >= data_len)
+        ret= transmit_message(mac_addr, data, data_len, 0);
+    else
+    {
+        PACKET_LOGI(TAG, "Compressed user message from %d to %d bytes", data_len, len);
+        ret= transmit_message(mac_addr, compressed, len, USER_DATA_COMPRESSED);
+        if (ret == ESP_OK)
+            stats_count(STATS_TX_COMPRESSED);
+    }
+    xSemaphoreGive(compress_lock);
+    return ret;
+}
+#endif
+
+/* Hands a message for this node to the handler, decompressed if it was sent compressed. */
+static void deliver_user_data(uint8_t *data, int len, bool compressed)
+{
+    if (compressed)
+    {
+#if CONFIG_DSDV_COMPRESSION
+        // only the data consumer task delivers messages
+        static uint8_t decompressed[MAX_MESSAGE_SIZE];
+        len= compress_decode(data, len, decompressed, MAX_MESSAGE_SIZE);
+        data= decompressed;
+#else
+        len= -1;
+#endif
+        if (len < 0)
+        {
+            stats_count(STATS_RX_MALFORMED);
+            PACKET_LOGW(TAG, "Received compressed user message that doesn't decompress");
+            return;
+        }
+    }
+    stats_count(STATS_RX_USER);
+    if (user_data_handler != NULL)
+        user_data_handler(data, len);
+}
+
+esp_err_t lookup_route(uint8_t *mac_addr, uint8_t *nextHop_addr, uint8_t *hop_count)
+{
+    return find_next_hop(mac_addr, NULL, NULL, nextHop_addr, hop_count);
+}
+
+#if CONFIG_DSDV_ZONE_ROUTING
+esp_err_t lookup_zone_route(uint8_t *mac_addr, uint8_t *head_addr, uint8_t *nextHop_addr, uint8_t *hop_count)
+{
+    if (IS_UNSET_ADDR(head_addr))
+        find_head(mac_addr, head_addr);
+    return find_next_hop(mac_addr, head_addr, NULL, nextHop_addr, hop_count);
+}
+#endif
+
+void register_user_data_handler(user_data_handler_t handler)
+{
+    user_data_handler= handler;
+}
+
+/* Queues one fragment. ESP_ERR_NO_MEM means the frame pool or the TX queue is full for now. */
+static esp_err_t transmit_fragment(uint8_t *mac_addr, uint16_t msg_id, int frag_index, int frag_count, const uint8_t *data, int len, uint8_t flags)
+{
+    frame_buffer_t *frame= frame_alloc(true);
+    if (frame == NULL)
+        return ESP_ERR_NO_MEM;
+    ((example_espnow_data_t*)frame->data)->is_userData= USER_DATA_FRAGMENT | flags;
+    user_fragment_t *fragment= (user_fragment_t*) ((example_espnow_data_t*)frame->data)->payload;
+    memcpy(fragment->dest_mac, mac_addr, ESP_NOW_ETH_ALEN);
+#if CONFIG_DSDV_ZONE_ROUTING
+    find_head(mac_addr, fragment->head_mac);
+#endif
+    memcpy(fragment->src_mac, own_mac_addr, ESP_NOW_ETH_ALEN);
+    fragment->msg_id= msg_id;
+    fragment->frag_index= frag_index;
+    fragment->frag_count= frag_count;
+    memcpy(fragment->payload, data, len);
+    frame->len += sizeof(user_fragment_t) + len;
+
+    // each fragment looks the route up again, so a message follows route changes
+    uint8_t next_hop[ESP_NOW_ETH_ALEN];
+    uint8_t hop_count;
+    if (memcmp(s_example_broadcast_mac, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        memcpy(next_hop, s_example_broadcast_mac, ESP_NOW_ETH_ALEN);
+    else if (find_next_hop(mac_addr, USER_DATA_HEAD((user_data_t*) fragment), own_mac_addr, next_hop, &hop_count) != ESP_OK)
+    {
+        stats_count(STATS_NO_ROUTE);
+        PACKET_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(mac_addr));
+        frame_release(frame);
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret= transmit_frame(next_hop, frame, !IS_BROADCAST_ADDR(next_hop));
+    if (ret == ESP_OK)
+        stats_count(STATS_TX_FRAGMENTS);
+    return ret;
+}
+
+/* The fragments are queued back to back as the TX queue and the frame pool make room, so that they follow
+ * each other down the route while later ones are still being queued. */
+static esp_err_t transmit_fragments(uint8_t *mac_addr, uint8_t *data, int data_len, uint8_t flags)
+{
+    int frag_count= (data_len + FRAGMENT_PAYLOAD_LEN - 1) / FRAGMENT_PAYLOAD_LEN;
+    if (data_len > MAX_MESSAGE_SIZE || frag_count > MAX_FRAGMENTS)
+    {
+        ESP_LOGW(TAG, "transmit_user_data(): ERROR: %d bytes exceed the maximum message size", data_len);
+        return ESP_FAIL;
+    }
+    if (memcmp(own_mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        return ESP_FAIL;
+
+    uint16_t msg_id= atomic_fetch_add(&next_msg_id, 1);
+    int64_t deadline= esp_timer_get_time() + (int64_t)FRAGMENT_SEND_TIMEOUT * 1000;
+    int frag_index= 0;
+    while (frag_index < frag_count)
+    {
+        int offset= frag_index * FRAGMENT_PAYLOAD_LEN;
+        int len= data_len - offset < FRAGMENT_PAYLOAD_LEN ? data_len - offset : FRAGMENT_PAYLOAD_LEN;
+        esp_err_t ret= transmit_fragment(mac_addr, msg_id, frag_index, frag_count, data + offset, len, flags);
+        if (ret == ESP_OK)
+            frag_index++;
+        else if (ret != ESP_ERR_NO_MEM || esp_timer_get_time() >= deadline)
+        {
+            PACKET_LOGW(TAG, "Sending message %u to "MACSTR" failed at fragment %d of %d", msg_id, MAC2STR(mac_addr), frag_index, frag_count);
+            return ret;
+        }
+        else
+            vTaskDelay(1);
+    }
+    stats_count(STATS_TX_USER);
+    PACKET_LOGW(TAG, "Sent message %u to "MACSTR" in %d fragments", msg_id, MAC2STR(mac_addr), frag_count);
+    return ESP_OK;
+}
+
+/* offset is where the len bytes of data start in the message. */
+static void receive_fragment(const uint8_t *src_mac, uint16_t msg_id, int frag_index, int frag_count, int offset, const uint8_t *data, int len, bool compressed)
+{
+    int64_t current_time= esp_timer_get_time();
+    for (int expired = reassembly_expire(current_time, (int64_t)REASSEMBLY_TIMEOUT * 1000); expired > 0; expired--)
+        stats_count(STATS_RX_REASSEMBLY_TIMEOUTS);
+
+    stats_count(STATS_RX_FRAGMENTS);
+    reassembly_t *msg;
+    reassembly_status_t status= reassembly_add(src_mac, msg_id, frag_index, frag_count, offset, data, len, current_time, &msg);
+    if (status == REASSEMBLY_FULL)
+    {
+        stats_count(STATS_RX_REASSEMBLY_FULL);
+        PACKET_LOGW(TAG, "No reassembly slot for message %u from "MACSTR"", msg_id, MAC2STR(src_mac));
+    }
+    else if (status == REASSEMBLY_INVALID)
+    {
+        stats_count(STATS_RX_MALFORMED);
+        PACKET_LOGW(TAG, "Received invalid fragment %d/%d of message %u from "MACSTR"", frag_index, frag_count, msg_id, MAC2STR(src_mac));
+    }
+    else if (status == REASSEMBLY_COMPLETE)
+    {
+        PACKET_LOGW(TAG, "Received user message %u from: "MACSTR", len: %d", msg->msg_id, MAC2STR(msg->src_addr), msg->len);
+        deliver_user_data(msg->data, msg->len, compressed);
+        reassembly_release(msg);
+    }
+}
+
+
+/* Queues one frame of a flooded message and remembers it, so that the copies the neighbours relay back are ignored. */
+static esp_err_t transmit_flood_fragment(uint16_t msg_id, int frag_index, int frag_count, uint8_t ttl, const uint8_t *data, int len)
+{
+    frame_buffer_t *frame= frame_alloc(true);
+    if (frame == NULL)
+        return ESP_ERR_NO_MEM;
+    ((example_espnow_data_t*)frame->data)->is_userData= USER_DATA_FLOOD;
+    user_flood_t *flood= (user_flood_t*) ((example_espnow_data_t*)frame->data)->payload;
+    memcpy(flood->src_mac, own_mac_addr, ESP_NOW_ETH_ALEN);
+    flood->msg_id= msg_id;
+    flood->frag_index= frag_index;
+    flood->frag_count= frag_count;
+    flood->ttl= ttl;
+    memcpy(flood->payload, data, len);
+    frame->len += sizeof(user_flood_t) + len;
+
+    xSemaphoreTake(flood_lock, portMAX_DELAY);
+    flood_cache_add(own_mac_addr, msg_id, frag_index)->copies= 1;
+    xSemaphoreGive(flood_lock);
+    esp_err_t ret= transmit_frame(s_example_broadcast_mac, frame, false);
+    if (ret == ESP_OK)
+        stats_count(STATS_TX_FLOODS);
+    return ret;
+}
+
+esp_err_t flood_user_data(uint8_t *data, int data_len, uint8_t ttl)
+{
+    int frag_count= data_len > 0 ? (data_len + FLOOD_PAYLOAD_LEN - 1) / FLOOD_PAYLOAD_LEN : 1;
+    if (data_len > MAX_MESSAGE_SIZE || frag_count > MAX_FRAGMENTS)
+    {
+        ESP_LOGW(TAG, "flood_user_data(): ERROR: %d bytes exceed the maximum message size", data_len);
+        return ESP_FAIL;
+    }
+    if (ttl == 0 || flood_lock == NULL)
+        return ESP_FAIL;
+
+    uint16_t msg_id= atomic_fetch_add(&next_msg_id, 1);
+    int64_t deadline= esp_timer_get_time() + (int64_t)FRAGMENT_SEND_TIMEOUT * 1000;
+    int frag_index= 0;
+    while (frag_index < frag_count)
+    {
+        int offset= frag_index * FLOOD_PAYLOAD_LEN;
+        int len= data_len - offset < FLOOD_PAYLOAD_LEN ? data_len - offset : FLOOD_PAYLOAD_LEN;
+        esp_err_t ret= transmit_flood_fragment(msg_id, frag_index, frag_count, ttl, data + offset, len);
+        if (ret == ESP_OK)
+            frag_index++;
+        else if (ret != ESP_ERR_NO_MEM || esp_timer_get_time() >= deadline)
+        {
+            PACKET_LOGW(TAG, "Flooding message %u failed at fragment %d of %d", msg_id, frag_index, frag_count);
+            return ret;
+        }
+        else
+            vTaskDelay(1);
+    }
+    stats_count(STATS_TX_USER);
+    PACKET_LOGW(TAG, "Flooded message %u in %d frames, TTL %d", msg_id, frag_count, ttl);
+    return ESP_OK;
+}
+
+/* The first copy of a flooded frame goes to the user and is held for relaying, later copies are only counted. */
+static void receive_flood(frame_buffer_t *frame, user_flood_t *flood, int len)
+{
+    if (flood->frag_index >= flood->frag_count)
+    {
+        stats_count(STATS_RX_MALFORMED);
+        PACKET_LOGW(TAG, "Received invalid flooded fragment %d/%d of message %u from "MACSTR"", flood->frag_index, flood->frag_count, flood->msg_id, MAC2STR(flood->src_mac));
+        return;
+    }
+
+    xSemaphoreTake(flood_lock, portMAX_DELAY);
+    flood_entry_t *entry= flood_cache_find(flood->src_mac, flood->msg_id, flood->frag_index);
+    if (entry != NULL || memcmp(own_mac_addr, flood->src_mac, ESP_NOW_ETH_ALEN) == 0)
+    {
+        if (entry != NULL && entry->copies < UINT8_MAX)
+            entry->copies++;
+        xSemaphoreGive(flood_lock);
+        stats_count(STATS_RX_FLOOD_DUPLICATES);
+        return;
+    }
+    entry= flood_cache_add(flood->src_mac, flood->msg_id, flood->frag_index);
+    entry->copies= 1;
+    if (flood->ttl > 1)
+    {
+        // the random delay gives the neighbours that got the frame at the same time the chance to relay it first
+        frame_ref(frame);
+        entry->frame= frame;
+        entry->relay_time= esp_timer_get_time() + esp_random() % ((uint32_t)FLOOD_RELAY_DELAY * 1000 + 1);
+        xTaskNotifyGive(flood_relay_task);
+    }
+    xSemaphoreGive(flood_lock);
+
+    stats_count(STATS_RX_FLOODS);
+    PACKET_LOGW(TAG, "Received flooded message %u from: "MACSTR", fragment %d/%d, TTL %d", flood->msg_id, MAC2STR(flood->src_mac), flood->frag_index, flood->frag_count, flood->ttl);
+    if (flood->frag_count > 1)
+        receive_fragment(flood->src_mac, flood->msg_id, flood->frag_index, flood->frag_count,
+            flood->frag_index * FLOOD_PAYLOAD_LEN, flood->payload, len - sizeof(user_flood_t), false);
+    else
+        deliver_user_data(flood->payload, len - sizeof(user_flood_t), false);
+}
+
+static int count_neighbours()
+{
+    int neighbours= 0;
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    for (int i = 1; i < entries_nbr; i++)
+        if (routing_table[i].hop_count == 1)
+            neighbours++;
+    xSemaphoreGive(table_lock);
+    return neighbours;
+}
+
+/* Relays the held frames as they fall due, counter-based: a node that heard FLOOD_COUNTER_THRESHOLD copies,
+ * or one from each of its neighbours, by then leaves the frame to them, since its own copy would reach few
+ * nodes that don't have it yet. This keeps a flood well below one transmission per node in dense meshes. */
+static void relay_floods(void *pvParameter)
+{
+    while (true)
+    {
+        TickType_t ticks= portMAX_DELAY;
+        xSemaphoreTake(flood_lock, portMAX_DELAY);
+        flood_entry_t *entry;
+        while ((entry= flood_cache_next_relay()) != NULL)
+        {
+            int64_t wait_us= entry->relay_time - esp_timer_get_time();
+            if (wait_us > 0)
+            {
+                int64_t tick_us= portTICK_PERIOD_MS * 1000;
+                ticks= (wait_us + tick_us - 1) / tick_us;
+                break;
+            }
+
+            frame_buffer_t *frame= entry->frame;
+            entry->frame= NULL;
+            int neighbours= count_neighbours();
+            if (FLOOD_COUNTER_THRESHOLD > 0 && (entry->copies >= FLOOD_COUNTER_THRESHOLD || (neighbours > 0 && entry->copies >= neighbours)))
+            {
+                stats_count(STATS_TX_FLOOD_SUPPRESSED);
+                frame_release(frame);
+                continue;
+            }
+            // frames are read-only while shared: the data task may still be delivering this one
+            if (atomic_load(&frame->refs) > 1)
+            {
+                frame_buffer_t *copy= frame_alloc(true);
+                if (copy == NULL)
+                {
+                    PACKET_LOGW(TAG, "Frame pool exhausted, not relaying flooded frame");
+                    frame_release(frame);
+                    continue;
+                }
+                memcpy(copy->data, frame->data, frame->len);
+                copy->len= frame->len;
+                copy->rx_time= frame->rx_time;
+                frame_release(frame);
+                frame= copy;
+            }
+            user_flood_t *flood= (user_flood_t*) ((example_espnow_data_t*)frame->data)->payload;
+            flood->ttl--;
+            frame->sealed= false;
+            PACKET_LOGI(TAG, "Relaying flooded message %u from "MACSTR", fragment %d, copies heard: %d", flood->msg_id, MAC2STR(flood->src_mac), flood->frag_index, entry->copies);
+            if (transmit_frame(s_example_broadcast_mac, frame, false) == ESP_OK)
+                stats_count(STATS_TX_FLOOD_RELAYS);
+        }
+        xSemaphoreGive(flood_lock);
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+/* Sends a user message frame to next_hop, in a bundle with others for it if it is small enough. Consumes the
+ * reference to frame. */
+static esp_err_t send_user_message(uint8_t *next_hop, frame_buffer_t *frame)
+{
+#if CONFIG_DSDV_AGGREGATION
+    example_espnow_data_t *data= (example_espnow_data_t*)frame->data;
+    int len= frame->len - sizeof(example_espnow_data_t);
+    // without a frame to start a bundle, the message goes alone
+    if (data->is_userData == USER_DATA_MESSAGE && len <= sizeof(user_data_t) + BUNDLE_MAX_MESSAGE
+            && bundle_message(next_hop, data->payload, len, frame->rx_time) == ESP_OK)
+    {
+        frame_release(frame);
+        return ESP_OK;
+    }
+#endif
+    return transmit_frame(next_hop, frame, true);
+}
+
+#if CONFIG_DSDV_AGGREGATION
+/* Sends a bundle and frees its slot. The caller holds bundle_lock. */
+static void send_bundle(bundle_t *bundle)
+{
+    frame_buffer_t *frame= bundle->frame;
+    example_espnow_data_t *data= (example_espnow_data_t*)frame->data;
+    int messages= bundle->messages;
+    bundle->frame= NULL;
+    if (messages == 1)
+    {
+        // nothing joined the message: it goes out as it came, without the record's length byte
+        frame->len--;
+        memmove(data->payload, data->payload + 1, frame->len - sizeof(example_espnow_data_t));
+        data->is_userData= USER_DATA_MESSAGE;
+    }
+    PACKET_LOGI(TAG, "Sending %d user messages to "MACSTR" in one frame", messages, MAC2STR(bundle->next_hop));
+    if (transmit_frame(bundle->next_hop, frame, true) == ESP_OK && messages > 1)
+    {
+        stats_count(STATS_TX_BUNDLES);
+        for (int i = 0; i < messages; i++)
+            stats_count(STATS_TX_BUNDLED);
+    }
+}
+
+/* Adds a message, user_data_t and payload, to the bundle for next_hop, starting one if there is none. A bundle
+ * goes out when the next message doesn't fit, when it has no room left for another, or BUNDLE_DELAY after its
+ * first message. Fails only when no frame is left to start a bundle. */
+static esp_err_t bundle_message(const uint8_t *next_hop, const uint8_t *message, int len, int64_t rx_time)
+{
+    xSemaphoreTake(bundle_lock, portMAX_DELAY);
+    bundle_t *bundle= bundle_find(next_hop);
+    if (bundle == NULL || !bundle_append(bundle, message, len))
+    {
+        if (bundle != NULL)
+            send_bundle(bundle);
+        else if ((bundle= bundle_free_slot()) == NULL)
+        {
+            // the bundle due first goes out early to make room
+            bundle= bundle_next_send();
+            send_bundle(bundle);
+        }
+        frame_buffer_t *frame= frame_alloc(true);
+        if (frame == NULL)
+        {
+            xSemaphoreGive(bundle_lock);
+            return ESP_ERR_NO_MEM;
+        }
+        // the forwarding latency of a bundle counts from the arrival of its first message
+        frame->rx_time= rx_time;
+        ((example_espnow_data_t*)frame->data)->is_userData= USER_DATA_BUNDLE;
+        bundle_start(bundle, next_hop, frame, esp_timer_get_time() + BUNDLE_DELAY * 1000);
+        bundle_append(bundle, message, len);
+        xTaskNotifyGive(bundle_send_task);
+    }
+    if (bundle->frame->len + 1 + sizeof(user_data_t) >= ESP_NOW_MAX_DATA_LEN)
+        send_bundle(bundle);
+    xSemaphoreGive(bundle_lock);
+    return ESP_OK;
+}
+
+/* Hands the messages of a bundle for this node to the handler and bundles the others again by their next hop. */
+static void receive_bundle(frame_buffer_t *frame, const uint8_t *prev_hop, uint8_t *payload, int payload_len)
+{
+    int offset= 0;
+    int len;
+    uint8_t *message;
+    while ((message= (uint8_t*) bundle_next_record(payload, payload_len, &offset, &len)) != NULL)
+    {
+        user_data_t *user_data= (user_data_t*) message;
+        if (memcmp(own_mac_addr, user_data->dest_mac, ESP_NOW_ETH_ALEN) == 0)
+        {
+            PACKET_LOGW(TAG, "Received bundled user message from: "MACSTR", len: %d", MAC2STR(prev_hop), len - sizeof(user_data_t));
+            deliver_user_data(user_data->payload, len - sizeof(user_data_t), false);
+            continue;
+        }
+
+        uint8_t next_hop[ESP_NOW_ETH_ALEN];
+        uint8_t hop_count;
+        if (find_next_hop(user_data->dest_mac, USER_DATA_HEAD(user_data), prev_hop, next_hop, &hop_count) != ESP_OK)
+        {
+            stats_count(STATS_NO_ROUTE);
+            PACKET_LOGW(TAG, "Failed to find a path to "MACSTR"", MAC2STR(user_data->dest_mac));
+        }
+        else if (bundle_message(next_hop, message, len, frame->rx_time) == ESP_OK)
+            stats_count(STATS_TX_FORWARDED);
+        else
+            stats_count(STATS_TX_QUEUE_FULL);
+    }
+}
+
+/* Like salvage_user_data(), for each message of a bundle the next hop didn't acknowledge. */
+static void salvage_bundle(frame_buffer_t *frame, const uint8_t *failed_hop)
+{
+    example_espnow_data_t *data= (example_espnow_data_t*)frame->data;
+    int payload_len= frame->len - sizeof(example_espnow_data_t);
+    int offset= 0;
+    int len;
+    const uint8_t *message;
+    while ((message= bundle_next_record(data->payload, payload_len, &offset, &len)) != NULL)
+    {
+        const user_data_t *user_data= (const user_data_t*) message;
+        uint8_t next_hop[ESP_NOW_ETH_ALEN];
+        uint8_t hop_count;
+        if (find_next_hop(user_data->dest_mac, USER_DATA_HEAD(user_data), NULL, next_hop, &hop_count) != ESP_OK || memcmp(next_hop, failed_hop, ESP_NOW_ETH_ALEN) == 0)
+            continue;
+        if (bundle_message(next_hop, message, len, frame->rx_time) == ESP_OK)
+            stats_count(STATS_TX_SALVAGED);
+    }
+    frame_release(frame);
+}
+
+/* Sends the bundles whose delay has run out. */
+static void send_bundles(void *pvParameter)
+{
+    while (true)
+    {
+        TickType_t ticks= portMAX_DELAY;
+        xSemaphoreTake(bundle_lock, portMAX_DELAY);
+        bundle_t *bundle;
+        while ((bundle= bundle_next_send()) != NULL)
+        {
+            int64_t wait_us= bundle->send_time - esp_timer_get_time();
+            if (wait_us > 0)
+            {
+                int64_t tick_us= portTICK_PERIOD_MS * 1000;
+                ticks= (wait_us + tick_us - 1) / tick_us;
+                break;
+            }
+            send_bundle(bundle);
+        }
+        xSemaphoreGive(bundle_lock);
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+#endif
+
+/* Metric the neighbour advertised for the route, not including the link to it. */
+static uint16_t advertised_metric(const RoutingAdvert_t *advert)
+{
+    if (advert->hop_count == UINT8_MAX)
+        return METRIC_INFINITY;
+#if CONFIG_DSDV_METRIC_ETX
+    return advert->metric;
+#else
+    return advert->hop_count;
+#endif
+}
 
-static void update_routing_table(RoutingEntry_t recvd_routing_entry, uint8_t *nextHop_addr)
+/* Metric of a route through the neighbour, from the finite metric the neighbour advertised for it. */
+static uint16_t path_metric(uint16_t advertised, int neighbour)
+{
+#if CONFIG_DSDV_METRIC_ETX
+    uint32_t metric= advertised + link_quality_etx(&routing_table_neighbour_stats(neighbour)->link);
+#else
+    uint32_t metric= advertised + 1;
+#endif
+    return metric < METRIC_INFINITY ? metric : METRIC_INFINITY - 1;
+}
+
+/* An alternate is loop-free if its neighbour advertised the current sequence number with a smaller metric than
+ * ours: the metric of a sequence number only shrinks, so the neighbour can't be routing through this node. */
+static bool alternate_feasible(int index, const RouteAlternate_t *alternate)
+{
+    return alternate->seq_num == routing_table[index].seq_num && alternate->metric < routing_table[index].metric;
+}
+
+static void update_routing_table(RoutingAdvert_t recvd_routing_entry, uint8_t *nextHop_addr, int neighbour)
 {    
-    int index;
-    for (index = 0; index < entries_nbr; index++)
-        if (memcmp(routing_table[index].destination_addr, recvd_routing_entry.destination_addr, ESP_NOW_ETH_ALEN) == 0) // known destination
-            break;
-    
-    if (index == entries_nbr)
+    // a broken route stays broken one hop further
+    uint8_t advertised_hop_count= recvd_routing_entry.hop_count;
+    uint16_t advertised= advertised_metric(&recvd_routing_entry);
+    uint16_t metric= METRIC_INFINITY;
+    if (recvd_routing_entry.hop_count < UINT8_MAX)
+    {
+        recvd_routing_entry.hop_count++;
+        metric= path_metric(advertised, neighbour);
+    }
+
+    int64_t current_time= esp_timer_get_time();
+    int index= routing_table_find(recvd_routing_entry.destination_addr);
+    if (index < 0)
     { 
+        // unknown destinations are only worth an entry if they are reachable
+        if (recvd_routing_entry.hop_count == UINT8_MAX)
+            return;
+#if CONFIG_DSDV_ZONE_ROUTING
+        // beyond the zone, only cluster heads get an entry
+        if (recvd_routing_entry.hop_count > ZONE_RADIUS && !(recvd_routing_entry.flags & ADVERT_FLAG_HEAD))
+            return;
+#endif
+
         // add new entry to table
+        index= routing_table_add(recvd_routing_entry.destination_addr);
+        if (index < 0)
+        {
+            stats_count(STATS_ROUTING_TABLE_FULL);
+            PACKET_LOGW(TAG, "Routing table full, ignoring route to "MACSTR"", MAC2STR(recvd_routing_entry.destination_addr));
+            return;
+        }
         RoutingEntry_t *new_routing_entry= &routing_table[index];
-        memcpy(new_routing_entry->destination_addr, recvd_routing_entry.destination_addr, ESP_NOW_ETH_ALEN);
-        memcpy(new_routing_entry->nextHop_addr, nextHop_addr, ESP_NOW_ETH_ALEN);
-        new_routing_entry->hop_count= recvd_routing_entry.hop_count + 1;
+        routing_table_set_next_hop(index, neighbour);
+        new_routing_entry->hop_count= recvd_routing_entry.hop_count;
+        new_routing_entry->metric= metric;
         new_routing_entry->seq_num= recvd_routing_entry.seq_num;
-        new_routing_entry->last_update_time= esp_timer_get_time();
-        entries_nbr++;
+        routing_info[index].last_update_time= current_time;
+        routing_info[index].first_heard_time= current_time;
+        note_route_change();
+#if CONFIG_DSDV_ZONE_ROUTING
+        routing_info[index].head= recvd_routing_entry.flags & ADVERT_FLAG_HEAD;
+        routing_info[index].previous_hop_count= UINT8_MAX;
+#endif
     }
     else
     {
         // Update existing entry if necessary
         RoutingEntry_t *curnt_routing_entry= &routing_table[index];
-        if (recvd_routing_entry.seq_num > curnt_routing_entry->seq_num)
+        RoutingEntryInfo_t *curnt_routing_info= &routing_info[index];
+#if CONFIG_DSDV_ZONE_ROUTING
+        // like an unknown one, an unreachable destination comes back only within the zone
+        if (curnt_routing_entry->hop_count == UINT8_MAX && index != 0 && recvd_routing_entry.hop_count != UINT8_MAX
+                && recvd_routing_entry.hop_count > ZONE_RADIUS && !(recvd_routing_entry.flags & ADVERT_FLAG_HEAD))
+            return;
+#endif
+        // a restored route only gives way to one as good: a longer one may lead back through this node, learned
+        // from it before the restart with a sequence number newer than the restored one
+        if (curnt_routing_info->provisional && metric != METRIC_INFINITY && metric > curnt_routing_entry->metric)
+            return;
+        bool was_broken= curnt_routing_entry->hop_count == UINT8_MAX;
+        uint8_t old_next_hop= curnt_routing_entry->next_hop;
+#if CONFIG_DSDV_ZONE_ROUTING
+        uint8_t old_hop_count= curnt_routing_entry->hop_count;
+        uint16_t old_seq_num= curnt_routing_entry->seq_num;
+#endif
+        if (SEQ_NUM_NEWER(recvd_routing_entry.seq_num, curnt_routing_entry->seq_num))
         {
             if (index == 0)
+            {
+                // the route to this node broke somewhere: the next sequence number repairs it
                 curnt_routing_entry->seq_num= recvd_routing_entry.seq_num % 2 ? recvd_routing_entry.seq_num+1 : recvd_routing_entry.seq_num;
+                note_route_change();
+            }
+            else if (recvd_routing_entry.hop_count == UINT8_MAX && curnt_routing_entry->hop_count != UINT8_MAX && curnt_routing_entry->next_hop != neighbour)
+            {
+                // a break elsewhere doesn't affect a route that doesn't go through it; the neighbour that lost
+                // the route is repaired by this node's next advert with a newer sequence number
+                note_route_change();
+            }
+            else if (recvd_routing_entry.hop_count == UINT8_MAX && curnt_routing_entry->hop_count != UINT8_MAX && fail_over(index))
+            {
+                // the alternate keeps the current sequence number until the destination's next one arrives
+            }
             else
             {
-                memcpy(curnt_routing_entry->nextHop_addr, nextHop_addr, ESP_NOW_ETH_ALEN);
-                curnt_routing_entry->hop_count= recvd_routing_entry.hop_count + 1;
+                // a longer route may be followed by a better one with the same sequence number: hold it back
+                if (metric != METRIC_INFINITY && metric > curnt_routing_entry->metric)
+                    curnt_routing_info->advertise_after= current_time + 2 * (int64_t)curnt_routing_info->settling_time;
+                routing_table_set_next_hop(index, neighbour);
+                curnt_routing_entry->hop_count= recvd_routing_entry.hop_count;
+                curnt_routing_entry->metric= metric;
                 curnt_routing_entry->seq_num= recvd_routing_entry.seq_num;
-                curnt_routing_entry->last_update_time= esp_timer_get_time();
+                curnt_routing_info->last_update_time= current_time;
+                curnt_routing_info->first_heard_time= current_time;
             }
         }
         else if (recvd_routing_entry.seq_num == curnt_routing_entry->seq_num)
         {
-            if (recvd_routing_entry.hop_count + 1 < curnt_routing_entry->hop_count)
+            if (metric < curnt_routing_entry->metric)
             {
-                memcpy(curnt_routing_entry->nextHop_addr, nextHop_addr, ESP_NOW_ETH_ALEN);
-                curnt_routing_entry->hop_count= recvd_routing_entry.hop_count + 1;
-                curnt_routing_entry->last_update_time= esp_timer_get_time();
+                // weighted average of the time the best route takes to arrive
+                uint32_t settling_time= current_time - curnt_routing_info->first_heard_time;
+                curnt_routing_info->settling_time= (3 * (uint64_t)curnt_routing_info->settling_time + settling_time) / 4;
+                routing_table_set_next_hop(index, neighbour);
+                curnt_routing_entry->hop_count= recvd_routing_entry.hop_count;
+                curnt_routing_entry->metric= metric;
+                curnt_routing_info->last_update_time= current_time;
             }
-            else if (memcmp(curnt_routing_entry->nextHop_addr, nextHop_addr, ESP_NOW_ETH_ALEN) == 0)
+            else if (curnt_routing_entry->next_hop == neighbour)
             {
-                curnt_routing_entry->hop_count= recvd_routing_entry.hop_count + 1;
-                curnt_routing_entry->last_update_time= esp_timer_get_time();
+                // the metric of a sequence number never grows, which keeps the routes loop-free when
+                // link estimates get worse; the worse metric is taken with the next sequence number
+                if (metric == METRIC_INFINITY && !fail_over(index))
+                {
+                    curnt_routing_entry->hop_count= recvd_routing_entry.hop_count;
+                    curnt_routing_entry->metric= metric;
+                }
+                curnt_routing_info->last_update_time= current_time;
             }                
         }
         else if (memcmp(curnt_routing_entry->destination_addr, nextHop_addr, ESP_NOW_ETH_ALEN) == 0)
         {
-            memcpy(curnt_routing_entry->nextHop_addr, nextHop_addr, ESP_NOW_ETH_ALEN);
-            curnt_routing_entry->hop_count= recvd_routing_entry.hop_count + 1;
+            routing_table_set_next_hop(index, neighbour);
+            curnt_routing_entry->hop_count= recvd_routing_entry.hop_count;
+            curnt_routing_entry->metric= metric;
             curnt_routing_entry->seq_num += curnt_routing_entry->seq_num % 2 ? 1 : 0;
-            curnt_routing_entry->last_update_time= esp_timer_get_time();
+            curnt_routing_info->last_update_time= current_time;
+            curnt_routing_info->first_heard_time= current_time;
         }   
+
+        // an advert that refreshed a restored route confirms it
+        if (curnt_routing_info->last_update_time == current_time)
+        {
+            curnt_routing_info->provisional= false;
+#if CONFIG_DSDV_ZONE_ROUTING
+            bool head= recvd_routing_entry.flags & ADVERT_FLAG_HEAD;
+            if (head != curnt_routing_info->head)
+                xTaskNotifyGive(routing_task);
+            curnt_routing_info->head= head;
+#endif
+        }
+#if CONFIG_DSDV_ZONE_ROUTING
+        if (curnt_routing_entry->seq_num != old_seq_num)
+            curnt_routing_info->previous_hop_count= old_hop_count;
+#endif
+
+        // routes through other neighbours with the current sequence number are kept as alternates
+        if (index != 0 && curnt_routing_entry->next_hop != neighbour)
+        {
+            if (advertised == METRIC_INFINITY)
+                routing_table_remove_alternate(index, neighbour);
+            else if (recvd_routing_entry.seq_num == curnt_routing_entry->seq_num)
+                routing_table_set_alternate(index, neighbour, advertised_hop_count, recvd_routing_entry.seq_num, advertised);
+        }
+
+        // broken and repaired routes are advertised right away
+        bool is_broken= curnt_routing_entry->hop_count == UINT8_MAX;
+        if (was_broken != is_broken)
+        {
+            stats_count(is_broken ? STATS_ROUTE_BREAKS : STATS_ROUTE_REPAIRS);
+            note_route_change();
+            xTaskNotifyGive(routing_task);
+        }
+        else if (!is_broken && curnt_routing_entry->next_hop != old_next_hop)
+            stats_count(STATS_ROUTE_CHANGES);
+    }
+}
+
+/* Marks the route as broken and wakes the routing task to advertise it. */
+static void break_route(int index)
+{
+    // an odd sequence number marks a route broken by someone else than its destination
+    routing_table[index].hop_count= UINT8_MAX;
+    routing_table[index].metric= METRIC_INFINITY;
+    routing_table[index].seq_num += routing_table[index].seq_num % 2 ? 2 : 1;
+    stats_count(STATS_ROUTE_BREAKS);
+    note_route_change();
+    xTaskNotifyGive(routing_task);
+}
+
+/* Brings the next periodic advert forward with the adaptive period. */
+static void note_route_change()
+{
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+    if (!routes_changed)
+        xTaskNotifyGive(routing_task);
+    routes_changed= true;
+#endif
+}
+
+/* Moves the route to its best loop-free alternate, keeping the sequence number. Returns false if there is none. */
+static bool fail_over(int index)
+{
+    RoutingEntry_t *entry= &routing_table[index];
+    RoutingEntryInfo_t *info= &routing_info[index];
+    int best= -1;
+    uint16_t best_metric= METRIC_INFINITY;
+    for (int i = 0; i < info->alternates_nbr; i++)
+    {
+        uint16_t metric= path_metric(info->alternates[i].metric, info->alternates[i].next_hop);
+        if (alternate_feasible(index, &info->alternates[i]) && metric < best_metric)
+        {
+            best= i;
+            best_metric= metric;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    RouteAlternate_t alternate= info->alternates[best];
+    routing_table_set_next_hop(index, alternate.next_hop);
+    entry->hop_count= alternate.hop_count + 1;
+    entry->metric= best_metric;
+    stats_count(STATS_ROUTE_FAILOVERS);
+    PACKET_LOGI(TAG, "Route to "MACSTR" failed over to "MACSTR"", MAC2STR(entry->destination_addr), MAC2STR(routing_table_next_hop(index)));
+    return true;
+}
+
+/* Moves every route through the neighbour to an alternate, breaking those without one. Returns the number of broken routes. */
+static int break_routes_via(int neighbour)
+{
+    int broken= 0;
+    routing_table_remove_alternates_via(neighbour);
+    for (int i = 1; i < entries_nbr; i++)
+        if (routing_table[i].next_hop == neighbour && routing_table[i].hop_count != UINT8_MAX && !fail_over(i))
+        {
+            break_route(i);
+            broken++;
+        }
+    return broken;
+}
+
+/* Sends a user message the next hop didn't acknowledge over the route that replaced it, if there is one. */
+static void salvage_user_data(frame_buffer_t *frame, const uint8_t *failed_hop)
+{
+#if CONFIG_DSDV_AGGREGATION
+    if (((example_espnow_data_t*)frame->data)->is_userData == USER_DATA_BUNDLE)
+    {
+        salvage_bundle(frame, failed_hop);
+        return;
+    }
+#endif
+    user_data_t *user_data= (user_data_t*) ((example_espnow_data_t*)frame->data)->payload;
+    uint8_t next_hop[ESP_NOW_ETH_ALEN];
+    uint8_t hop_count;
+    if (find_next_hop(user_data->dest_mac, USER_DATA_HEAD(user_data), NULL, next_hop, &hop_count) != ESP_OK || memcmp(next_hop, failed_hop, ESP_NOW_ETH_ALEN) == 0)
+    {
+        frame_release(frame);
+        return;
     }
+    PACKET_LOGW(TAG, "Sending user message for "MACSTR" over "MACSTR" instead", MAC2STR(user_data->dest_mac), MAC2STR(next_hop));
+    if (transmit_frame(next_hop, frame, true) == ESP_OK)
+        stats_count(STATS_TX_SALVAGED);
+}
+
+#if CONFIG_DSDV_MULTIPATH_LOAD_BALANCE
+static uint32_t flow_hash(const uint8_t *prev_hop, const uint8_t *dest)
+{
+    // FNV-1a
+    uint32_t hash= 2166136261u;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        hash= (hash ^ prev_hop[i]) * 16777619u;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        hash= (hash ^ dest[i]) * 16777619u;
+    return hash;
+}
+#endif
+
+/* Next hop towards the destination. With CONFIG_DSDV_MULTIPATH_LOAD_BALANCE, the messages that come from
+ * prev_hop take one of the loop-free paths as good as the route; without prev_hop, the route itself.
+ * With CONFIG_DSDV_ZONE_ROUTING, a destination beyond the zone is reached through head_addr, the head the
+ * message's source chose: nodes that picked different heads could pass the message back and forth. Without
+ * a head given, the node picks its own. */
+static esp_err_t find_next_hop(const uint8_t *mac_addr, const uint8_t *head_addr, const uint8_t *prev_hop, uint8_t *nextHop_addr, uint8_t *hop_count)
+{
+    if (table_lock == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    esp_err_t ret= ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    int index= routing_table_find(mac_addr);
+#if CONFIG_DSDV_ZONE_ROUTING
+    // beyond the zone, towards the head of the destination's cluster; a node on the way whose zone
+    // holds the destination takes over
+    if (index < 0 || routing_table[index].hop_count == UINT8_MAX)
+    {
+        if (head_addr == NULL || IS_UNSET_ADDR(head_addr))
+            head_addr= zone_find_head(mac_addr);
+        int head= head_addr != NULL ? routing_table_find(head_addr) : -1;
+        if (head > 0)
+            index= head;
+    }
+#endif
+    if (index >= 0 && routing_table[index].hop_count != UINT8_MAX)
+    {
+        int next_hop= routing_table[index].next_hop;
+        *hop_count= routing_table[index].hop_count;
+#if CONFIG_DSDV_MULTIPATH_LOAD_BALANCE
+        if (prev_hop != NULL)
+        {
+            const RouteAlternate_t *paths[MAX_ALTERNATES];
+            int paths_nbr= 0;
+            for (int i = 0; i < routing_info[index].alternates_nbr; i++)
+            {
+                const RouteAlternate_t *alternate= &routing_info[index].alternates[i];
+                if (alternate_feasible(index, alternate) && path_metric(alternate->metric, alternate->next_hop) <= routing_table[index].metric)
+                    paths[paths_nbr++]= alternate;
+            }
+            int path= paths_nbr > 0 ? flow_hash(prev_hop, mac_addr) % (paths_nbr + 1) : 0;
+            if (path > 0)
+            {
+                next_hop= paths[path - 1]->next_hop;
+                *hop_count= paths[path - 1]->hop_count + 1;
+            }
+        }
+#endif
+        memcpy(nextHop_addr, routing_table_neighbour_addr(next_hop), ESP_NOW_ETH_ALEN);
+        ret= ESP_OK;
+    }
+    xSemaphoreGive(table_lock);
+    return ret;
+}
+
+static bool entry_changed(int i)
+{
+    return routing_table[i].hop_count != routing_info[i].advertised_hop_count
+        || routing_table[i].seq_num != routing_info[i].advertised_seq_num;
+}
+
+#if CONFIG_DSDV_ZONE_ROUTING
+/* Entries the neighbours keep: those that are within their zones, the routes to cluster heads, and a head's
+ * demotion until it was passed on. A route broken at the edge of the zone reaches the nodes that had it. */
+static bool entry_in_zone(int i)
+{
+    if (routing_info[i].head || routing_info[i].advertised_head)
+        return true;
+    uint8_t hop_count= routing_table[i].hop_count == UINT8_MAX ? routing_info[i].advertised_hop_count : zone_hop_count(i);
+    return hop_count < ZONE_RADIUS;
+}
+#endif
+
+static bool entry_selected(int i, int selection, int64_t current_time)
+{
+    // restored routes aren't passed on before they are confirmed
+    if (routing_info[i].provisional)
+        return false;
+#if CONFIG_DSDV_ZONE_ROUTING
+    if (!entry_in_zone(i))
+        return false;
+#endif
+    if (selection == ADVERTISE_ALL)
+        return true;
+    if (!entry_changed(i))
+        return false;
+    if (routing_table[i].hop_count == UINT8_MAX || routing_info[i].advertised_hop_count == UINT8_MAX)
+        return true;
+#if CONFIG_DSDV_ZONE_ROUTING
+    // the election of the heads waits for the flags
+    if (routing_info[i].head != routing_info[i].advertised_head)
+        return true;
+#endif
+    return selection == ADVERTISE_CHANGED && current_time >= routing_info[i].advertise_after;
+}
+
+static void send_routing_packet(frame_buffer_t *frame, stats_counter_t counter)
+{
+    RoutingPacket_t *packet= (RoutingPacket_t*) ((example_espnow_data_t*)frame->data)->payload;
+    frame->len += sizeof(RoutingPacket_t) + packet->entries_nbr * sizeof(RoutingAdvert_t);
+    if (transmit_frame(s_example_broadcast_mac, frame, false) == ESP_OK)
+        stats_count(counter);
+}
+
+/* Broadcast the selected entries, packing as many as fit into each frame. */
+static void send_routing_packets(uint8_t type, int selection)
+{
+    frame_buffer_t *frame= NULL;
+    RoutingPacket_t *packet= NULL;
+    int64_t current_time= esp_timer_get_time();
+    stats_counter_t counter= type == DSDV_FULL_DUMP ? STATS_TX_FULL_DUMPS : selection == ADVERTISE_URGENT ? STATS_TX_TRIGGERED : STATS_TX_UPDATES;
+
+    for (int i = 0; i < entries_nbr; i++)
+    {
+        if (!entry_selected(i, selection, current_time))
+            continue;
+        if (frame == NULL)
+        {
+            frame= frame_alloc(false);
+            if (frame == NULL)
+            {
+                ESP_LOGW(TAG, "Frame pool exhausted, routing advertisement incomplete");
+                return;
+            }
+            packet= (RoutingPacket_t*) ((example_espnow_data_t*)frame->data)->payload;
+            packet->type= type;
+            packet->entries_nbr= 0;
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+            packet->period= advert_period;
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+            packet->channel= channel_home();
+#endif
+        }
+        RoutingAdvert_t *advert= &packet->entries[packet->entries_nbr++];
+        memcpy(advert->destination_addr, routing_table[i].destination_addr, ESP_NOW_ETH_ALEN);
+        advert->hop_count= routing_table[i].hop_count;
+        advert->seq_num= routing_table[i].seq_num;
+#if CONFIG_DSDV_METRIC_ETX
+        advert->metric= routing_table[i].metric;
+#endif
+#if CONFIG_DSDV_ZONE_ROUTING
+        advert->flags= routing_info[i].head ? ADVERT_FLAG_HEAD : 0;
+        routing_info[i].advertised_head= routing_info[i].head;
+#endif
+        routing_info[i].advertised_hop_count= routing_table[i].hop_count;
+        routing_info[i].advertised_seq_num= routing_table[i].seq_num;
+        if (packet->entries_nbr == MAX_ENTRIES_PER_PACKET)
+        {
+            send_routing_packet(frame, counter);
+            frame= NULL;
+        }
+    }
+    if (frame != NULL)
+        send_routing_packet(frame, counter);
+}
+
+static void send_full_dump()
+{
+    send_routing_packets(DSDV_FULL_DUMP, ADVERTISE_ALL);
 }
 
 static void send_incremental_updates()
 {
-    for (int i = 1; i < entries_nbr; i++) {
-        if (memcmp((uint8_t*)&routing_table[i], (uint8_t*)&routing_table_old[i], sizeof(RoutingEntry_t)) != 0) {
-            for (int j = 1; j < entries_nbr; j++)
-                if (routing_table[j].hop_count == 1)// && (i!=j || routing_table_old[i].seq_num % 2))
-                    transmit_data(routing_table[j].destination_addr, (uint8_t*)&routing_table[i], sizeof(RoutingEntry_t), true, false);
-            vTaskDelay(BROADCASTING_PERIOD / MAX_NODES / portTICK_PERIOD_MS);
-            memcpy((uint8_t*)&routing_table_old[i], (uint8_t*)&routing_table[i], sizeof(RoutingEntry_t));
+    int count= 0;
+    int64_t current_time= esp_timer_get_time();
+    for (int i = 0; i < entries_nbr; i++)
+        if (entry_selected(i, ADVERTISE_CHANGED, current_time))
+            count++;
+
+    // an incremental update that doesn't fit into one frame is sent as a full dump
+    if (count > MAX_ENTRIES_PER_PACKET)
+        send_full_dump();
+    else if (count > 0)
+        send_routing_packets(DSDV_INCREMENTAL_UPDATE, ADVERTISE_CHANGED);
+}
+
+static void send_triggered_updates()
+{
+    send_routing_packets(DSDV_INCREMENTAL_UPDATE, ADVERTISE_URGENT);
+}
+
+#if CONFIG_DSDV_ZONE_ROUTING
+/* Head a message for the destination is sent to, all zeros if none is known. */
+static void find_head(const uint8_t *mac_addr, uint8_t *head_addr)
+{
+    memset(head_addr, 0, ESP_NOW_ETH_ALEN);
+    if (table_lock == NULL)
+        return;
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    const uint8_t *found= zone_find_head(mac_addr);
+    if (found != NULL)
+        memcpy(head_addr, found, ESP_NOW_ETH_ALEN);
+    xSemaphoreGive(table_lock);
+}
+
+/* Distance that decides whether a destination is in the zone. The first route with a new sequence number is
+ * often not the shortest one, so the distance the previous sequence number settled at counts as well; a route
+ * that really got longer leaves the zone one sequence number later. */
+static uint8_t zone_hop_count(int index)
+{
+    uint8_t hop_count= routing_table[index].hop_count;
+    if (hop_count == UINT8_MAX || routing_info[index].previous_hop_count >= hop_count)
+        return hop_count;
+    return routing_info[index].previous_hop_count;
+}
+
+/* A node is a cluster head unless a head that precedes it is in its zone. The heads are settled in this
+ * order as the flags spread, a few periods after a change. A booting node first waits for its zone to fill in,
+ * then only takes over if it precedes its whole zone, until the flags of these heads reached it: otherwise every
+ * node would be a head for a moment, and routed to from the whole mesh. */
+static bool elect_head(int periods)
+{
+    static int periods_uncovered= 0;
+    if (periods < ZONE_RADIUS)
+        return false;
+    for (int i = 1; i < entries_nbr; i++)
+        if ((routing_info[i].head || periods < 2 * ZONE_RADIUS) && zone_hop_count(i) <= ZONE_RADIUS
+                && zone_precedes(routing_table[i].destination_addr, own_mac_addr))
+        {
+            periods_uncovered= 0;
+            return false;
         }
+    return routing_info[0].head || ++periods_uncovered >= ZONE_PROMOTION_PERIODS;
+}
+
+static void send_zone_summary_packet(frame_buffer_t *frame)
+{
+    ZoneSummary_t *summary= (ZoneSummary_t*) ((example_espnow_data_t*)frame->data)->payload;
+    frame->len += sizeof(ZoneSummary_t) + summary->members_nbr * ESP_NOW_ETH_ALEN;
+    if (transmit_frame(s_example_broadcast_mac, frame, false) == ESP_OK)
+        stats_count(STATS_TX_ZONE_SUMMARIES);
+}
+
+/* Destinations a summary would list, in any order. */
+static uint32_t zone_members_hash()
+{
+    uint32_t hash= 0;
+    for (int i = 1; i < entries_nbr; i++)
+    {
+        if (zone_hop_count(i) > ZONE_RADIUS || routing_info[i].provisional)
+            continue;
+        // FNV-1a per destination, summed
+        uint32_t member_hash= 2166136261u;
+        for (int j = 0; j < ESP_NOW_ETH_ALEN; j++)
+            member_hash= (member_hash ^ routing_table[i].destination_addr[j]) * 16777619u;
+        hash += member_hash;
+    }
+    return hash;
+}
+
+/* A cluster head announces the reachable destinations of its zone, in as many parts as needed, with each full
+ * dump and whenever they changed. */
+static void send_zone_summary(bool full_dump)
+{
+    static uint32_t summary_hash= 0;
+    if (!routing_info[0].head)
+    {
+        summary_hash= 0;
+        return;
+    }
+    uint32_t hash= zone_members_hash();
+    if (!full_dump && hash == summary_hash)
+        return;
+    summary_hash= hash;
+    frame_buffer_t *frame= NULL;
+    ZoneSummary_t *summary= NULL;
+    int parts= 0;
+    for (int i = 1; i < entries_nbr; i++)
+    {
+        if (zone_hop_count(i) > ZONE_RADIUS || routing_info[i].provisional)
+            continue;
+        if (frame == NULL)
+        {
+            if (parts == MAX_SUMMARY_PARTS)
+                break;
+            frame= frame_alloc(false);
+            if (frame == NULL)
+            {
+                ESP_LOGW(TAG, "Frame pool exhausted, zone summary incomplete");
+                return;
+            }
+            summary= (ZoneSummary_t*) ((example_espnow_data_t*)frame->data)->payload;
+            summary->type= DSDV_ZONE_SUMMARY;
+            summary->members_nbr= 0;
+            summary->part= parts++;
+            memcpy(summary->head_addr, own_mac_addr, ESP_NOW_ETH_ALEN);
+            summary->seq_num= routing_table[0].seq_num;
+        }
+        memcpy(summary->members[summary->members_nbr++], routing_table[i].destination_addr, ESP_NOW_ETH_ALEN);
+        if (summary->members_nbr == MAX_MEMBERS_PER_PACKET)
+        {
+            send_zone_summary_packet(frame);
+            frame= NULL;
+        }
+    }
+    if (frame != NULL)
+        send_zone_summary_packet(frame);
+}
+
+/* Maps the destinations of another head's zone to that head and passes the summary on unchanged, the first
+ * time it is heard. */
+static void receive_zone_summary(frame_buffer_t *frame, const ZoneSummary_t *summary)
+{
+    if (memcmp(summary->head_addr, own_mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        return;
+    int64_t current_time= esp_timer_get_time();
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    bool fresh= zone_summary_fresh(summary->head_addr, summary->seq_num, summary->part, current_time);
+    for (int i = 0; fresh && i < summary->members_nbr; i++)
+    {
+        if (memcmp(summary->members[i], own_mac_addr, ESP_NOW_ETH_ALEN) == 0)
+            continue;
+        // a head that was demoted or can't be reached is replaced right away
+        const uint8_t *head_addr= zone_find_head(summary->members[i]);
+        int head= head_addr != NULL ? routing_table_find(head_addr) : -1;
+        bool head_valid= head > 0 && routing_info[head].head && routing_table[head].hop_count != UINT8_MAX;
+        zone_set_head(summary->members[i], summary->head_addr, current_time, head_valid ? (int64_t)ZONE_HEAD_HOLD_TIME * 1000 : 0);
+    }
+    xSemaphoreGive(table_lock);
+    if (!fresh)
+        return;
+
+    stats_count(STATS_RX_ZONE_SUMMARIES);
+    PACKET_LOGI(TAG, "Received zone summary of "MACSTR", part %d, members: %d", MAC2STR(summary->head_addr), summary->part, summary->members_nbr);
+    frame_ref(frame);
+    if (transmit_frame(s_example_broadcast_mac, frame, false) == ESP_OK)
+        stats_count(STATS_TX_ZONE_SUMMARY_RELAYS);
+}
+#endif
+
+#if CONFIG_DSDV_PERSISTENT_STATE
+/* Destinations and hop counts of the confirmed reachable routes, in any order. Next hops and sequence numbers
+ * change all the time without making the stored routes less useful, so they don't count. */
+static uint32_t routes_hash()
+{
+    uint32_t hash= 0;
+    for (int i = 1; i < entries_nbr; i++)
+    {
+        if (routing_table[i].hop_count == UINT8_MAX || routing_info[i].provisional)
+            continue;
+        // FNV-1a per entry, summed
+        uint32_t entry_hash= 2166136261u;
+        for (int j = 0; j < ESP_NOW_ETH_ALEN; j++)
+            entry_hash= (entry_hash ^ routing_table[i].destination_addr[j]) * 16777619u;
+        entry_hash= (entry_hash ^ routing_table[i].hop_count) * 16777619u;
+        hash += entry_hash;
+    }
+    return hash;
+}
+
+/* A restarted node goes on above the sequence numbers it used before, and takes the routes it knew as provisional:
+ * they are used for forwarding right away but not advertised, and dropped if no advert confirms them within
+ * PROVISIONAL_TIMEOUT. */
+static void restore_routing_state()
+{
+    if (route_store_open() != ESP_OK)
+        return;
+    uint16_t seq_num;
+    if (route_store_load_seq_num(&seq_num) == ESP_OK)
+        routing_table[0].seq_num= seq_num;
+    seq_num_stored= true;
+    seq_num_limit= routing_table[0].seq_num;
+    reserve_seq_nums(routing_table[0].seq_num + SEQ_NUM_RESERVE);
+
+    int64_t current_time= esp_timer_get_time();
+    int restored= 0;
+    int routes_nbr= route_store_load_routes(stored_routes, MAX_NODES);
+    for (int i = 0; i < routes_nbr; i++)
+    {
+        StoredRoute_t *route= &stored_routes[i];
+        if (route->hop_count == UINT8_MAX || routing_table_find(route->destination_addr) >= 0)
+            continue;
+        int neighbour= routing_table_neighbour(route->next_hop_addr);
+        int index= neighbour >= 0 ? routing_table_add(route->destination_addr) : -1;
+        if (index < 0)
+            break;
+        routing_table_set_next_hop(index, neighbour);
+        routing_table[index].hop_count= route->hop_count;
+        routing_table[index].seq_num= route->seq_num;
+        routing_table[index].metric= route->metric;
+        routing_info[index].last_update_time= current_time;
+        routing_info[index].first_heard_time= current_time;
+        routing_info[index].provisional= true;
+        stats_count(STATS_ROUTES_RESTORED);
+        restored++;
+    }
+    stored_routes_hash= routes_hash();
+    next_store_time= current_time + (int64_t)ROUTE_STORE_INTERVAL * 1000000;
+    ESP_LOGI(TAG, "Restored sequence number %d and %d routes", routing_table[0].seq_num, restored);
+}
+
+/* Own sequence numbers are reserved SEQ_NUM_RESERVE at a time before they are advertised, which takes one
+ * NVS write every SEQ_NUM_RESERVE / 2 broadcasting periods. Called with the table lock held, this only moves
+ * on to the next sequence number if it is reserved. Returns the limit to write once the lock is released, a
+ * period before the reserve runs out, or -1. */
+static int advance_seq_num()
+{
+    uint16_t seq_num= routing_table[0].seq_num + 2;
+    if (!seq_num_stored || SEQ_NUM_NEWER(seq_num_limit, seq_num))
+        routing_table[0].seq_num= seq_num;
+    if (!seq_num_stored || SEQ_NUM_NEWER(seq_num_limit, (uint16_t)(routing_table[0].seq_num + 2)))
+        return -1;
+    return (uint16_t)(routing_table[0].seq_num + SEQ_NUM_RESERVE);
+}
+
+/* The new limit only counts once it is in flash. seq_num_limit is only touched by the routing task. */
+static void reserve_seq_nums(uint16_t limit)
+{
+    if (route_store_save_seq_num(limit) != ESP_OK)
+        return;
+    seq_num_limit= limit;
+    stats_count(STATS_NVS_WRITES);
+}
+
+/* Copies the reachable routes into stored_routes if they changed since they were last written, at most once
+ * per ROUTE_STORE_INTERVAL. Returns their number, or -1 if there is nothing to write. */
+static int snapshot_routes(int64_t current_time)
+{
+    if (current_time < next_store_time)
+        return -1;
+    uint32_t hash= routes_hash();
+    if (hash == stored_routes_hash)
+        return -1;
+
+    int routes_nbr= 0;
+    for (int i = 1; i < entries_nbr; i++)
+    {
+        if (routing_table[i].hop_count == UINT8_MAX || routing_info[i].provisional)
+            continue;
+        StoredRoute_t *route= &stored_routes[routes_nbr++];
+        memcpy(route->destination_addr, routing_table[i].destination_addr, ESP_NOW_ETH_ALEN);
+        memcpy(route->next_hop_addr, routing_table_next_hop(i), ESP_NOW_ETH_ALEN);
+        route->hop_count= routing_table[i].hop_count;
+        route->seq_num= routing_table[i].seq_num;
+        route->metric= routing_table[i].metric;
     }
+    stored_routes_hash= hash;
+    next_store_time= current_time + (int64_t)ROUTE_STORE_INTERVAL * 1000000;
+    return routes_nbr;
 }
+#endif
 
 inline static void print_routing_table()
 {
     ESP_LOGI("", "\nRouting Table:");
-    ESP_LOGI("", "| %-17s | %-17s | %-10s | %-10s | %-16s |", "Destination", "Next Hop", "Hop Count", "Seq. Num", "Last UpdateTime");
-    ESP_LOGI("", "|-------------------|-------------------|------------|------------|------------------|");
+    ESP_LOGI("", "| %-17s | %-17s | %-10s | %-10s | %-10s | %-10s | %-16s |", "Destination", "Next Hop", "Hop Count", "Metric", "Link RSSI", "Seq. Num", "Last UpdateTime");
+    ESP_LOGI("", "|-------------------|-------------------|------------|------------|------------|------------|------------------|");
     for (int i = 0; i < entries_nbr; i++)
-        ESP_LOGI("", "| "MACSTR" | "MACSTR" | %-10d | %-10d | %-16lld |", 
+        ESP_LOGI("", "| "MACSTR" | "MACSTR" | %-10d | %-10d | %-10d | %-10d | %-16lld |", 
             MAC2STR(routing_table[i].destination_addr),
-            MAC2STR(routing_table[i].nextHop_addr),
+            MAC2STR(routing_table_next_hop(i)),
             routing_table[i].hop_count,
+            routing_table[i].metric,
+            routing_table_neighbour_stats(routing_table[i].next_hop)->link.rssi / 16,
             routing_table[i].seq_num,
-            routing_table[i].last_update_time / 1000000
+            routing_info[i].last_update_time / 1000000
         );
     ESP_LOGI("", "\n");
 }
@@ -2,13 +2,66 @@
 #define DSDV_PROTOCOL_H
 
 #include "networking_utils.h"
+#include "routing_table.h"
+#include "reassembly.h"
+#include "flood_cache.h"
+#include "route_store.h"
+#include "zone.h"
+#include "bundle.h"
+#include "compress.h"
+#include "channel.h"
 
 
-#define MAX_NODES           10
 #define BROADCASTING_PERIOD 5000 // [ms]
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+#define MIN_BROADCASTING_PERIOD CONFIG_DSDV_MIN_BROADCASTING_PERIOD // [ms] period after the routes changed
+#define MAX_BROADCASTING_PERIOD CONFIG_DSDV_MAX_BROADCASTING_PERIOD // [ms] the period doubles up to this while they don't
+#else
+#define MIN_BROADCASTING_PERIOD BROADCASTING_PERIOD
+#define MAX_BROADCASTING_PERIOD BROADCASTING_PERIOD
+#endif
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+#define ADVERT_DELAY        CONFIG_DSDV_WAKE_INTERVAL // [ms] longest wait of an advert for the next wake or control window
+#else
+#define ADVERT_DELAY        0
+#endif
+#define FULL_DUMP_INTERVAL  6    // [broadcasting periods]
+#define ROUTE_EXPIRY_TIME   (MAX_BROADCASTING_PERIOD * FULL_DUMP_INTERVAL * 2) // [ms] unreachable entries are dropped after this
+#define BROADCAST_JITTER    10   // [%] periodic broadcasts are spread over +-BROADCAST_JITTER of the period
+#define TRIGGER_JITTER      20   // [ms] maximum delay of a triggered update
+#define REASSEMBLY_TIMEOUT  2000 // [ms] a message whose fragments haven't all arrived by then is dropped
+#define FRAGMENT_SEND_TIMEOUT 5000 // [ms] transmit_user_data() gives up on a message whose fragments don't get queued by then
+#define FLOOD_RELAY_DELAY   CONFIG_DSDV_FLOOD_RELAY_DELAY // [ms] maximum random delay before a flooded frame is relayed
+#define FLOOD_COUNTER_THRESHOLD CONFIG_DSDV_FLOOD_COUNTER_THRESHOLD // copies heard that suppress the relay, 0 for none
+#define FLOOD_TASK_PRIORITY 4    // like the data consumer task
+#define BUNDLE_TASK_PRIORITY 4   // like the data consumer task
+#define PROVISIONAL_TIMEOUT (MAX_BROADCASTING_PERIOD * 2) // [ms] restored routes no advert confirmed by then are dropped
+#define ROUTE_STORE_INTERVAL CONFIG_DSDV_ROUTE_STORE_INTERVAL // [s] minimum time between two writes of the routes
+#define ZONE_HEAD_HOLD_TIME (MAX_BROADCASTING_PERIOD * (FULL_DUMP_INTERVAL + 1)) // [ms] a destination's head is kept this long without a summary listing it
+#define ZONE_ROUTE_TIMEOUT (MAX_BROADCASTING_PERIOD * 3) // [ms] routes not refreshed for this long are broken
+#define ZONE_PROMOTION_PERIODS 2 // periods without a smaller head in the zone before a node takes over as head
 
 
+typedef void (*user_data_handler_t)(uint8_t *data, int data_len);
+
 void start_dsdv_routing();
+/* Messages of up to MAX_MESSAGE_SIZE bytes. Those too large for one frame are sent as fragments, blocking until
+ * the last one is queued; the destination hands them to its handler once all have arrived. */
 esp_err_t transmit_user_data(uint8_t *mac_addr, uint8_t *data, int data_len);
+#if CONFIG_DSDV_COMPRESSION
+/* Like transmit_user_data(), compressed if that makes the message smaller. The destination decompresses it
+ * before it is handed to its handler. */
+esp_err_t transmit_compressed_user_data(uint8_t *mac_addr, uint8_t *data, int data_len);
+#endif
+/* Delivers a message to every node within ttl hops, not only to the neighbours as a broadcast with
+ * transmit_user_data() does. Large messages are fragmented as there. */
+esp_err_t flood_user_data(uint8_t *data, int data_len, uint8_t ttl);
+esp_err_t lookup_route(uint8_t *mac_addr, uint8_t *nextHop_addr, uint8_t *hop_count);
+#if CONFIG_DSDV_ZONE_ROUTING
+/* Like lookup_route(), for a message routed towards head_addr beyond the zone. An unset (all zeros) head_addr
+ * is chosen and filled in as the source of a message does. */
+esp_err_t lookup_zone_route(uint8_t *mac_addr, uint8_t *head_addr, uint8_t *nextHop_addr, uint8_t *hop_count);
+#endif
+void register_user_data_handler(user_data_handler_t handler);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <string.h>
+
+#include "bundle.h"
+
+#if CONFIG_DSDV_AGGREGATION
+/* The messages of a node mostly go to one or two next hops, so a few slots searched linearly do. */
+static bundle_t bundles[BUNDLE_SLOTS];
+
+
+void bundle_init()
+{
+    memset(bundles, 0, sizeof(bundles));
+}
+
+/* The bundle being filled for next_hop, or NULL if there is none. */
+bundle_t *bundle_find(const uint8_t *next_hop)
+{
+    for (int i = 0; i < BUNDLE_SLOTS; i++)
+        if (bundles[i].frame != NULL && memcmp(bundles[i].next_hop, next_hop, ESP_NOW_ETH_ALEN) == 0)
+            return &bundles[i];
+    return NULL;
+}
+
+/* A slot without a bundle, or NULL if all are taken. */
+bundle_t *bundle_free_slot()
+{
+    for (int i = 0; i < BUNDLE_SLOTS; i++)
+        if (bundles[i].frame == NULL)
+            return &bundles[i];
+    return NULL;
+}
+
+/* The bundle due first, or NULL if none is being filled. */
+bundle_t *bundle_next_send()
+{
+    bundle_t *next= NULL;
+    for (int i = 0; i < BUNDLE_SLOTS; i++)
+        if (bundles[i].frame != NULL && (next == NULL || bundles[i].send_time < next->send_time))
+            next= &bundles[i];
+    return next;
+}
+
+/* Starts a bundle in a free slot with an empty frame, whose payload the records are appended to. */
+void bundle_start(bundle_t *bundle, const uint8_t *next_hop, frame_buffer_t *frame, int64_t send_time)
+{
+    memcpy(bundle->next_hop, next_hop, ESP_NOW_ETH_ALEN);
+    bundle->messages= 0;
+    bundle->send_time= send_time;
+    bundle->frame= frame;
+}
+
+/* Returns false if the message doesn't fit into the frame any more. */
+bool bundle_append(bundle_t *bundle, const uint8_t *message, int len)
+{
+    frame_buffer_t *frame= bundle->frame;
+    if (frame->len + 1 + len > ESP_NOW_MAX_DATA_LEN)
+        return false;
+    frame->data[frame->len]= len;
+    memcpy(&frame->data[frame->len + 1], message, len);
+    frame->len += 1 + len;
+    bundle->messages++;
+    return true;
+}
+
+/* Walks the records of a bundle's payload from *offset, 0 at first: returns the next message and its length in
+ * *len, or NULL after the last one. */
+const uint8_t *bundle_next_record(const uint8_t *payload, int payload_len, int *offset, int *len)
+{
+    if (*offset >= payload_len)
+        return NULL;
+    *len= payload[*offset];
+    const uint8_t *message= &payload[*offset + 1];
+    *offset += 1 + *len;
+    return message;
+}
+
+/* Whether the payload holds one record or more, each of at least min_len bytes and the last one ending with it. */
+bool bundle_valid(const uint8_t *payload, int payload_len, int min_len)
+{
+    int offset= 0;
+    while (offset < payload_len)
+    {
+        int len= payload[offset];
+        if (len < min_len || offset + 1 + len > payload_len)
+            return false;
+        offset += 1 + len;
+    }
+    return payload_len > 0;
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_utils.h"
+
+#define BUNDLE_SLOTS        4    // next hops with a bundle being filled at the same time
+#define BUNDLE_DELAY        CONFIG_DSDV_AGGREGATION_DELAY // [ms] a bundle goes out this long after its first message
+#define BUNDLE_MAX_MESSAGE  100  // [bytes] larger payloads go in frames of their own
+
+
+/* Frame being filled with small user messages for one next hop. Its payload is a sequence of records, each a
+ * length byte followed by a message as it is sent on its own: user_data_t and the payload. */
+typedef struct {
+    uint8_t next_hop[ESP_NOW_ETH_ALEN];
+    uint8_t messages;
+    int64_t send_time;
+    frame_buffer_t *frame;                // NULL while the slot is free
+} bundle_t;
+
+void bundle_init();
+bundle_t *bundle_find(const uint8_t *next_hop);
+bundle_t *bundle_free_slot();
+bundle_t *bundle_next_send();
+void bundle_start(bundle_t *bundle, const uint8_t *next_hop, frame_buffer_t *frame, int64_t send_time);
+bool bundle_append(bundle_t *bundle, const uint8_t *message, int len);
+const uint8_t *bundle_next_record(const uint8_t *payload, int payload_len, int *offset, int *len);
+bool bundle_valid(const uint8_t *payload, int payload_len, int min_len);
+
+#endif
@@ -0,0 +1,112 @@
+#include "capture.h"
+
+#if CONFIG_DSDV_CAPTURE
+static const char *TAG = "capture";
+
+/* Records are appended by the WiFi task and the TX task and taken out by the drain task, each under s_lock
+ * for the time of a copy. A record that doesn't fit is dropped rather than overwriting older ones, so that
+ * a replay sees no gaps but the counted ones. */
+static uint8_t s_buffer[CAPTURE_BUFFER_SIZE];
+static size_t s_head, s_used;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_own_addr[ESP_NOW_ETH_ALEN];
+
+
+static void ring_write(size_t pos, const void *src, size_t len)
+{
+    pos %= CAPTURE_BUFFER_SIZE;
+    size_t first = len < CAPTURE_BUFFER_SIZE - pos ? len : CAPTURE_BUFFER_SIZE - pos;
+    memcpy(&s_buffer[pos], src, first);
+    memcpy(s_buffer, (const uint8_t *)src + first, len - first);
+}
+
+static void ring_read(size_t pos, void *dst, size_t len)
+{
+    pos %= CAPTURE_BUFFER_SIZE;
+    size_t first = len < CAPTURE_BUFFER_SIZE - pos ? len : CAPTURE_BUFFER_SIZE - pos;
+    memcpy(dst, &s_buffer[pos], first);
+    memcpy((uint8_t *)dst + first, s_buffer, len - first);
+}
+
+/* Called from the receive callback and by the TX task right before a frame goes to the driver. */
+void capture_frame(uint8_t direction, const uint8_t *peer_addr, int8_t rssi, const uint8_t *data, int len)
+{
+    capture_record_t record;
+    record.direction = direction;
+    memcpy(record.peer_addr, peer_addr, ESP_NOW_ETH_ALEN);
+    record.rssi = rssi;
+    record.len = len;
+    size_t size = sizeof(record) + len;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_used + size > CAPTURE_BUFFER_SIZE) {
+        portEXIT_CRITICAL(&s_lock);
+        stats_count(STATS_CAPTURE_DROPPED);
+        return;
+    }
+    // taken under the lock, so that the records of both tasks stay in time order
+    record.time_us = (uint32_t)esp_timer_get_time();
+    ring_write(s_head + s_used, &record, sizeof(record));
+    ring_write(s_head + s_used + sizeof(record), data, len);
+    s_used += size;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+/* Moves as many whole records as fit into buf out of the buffer. Returns their length in bytes. */
+size_t capture_read(uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    portENTER_CRITICAL(&s_lock);
+    while (s_used - done >= sizeof(capture_record_t)) {
+        capture_record_t record;
+        ring_read(s_head + done, &record, sizeof(record));
+        size_t size = sizeof(record) + record.len;
+        if (done + size > len)
+            break;
+        ring_read(s_head + done, buf + done, size);
+        done += size;
+    }
+    s_head = (s_head + done) % CAPTURE_BUFFER_SIZE;
+    s_used -= done;
+    portEXIT_CRITICAL(&s_lock);
+    return done;
+}
+
+/* Writes the records to the console, a chunk per line, so that the host tools can pick them out of the log. */
+static void capture_task(void *pvParameter)
+{
+    static uint8_t chunk[sizeof(capture_header_t) + CAPTURE_CHUNK_SIZE];
+    static char line[2 * sizeof(chunk) + 1];
+    static const char hex[] = "0123456789abcdef";
+    capture_header_t *header = (capture_header_t *)chunk;
+    header->magic = CAPTURE_MAGIC;
+    header->version = CAPTURE_VERSION;
+    memcpy(header->own_addr, s_own_addr, ESP_NOW_ETH_ALEN);
+
+    for (;;) {
+        size_t len = capture_read(chunk + sizeof(capture_header_t), CAPTURE_CHUNK_SIZE);
+        if (len == 0) {
+            vTaskDelay(pdMS_TO_TICKS(CAPTURE_DRAIN_PERIOD));
+            continue;
+        }
+        header->records_len = len;
+        header->dropped = stats_get(STATS_CAPTURE_DROPPED);
+        len += sizeof(capture_header_t);
+        for (size_t i = 0; i < len; i++) {
+            line[2 * i] = hex[chunk[i] >> 4];
+            line[2 * i + 1] = hex[chunk[i] & 0x0f];
+        }
+        line[2 * len] = '\0';
+        printf("DCAP:%s\n", line);
+    }
+}
+
+void capture_init()
+{
+    // a chunk must hold the largest record
+    assert(CAPTURE_CHUNK_SIZE >= sizeof(capture_record_t) + ESP_NOW_MAX_DATA_LEN);
+    esp_read_mac(s_own_addr, ESP_MAC_WIFI_SOFTAP);
+    xTaskCreate(capture_task, "dsdv_capture", 2048, NULL, CAPTURE_TASK_PRIORITY, NULL);
+    ESP_LOGI(TAG, "Capturing frames, %d byte buffer", CAPTURE_BUFFER_SIZE);
+}
+#endif
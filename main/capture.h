@@ -0,0 +1,45 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "networking_utils.h"
+
+#define CAPTURE_BUFFER_SIZE         CONFIG_DSDV_CAPTURE_BUFFER_SIZE // [bytes] records waiting to be drained
+#define CAPTURE_DRAIN_PERIOD        100   // [ms]
+#define CAPTURE_CHUNK_SIZE          512   // [bytes] records drained in one console line at most
+#define CAPTURE_TASK_PRIORITY       1     // below everything that touches frames
+#define CAPTURE_MAGIC               0x50414344 // "DCAP"
+#define CAPTURE_VERSION             1
+
+enum {
+    CAPTURE_RX,
+    CAPTURE_TX,
+};
+
+/* A capture is a sequence of chunks, each a header and the records it counts. Over the console, a chunk is
+ * a line of "DCAP:" and its bytes in hex; a capture file is the chunks one after the other. Little-endian. */
+typedef struct {
+    uint32_t magic;                       // CAPTURE_MAGIC
+    uint8_t version;
+    uint8_t own_addr[ESP_NOW_ETH_ALEN];   // address of the capturing node, as in its routing entries
+    uint16_t records_len;                 // [bytes] records that follow
+    uint32_t dropped;                     // records lost to a full buffer since boot
+} __attribute__((packed)) capture_header_t;
+
+/* A frame as the driver handed it over or was given it, followed by its len bytes. A unicast is recorded
+ * once per transmission, retries included. */
+typedef struct {
+    uint32_t time_us;                     // uptime, low 32 bits
+    uint8_t direction;                    // CAPTURE_RX or CAPTURE_TX
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];  // sender of a received frame, destination of a sent one
+    int8_t rssi;                          // [dBm] of a received frame, 0 for sent ones
+    uint16_t len;
+    uint8_t data[0];
+} __attribute__((packed)) capture_record_t;
+
+void capture_init();
+void capture_frame(uint8_t direction, const uint8_t *peer_addr, int8_t rssi, const uint8_t *data, int len);
+size_t capture_read(uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,93 @@
+#include "channel.h"
+
+#if CONFIG_DSDV_MULTI_CHANNEL
+static const char *TAG = "channel";
+
+static const uint8_t s_data_channels[] = { 1, 6, 11 };
+
+/* Data channels of the neighbours, from their adverts. The control task writes the table, the TX task
+ * reads it. The radio is tuned by the TX task alone. */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint8_t channel;
+    int64_t last_heard;
+} neighbour_channel_t;
+
+static neighbour_channel_t s_channels[CHANNEL_TABLE_SIZE];
+static SemaphoreHandle_t s_channels_lock;
+static uint8_t s_home;
+static uint8_t s_current;
+
+
+/* The data channel is picked by a hash of the own address, so that neighbours spread over the channels
+ * without agreeing on anything. */
+void channel_init()
+{
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    esp_read_mac(mac_addr, ESP_MAC_WIFI_SOFTAP);
+    unsigned hash = 0;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        hash = hash * 31 + mac_addr[i];
+    s_home = s_data_channels[hash % DATA_CHANNELS];
+    s_current = CONTROL_CHANNEL;
+    s_channels_lock = xSemaphoreCreateMutex();
+    ESP_LOGI(TAG, "Data channel %d", s_home);
+}
+
+uint8_t channel_home()
+{
+    return s_home;
+}
+
+uint8_t channel_current()
+{
+    return s_current;
+}
+
+void channel_tune(uint8_t channel)
+{
+    if (channel == s_current)
+        return;
+    if (esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) != ESP_OK) {
+        ESP_LOGW(TAG, "Tuning to channel %d failed", channel);
+        return;
+    }
+    s_current = channel;
+    stats_count(STATS_CHANNEL_SWITCHES);
+}
+
+void channel_heard(const uint8_t *mac_addr, uint8_t channel)
+{
+    if (channel < 1 || channel > 14)
+        return;
+    int64_t current_time = esp_timer_get_time();
+    xSemaphoreTake(s_channels_lock, portMAX_DELAY);
+    neighbour_channel_t *entry = &s_channels[0];
+    for (int i = 0; i < CHANNEL_TABLE_SIZE; i++) {
+        if (memcmp(s_channels[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            entry = &s_channels[i];
+            break;
+        }
+        if (s_channels[i].last_heard < entry->last_heard)
+            entry = &s_channels[i];
+    }
+    memcpy(entry->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    entry->channel = channel;
+    entry->last_heard = current_time;
+    xSemaphoreGive(s_channels_lock);
+}
+
+uint8_t channel_of(const uint8_t *mac_addr)
+{
+    uint8_t channel = 0;
+    xSemaphoreTake(s_channels_lock, portMAX_DELAY);
+    for (int i = 0; i < CHANNEL_TABLE_SIZE; i++) {
+        if (s_channels[i].channel != 0 && memcmp(s_channels[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            channel = s_channels[i].channel;
+            break;
+        }
+    }
+    xSemaphoreGive(s_channels_lock);
+    return channel;
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_utils.h"
+
+#define CONTROL_CHANNEL             CONFIG_ESPNOW_CHANNEL
+#define DATA_CHANNELS               CONFIG_DSDV_DATA_CHANNELS // of 1, 6 and 11, which don't overlap
+#define CHANNEL_TABLE_SIZE          32    // neighbours whose data channel is known, least recently heard ones are replaced
+
+
+void channel_init();
+uint8_t channel_home();
+uint8_t channel_current();
+void channel_tune(uint8_t channel);
+void channel_heard(const uint8_t *mac_addr, uint8_t channel);
+uint8_t channel_of(const uint8_t *mac_addr); // 0 if not known
+
+#endif
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "sdkconfig.h"
+
+#include "compress.h"
+
+#if CONFIG_DSDV_COMPRESSION
+/* LZ77 with a dictionary shared by all nodes, which sits in front of every message: matches may reach back
+ * into it, so that even a short record compresses. The output is a sequence of tokens:
+ *   0LLLLLLL                      literal run, the L+1 bytes that follow
+ *   1MMMMDDD DDDDDDDD             match, M+COMPRESS_MIN_MATCH bytes from D+1 bytes back
+ * Decoding needs no state beyond the output so far and the dictionary. */
+
+// Strings that recur in our telemetry records. Part of the format: all nodes must be built with the same one.
+static const char dictionary[] =
+    "{\"node\":\"\",\"seq\":,\"ts\":,\"uptime\":,\"type\":\"telemetry\",\"sensor\":\"\",\"status\":\"ok\",\"error\":null,"
+    "\"temperature\":,\"humidity\":,\"pressure\":,\"battery\":,\"voltage\":,\"current\":,\"rssi\":-,\"snr\":,"
+    "\"lux\":,\"co2\":,\"pm25\":,\"motion\":false,\"door\":true,\"value\":,\"unit\":\"C\",\"min\":,\"max\":,\"avg\":,"
+    "\"readings\":[{\"id\":,\"hops\":,\"parent\":\"\",\"fw\":\"1.0.\",\"alarm\":false},0.00,1.0,20.,-70,100,3.3";
+
+#define DICT_LEN            ((int)sizeof(dictionary) - 1)
+#define HASH_SIZE           (1 << COMPRESS_HASH_BITS)
+#define NO_POSITION         UINT16_MAX
+
+// positions in the dictionary, hashed as the encoder hashes the message; its table starts as a copy of this one
+static uint16_t dictionary_table[HASH_SIZE];
+static uint16_t table[HASH_SIZE];         // last position of each hash, the dictionary's and the message's
+
+
+static inline uint32_t hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+    return (v * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+}
+
+void compress_init()
+{
+    memset(dictionary_table, 0xFF, sizeof(dictionary_table));
+    for (int i = 0; i + COMPRESS_MIN_MATCH <= DICT_LEN; i++)
+        dictionary_table[hash((const uint8_t *)&dictionary[i])] = i;
+}
+
+static int put_literals(const uint8_t *data, int len, uint8_t *out, int op, int out_len)
+{
+    while (len > 0) {
+        int run = len < 128 ? len : 128;
+        if (op + 1 + run > out_len)
+            return -1;
+        out[op++] = run - 1;
+        memcpy(&out[op], data, run);
+        op += run;
+        data += run;
+        len -= run;
+    }
+    return op;
+}
+
+/* Positions count from the start of the dictionary, the message following it. */
+int compress_encode(const uint8_t *data, int len, uint8_t *out, int out_len)
+{
+    memcpy(table, dictionary_table, sizeof(table));
+    int op = 0;
+    int literals = 0;                     // start of the bytes not encoded yet
+    int i = 0;
+    while (i + COMPRESS_MIN_MATCH <= len) {
+        uint32_t h = hash(&data[i]);
+        int candidate = table[h];
+        table[h] = DICT_LEN + i;
+        int distance = DICT_LEN + i - candidate;
+        int match = 0;
+        if (candidate != NO_POSITION && distance <= COMPRESS_MAX_DISTANCE) {
+            while (match < COMPRESS_MAX_MATCH && i + match < len) {
+                int pos = candidate + match;
+                uint8_t c = pos < DICT_LEN ? (uint8_t)dictionary[pos] : data[pos - DICT_LEN];
+                if (c != data[i + match])
+                    break;
+                match++;
+            }
+        }
+        if (match < COMPRESS_MIN_MATCH) {
+            i++;
+            continue;
+        }
+
+        if ((op = put_literals(&data[literals], i - literals, out, op, out_len)) < 0 || op + 2 > out_len)
+            return -1;
+        out[op++] = 0x80 | (match - COMPRESS_MIN_MATCH) << 3 | (distance - 1) >> 8;
+        out[op++] = (distance - 1) & 0xFF;
+        // the prefixes inside the match are found by later ones too
+        for (int j = i + 1; j < i + match && j + COMPRESS_MIN_MATCH <= len; j++)
+            table[hash(&data[j])] = DICT_LEN + j;
+        i += match;
+        literals = i;
+    }
+    return put_literals(&data[literals], len - literals, out, op, out_len);
+}
+
+int compress_decode(const uint8_t *data, int len, uint8_t *out, int out_len)
+{
+    int ip = 0;
+    int op = 0;
+    while (ip < len) {
+        uint8_t token = data[ip++];
+        if (token < 0x80) {
+            int run = token + 1;
+            if (ip + run > len || op + run > out_len)
+                return -1;
+            memcpy(&out[op], &data[ip], run);
+            ip += run;
+            op += run;
+            continue;
+        }
+        if (ip == len)
+            return -1;
+        int match = ((token >> 3) & 0x0F) + COMPRESS_MIN_MATCH;
+        int distance = ((token & 0x07) << 8 | data[ip++]) + 1;
+        if (distance > op + DICT_LEN || op + match > out_len)
+            return -1;
+        // byte by byte: a match may overlap the bytes it produces, or start in the dictionary
+        for (int j = 0; j < match; j++, op++) {
+            int src = op - distance;
+            out[op] = src >= 0 ? out[src] : (uint8_t)dictionary[DICT_LEN + src];
+        }
+    }
+    return op;
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+
+#define COMPRESS_MIN_MATCH          3
+#define COMPRESS_MAX_MATCH          (COMPRESS_MIN_MATCH + 15)
+#define COMPRESS_MAX_DISTANCE       2048  // [bytes] back-references reach this far into the output and the dictionary
+#define COMPRESS_HASH_BITS          10    // the encoder's two tables of 3-byte prefixes take 4 << COMPRESS_HASH_BITS bytes
+
+
+void compress_init();
+/* Both return the length written to out, or -1 if it would exceed out_len. compress_decode() also returns -1
+ * for input that isn't the output of compress_encode(). compress_encode() keeps its table in static memory:
+ * callers must not run it concurrently. */
+int compress_encode(const uint8_t *data, int len, uint8_t *out, int out_len);
+int compress_decode(const uint8_t *data, int len, uint8_t *out, int out_len);
+
+#endif
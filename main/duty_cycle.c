@@ -0,0 +1,138 @@
+#include "duty_cycle.h"
+#include "channel.h"
+
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+static const char *TAG = "duty_cycle";
+
+/* The mesh time is the uptime plus an offset that only grows: a node takes over the time of any neighbour
+ * ahead of it, so the mesh follows its longest running node. The wake window takes the first WAKE_WINDOW ms
+ * of each WAKE_INTERVAL of mesh time. When the window moves, the node keeps waking and sending in the old
+ * one too for WAKE_LISTEN_TIME: the neighbours still in the old window hear the new time from it and
+ * move as well. The WiFi task changes the offsets as frames arrive, the TX task reads them to switch the radio.
+ * With DSDV_MULTI_CHANNEL the window is the control window: the radio is on the control channel in it and on
+ * the data channels instead of off outside it. */
+static atomic_llong s_offset;
+static atomic_llong s_old_offset;
+static atomic_llong s_old_until;          // [ms] uptime up to which the old window is kept
+static atomic_llong s_listen_until;       // [ms] uptime up to which the radio stays on
+static int s_scan_phase;                  // spreads the intervals spent awake over the nodes
+static bool s_radio_on;
+
+
+void duty_cycle_init()
+{
+    atomic_store(&s_offset, 0);
+    atomic_store(&s_old_until, 0);
+    atomic_store(&s_listen_until, WAKE_LISTEN_TIME);
+    s_scan_phase = esp_random() % WAKE_SCAN_INTERVALS;
+    s_radio_on = true;
+#if CONFIG_DSDV_DUTY_CYCLE
+    ESP_ERROR_CHECK( esp_wifi_connectionless_module_set_wake_interval(WAKE_INTERVAL) );
+#endif
+}
+
+int64_t duty_cycle_now()
+{
+    return esp_timer_get_time() / 1000 + atomic_load(&s_offset);
+}
+
+/* Called by the TX task right before the frame goes to the driver. */
+void duty_cycle_stamp(frame_buffer_t *frame)
+{
+    ((example_espnow_data_t *)frame->data)->mesh_time = (uint32_t)duty_cycle_now();
+}
+
+/* Called from the receive callback for every frame, before its CRC is checked: the mesh time is outside
+ * the CRC, and the frame passed the driver's FCS. */
+void duty_cycle_heard(const frame_buffer_t *frame)
+{
+    int64_t local_time = frame->rx_time / 1000;
+    int64_t offset = atomic_load(&s_offset);
+    // the low 32 bits tell how far the sender is ahead, the delay of the frame only makes it look behind
+    int32_t ahead = (int32_t)(((example_espnow_data_t *)frame->data)->mesh_time - (uint32_t)(local_time + offset));
+    if (ahead <= 0)
+        return;
+
+    // whole intervals and a few milliseconds leave the window where it is
+    int32_t phase = ahead % WAKE_INTERVAL;
+    if (phase > WAKE_GUARD) {
+        ESP_LOGD(TAG, "Mesh time %d ms ahead, window moved by %d ms", (int)ahead, (int)phase);
+        if (local_time < atomic_load(&s_listen_until))
+            atomic_store(&s_listen_until, local_time + WAKE_LISTEN_TIME);
+        else {
+            atomic_store(&s_old_offset, offset);
+            atomic_store(&s_old_until, local_time + WAKE_LISTEN_TIME);
+        }
+    }
+    atomic_fetch_add(&s_offset, ahead);
+}
+
+/* Where mesh_time is in the window: whether the radio is on and frames may be sent. Returns the time [ms]
+ * until that changes. The radio goes on WAKE_GUARD early and frames stop WAKE_GUARD before the end, so
+ * that a node that gets to its window a tick late hears the others all the same. */
+static int64_t window_state(int64_t mesh_time, bool *radio_on, bool *may_send)
+{
+    int64_t in_interval = mesh_time % WAKE_INTERVAL;
+    *radio_on = in_interval < WAKE_WINDOW || in_interval >= WAKE_INTERVAL - WAKE_GUARD;
+    *may_send = in_interval < WAKE_WINDOW - WAKE_GUARD;
+    if (*may_send)
+        return WAKE_WINDOW - WAKE_GUARD - in_interval;
+    if (in_interval < WAKE_WINDOW)
+        return WAKE_WINDOW - in_interval;
+    if (in_interval < WAKE_INTERVAL - WAKE_GUARD)
+        return WAKE_INTERVAL - WAKE_GUARD - in_interval;
+    return WAKE_INTERVAL - in_interval;
+}
+
+static void set_radio(bool on)
+{
+    if (on == s_radio_on)
+        return;
+#if CONFIG_DSDV_MULTI_CHANNEL
+    channel_tune(on ? CONTROL_CHANNEL : channel_home());
+#else
+    // the wake window of the driver has no phase of its own: it is opened and closed at the edges of ours
+    esp_now_set_wake_window(on ? 65535 : 0);
+#endif
+    s_radio_on = on;
+}
+
+/* Whether the radio is on, on the control channel with DSDV_MULTI_CHANNEL, as of the last duty_cycle_update(). */
+bool duty_cycle_radio_on()
+{
+    return s_radio_on;
+}
+
+/* Switches the radio on or off for the current time and tells whether frames may be sent. Returns the
+ * uptime [us] at which the state changes next. */
+int64_t duty_cycle_update(int64_t current_time, bool *may_send)
+{
+    int64_t local_time = current_time / 1000;
+    int64_t listen_until = atomic_load(&s_listen_until);
+    if (local_time < listen_until) {
+        // after booting, stay awake until the neighbours agree on the window
+        set_radio(true);
+        *may_send = true;
+        return listen_until * 1000;
+    }
+
+    bool radio_on;
+    int64_t mesh_time = local_time + atomic_load(&s_offset);
+    int64_t next = window_state(mesh_time, &radio_on, may_send);
+    int64_t old_until = atomic_load(&s_old_until);
+    if (local_time < old_until) {
+        bool old_radio_on, old_may_send;
+        int64_t old_next = window_state(local_time + atomic_load(&s_old_offset), &old_radio_on, &old_may_send);
+        radio_on |= old_radio_on;
+        *may_send |= old_may_send;
+        if (old_next < next)
+            next = old_next;
+        if (old_until - local_time < next)
+            next = old_until - local_time;
+    }
+    // one interval in WAKE_SCAN_INTERVALS is spent awake to hear the meshes whose window is elsewhere
+    bool scan = (mesh_time / WAKE_INTERVAL + s_scan_phase) % WAKE_SCAN_INTERVALS == 0;
+    set_radio(scan || radio_on);
+    return (local_time + next) * 1000;
+}
+#endif
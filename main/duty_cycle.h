@@ -0,0 +1,22 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_utils.h"
+
+#define WAKE_INTERVAL               CONFIG_DSDV_WAKE_INTERVAL // [ms]
+#define WAKE_WINDOW                 CONFIG_DSDV_WAKE_WINDOW   // [ms]
+#define WAKE_GUARD                  10    // [ms] the radio is on this long before the window, frames stop this long before its end
+#define WAKE_LISTEN_TIME            20000 // [ms] awake after booting, and in the old window as well after the window moved
+#define WAKE_SCAN_INTERVALS         64    // one interval in this many is spent awake
+
+
+void duty_cycle_init();
+int64_t duty_cycle_now(); // [ms] mesh time
+void duty_cycle_stamp(frame_buffer_t *frame);
+void duty_cycle_heard(const frame_buffer_t *frame);
+int64_t duty_cycle_update(int64_t current_time, bool *may_send);
+bool duty_cycle_radio_on();
+
+#endif
@@ -0,0 +1,58 @@
+#include <string.h>
+
+#include "flood_cache.h"
+
+/* Ring of the frames heard last, the oldest one replaced by the next new frame. A flood passes a node
+ * within a few relay delays, so FLOOD_CACHE_SIZE entries searched linearly catch all of its copies. */
+static flood_entry_t entries[FLOOD_CACHE_SIZE];
+static int entries_nbr= 0;
+static int oldest= 0;
+
+
+void flood_cache_init()
+{
+    memset(entries, 0, sizeof(entries));
+    entries_nbr= 0;
+    oldest= 0;
+}
+
+flood_entry_t *flood_cache_find(const uint8_t *origin_addr, uint16_t msg_id, uint8_t frag_index)
+{
+    for (int i = 0; i < entries_nbr; i++)
+        if (entries[i].msg_id == msg_id && entries[i].frag_index == frag_index
+                && memcmp(entries[i].origin_addr, origin_addr, ESP_NOW_ETH_ALEN) == 0)
+            return &entries[i];
+    return NULL;
+}
+
+/* Returns a new entry with no copies heard. A frame the replaced entry still held is dropped. */
+flood_entry_t *flood_cache_add(const uint8_t *origin_addr, uint16_t msg_id, uint8_t frag_index)
+{
+    flood_entry_t *entry;
+    if (entries_nbr < FLOOD_CACHE_SIZE)
+        entry= &entries[entries_nbr++];
+    else
+    {
+        entry= &entries[oldest];
+        oldest= (oldest + 1) % FLOOD_CACHE_SIZE;
+        if (entry->frame != NULL)
+            frame_release(entry->frame);
+    }
+    memcpy(entry->origin_addr, origin_addr, ESP_NOW_ETH_ALEN);
+    entry->msg_id= msg_id;
+    entry->frag_index= frag_index;
+    entry->copies= 0;
+    entry->relay_time= 0;
+    entry->frame= NULL;
+    return entry;
+}
+
+/* The entry whose held frame is due first, or NULL if none is held. */
+flood_entry_t *flood_cache_next_relay()
+{
+    flood_entry_t *next= NULL;
+    for (int i = 0; i < entries_nbr; i++)
+        if (entries[i].frame != NULL && (next == NULL || entries[i].relay_time < next->relay_time))
+            next= &entries[i];
+    return next;
+}
@@ -0,0 +1,27 @@
+#ifndef FLOOD_CACHE_H
+#define FLOOD_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_utils.h"
+
+#define FLOOD_CACHE_SIZE    CONFIG_DSDV_FLOOD_CACHE_SIZE
+
+
+/* Flooded frame heard recently. A frame is told apart from the others by its originator, message ID and
+ * fragment index. */
+typedef struct {
+    uint8_t origin_addr[ESP_NOW_ETH_ALEN];
+    uint16_t msg_id;
+    uint8_t frag_index;
+    uint8_t copies;                       // copies heard, the first one included
+    int64_t relay_time;                   // when the frame is relayed or suppressed, while it is held
+    frame_buffer_t *frame;                // held until then, NULL otherwise
+} flood_entry_t;
+
+void flood_cache_init();
+flood_entry_t *flood_cache_find(const uint8_t *origin_addr, uint16_t msg_id, uint8_t frag_index);
+flood_entry_t *flood_cache_add(const uint8_t *origin_addr, uint16_t msg_id, uint8_t frag_index);
+flood_entry_t *flood_cache_next_relay();
+
+#endif
@@ -0,0 +1,25 @@
+#include "frame_check.h"
+
+/* The CRC covers the frame type and the payload. The CRC field and the per-hop link sequence number and
+ * mesh time are left out, so a frame forwarded unchanged keeps its CRC and checking it doesn't write to the frame. */
+uint16_t frame_crc(const frame_buffer_t *frame)
+{
+    const example_espnow_data_t *buf = (const example_espnow_data_t *)frame->data;
+    uint16_t crc = esp_crc16_le(UINT16_MAX, &buf->is_userData, sizeof(buf->is_userData));
+    return esp_crc16_le(crc, buf->payload, frame->len - sizeof(example_espnow_data_t));
+}
+
+/* Called for a frame built or changed by this node, before it is sent. */
+void frame_seal(frame_buffer_t *frame)
+{
+    ((example_espnow_data_t *)frame->data)->crc = frame_crc(frame);
+    frame->sealed = true;
+}
+
+/* Length and CRC of a received frame. A frame that passes is sealed: it can be forwarded as it is. */
+bool frame_verify(frame_buffer_t *frame)
+{
+    frame->sealed = frame->len >= sizeof(example_espnow_data_t)
+                    && ((example_espnow_data_t *)frame->data)->crc == frame_crc(frame);
+    return frame->sealed;
+}
@@ -0,0 +1,12 @@
+#ifndef FRAME_CHECK_H
+#define FRAME_CHECK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "networking_utils.h"
+
+uint16_t frame_crc(const frame_buffer_t *frame);
+void frame_seal(frame_buffer_t *frame);
+bool frame_verify(frame_buffer_t *frame);
+
+#endif
@@ -0,0 +1,62 @@
+#include "link_quality.h"
+#include "routing_table.h"
+
+
+/* Plain mean of the first LQ_WINDOW samples, exponentially weighted afterwards. */
+static int32_t average(int32_t mean, int32_t sample, uint8_t samples)
+{
+    int32_t weight= samples < LQ_WINDOW ? samples + 1 : LQ_WINDOW;
+    return mean + (sample - mean) / weight;
+}
+
+static uint8_t count_sample(uint8_t samples)
+{
+    return samples < UINT8_MAX ? samples + 1 : samples;
+}
+
+/* Called for every periodic advert of the neighbour. A neighbour's own sequence number grows by 2
+ * per period, so a gap in it tells how many adverts were lost on the way. */
+void link_quality_advert_received(LinkQuality_t *link, int rssi, uint16_t seq_num)
+{
+    link->rssi= average(link->rssi, rssi * 16, link->rx_samples);
+
+    // an older sequence number means the neighbour restarted: nothing was lost
+    if (link->rx_samples > 0 && SEQ_NUM_NEWER(seq_num, link->advert_seq_num))
+    {
+        int missed= (uint16_t)(seq_num - link->advert_seq_num) / 2 - 1;
+        for (int i = 0; i < missed && i < LQ_MAX_GAP; i++)
+        {
+            link->rx_ratio= average(link->rx_ratio, 0, link->rx_samples);
+            link->rx_samples= count_sample(link->rx_samples);
+        }
+    }
+    link->rx_ratio= average(link->rx_ratio, LQ_ONE, link->rx_samples);
+    link->rx_samples= count_sample(link->rx_samples);
+    link->advert_seq_num= seq_num;
+}
+
+/* Called for every completed unicast to the neighbour. */
+void link_quality_unicast_sent(LinkQuality_t *link, bool acked, int attempts)
+{
+    int32_t sample= acked && attempts > 0 ? LQ_ONE / attempts : 0;
+    link->tx_ratio= average(link->tx_ratio, sample, link->tx_samples);
+    link->tx_samples= count_sample(link->tx_samples);
+}
+
+/* Expected transmissions of a frame and its acknowledgement over the link [1/ETX_ONE].
+ * Adverts only tell how well the neighbour is heard; the link is taken to be symmetric
+ * unless unicasts to the neighbour show the other direction to be worse. An unknown link
+ * counts as a perfect one. */
+uint16_t link_quality_etx(const LinkQuality_t *link)
+{
+    if (link->rx_samples == 0)
+        return ETX_ONE;
+
+    uint32_t rx_ratio= link->rx_ratio;
+    uint32_t tx_ratio= link->tx_samples > 0 && link->tx_ratio < rx_ratio ? link->tx_ratio : rx_ratio;
+    uint64_t ratios= (uint64_t)rx_ratio * tx_ratio;
+    if (ratios == 0)
+        return ETX_MAX_LINK;
+    uint64_t etx= (uint64_t)ETX_ONE * LQ_ONE * LQ_ONE / ratios;
+    return etx < ETX_MAX_LINK ? etx : ETX_MAX_LINK;
+}
@@ -0,0 +1,29 @@
+#ifndef LINK_QUALITY_H
+#define LINK_QUALITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LQ_ONE              4096   // fixed-point 1.0 of the delivery ratios
+#define LQ_WINDOW           8      // samples averaged before the estimate turns into an EWMA with weight 1/LQ_WINDOW
+#define LQ_MAX_GAP          8      // missed adverts counted at most between two received ones
+#define ETX_ONE             16     // fixed-point 1.0 of the ETX metric
+#define ETX_MAX_LINK        (ETX_ONE * 32)
+
+
+/* Link estimate of a neighbour, built from its periodic adverts and from the acknowledgements
+ * of unicasts sent to it. All zero means nothing is known about the link yet. */
+typedef struct {
+    int16_t rssi;                         // [1/16 dBm] average signal strength of its adverts
+    uint16_t rx_ratio;                    // [1/LQ_ONE] average share of its periodic adverts received
+    uint16_t tx_ratio;                    // [1/LQ_ONE] average of 1/transmissions of unicasts to it, 0 for lost ones
+    uint16_t advert_seq_num;              // its own sequence number in the last periodic advert received
+    uint8_t rx_samples;                   // saturating sample counts
+    uint8_t tx_samples;
+} LinkQuality_t;
+
+void link_quality_advert_received(LinkQuality_t *link, int rssi, uint16_t seq_num);
+void link_quality_unicast_sent(LinkQuality_t *link, bool acked, int attempts);
+uint16_t link_quality_etx(const LinkQuality_t *link);
+
+#endif
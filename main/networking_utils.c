@@ -1,16 +1,96 @@
 #include "networking_utils.h"
+#include "frame_check.h"
+#include "duty_cycle.h"
+#include "channel.h"
+#include "capture.h"
 
-#define ESPNOW_MAXDELAY 512
 #define PACKET_PERIOD 1000
 
 static const char *TAG = "networking_utils";
 
-static QueueHandle_t s_example_espnow_queue;
-SemaphoreHandle_t Mutex_send_param; // ´send_param´ shouldn't be accessed concurrently
+/* Received frames are split by kind so that routing advertisements never queue behind user messages:
+ * s_control_queue carries advertisements and send completions to a high-priority consumer task,
+ * s_data_queue user messages to a forwarding task that may run on the other core. */
+static QueueHandle_t s_control_queue;
+static QueueHandle_t s_data_queue;
+static event_handler_t s_event_handler;
+
+static frame_buffer_t s_frame_pool[FRAME_POOL_SIZE];
+static QueueHandle_t s_free_frames;
+
+typedef enum {
+    TX_REQUEST,
+    TX_DONE,
+} tx_event_id_t;
+
+typedef struct {
+    uint8_t dest_mac[ESP_NOW_ETH_ALEN];
+    frame_buffer_t *frame;
+    bool encrypt;
+    uint8_t attempts;
+    int64_t retry_time;                   // when a failed unicast is sent again
+#if CONFIG_DSDV_MULTI_CHANNEL
+    uint8_t channel;                      // data channel of the destination, 0 to wait for the control window
+#endif
+} tx_request_t;
+
+typedef struct {
+    tx_event_id_t id;
+    union {
+        tx_request_t request;
+        example_espnow_event_send_cb_t done;
+    } info;
+} tx_event_t;
+
+/* The TX task owns the peer list, the backlog and the window, so none of them needs a lock.
+ * s_tx_queue carries requests and send completions; s_tx_credits limits the requests in the queue and
+ * the backlog to TX_QUEUE_SIZE, which leaves room for the completions of all frames in flight.
+ * The window holds the frames in flight and the failed unicasts waiting for their retransmission:
+ * one neighbour that doesn't answer can't take more than TX_WINDOW frames out of the backlog. */
+static QueueHandle_t s_tx_queue;
+static SemaphoreHandle_t s_tx_credits;
+static tx_request_t s_tx_backlog[TX_QUEUE_SIZE];
+static int s_tx_backlog_head, s_tx_backlog_count;
+static tx_request_t s_in_flight[TX_WINDOW]; // in the order the driver completes them
+static int s_in_flight_head, s_in_flight_count;
+static tx_request_t s_tx_retries[TX_WINDOW];
+static int s_tx_retries_count;
+#if CONFIG_DSDV_MULTI_CHANNEL
+/* Outside the control window the radio listens on the own data channel and goes to a next hop's data channel
+ * to send it a unicast, one channel at a time. Frames that can only go out in the control window wait in
+ * s_tx_deferred meanwhile; they keep their credit, so it can't hold more than the backlog. */
+static bool s_data_period;
+static tx_request_t s_tx_deferred[TX_QUEUE_SIZE];
+static int s_tx_deferred_head, s_tx_deferred_count;
+#endif
 
-example_espnow_send_param_t *send_param;
+/* ESP-NOW keeps at most ESP_NOW_MAX_TOTAL_PEER_NUM peers, ESP_NOW_MAX_ENCRYPT_PEER_NUM of them encrypted.
+ * Destinations are added as frames go out to them, and the least recently used peers make room for new
+ * ones, so the slots stay with the neighbours that carry traffic. */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    bool encrypt;
+    int64_t last_used;
+} peer_t;
+
+static peer_t s_peers[ESP_NOW_MAX_TOTAL_PEER_NUM];
+static int s_peers_count;
+static esp_now_peer_info_t s_peer_info;    // filled in for each new peer
+
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+/* Link sequence numbers: the last one sent to a neighbour, or the highest one received from it along
+ * with a bitmap of the 32 before it. s_tx_links belongs to the TX task, s_rx_links to the data task. */
+typedef struct {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint16_t seq_num;
+    uint32_t window;
+    int64_t last_used;
+} link_seq_t;
+
+static link_seq_t s_tx_links[LINK_TABLE_SIZE];
+static link_seq_t s_rx_links[LINK_TABLE_SIZE];
+#endif
 
-static void example_espnow_deinit();
 
 /* WiFi should start before using ESPNOW */
 static void example_wifi_init(void)
@@ -34,19 +114,19 @@ static void example_wifi_init(void)
  * necessary data to a queue and handle it from a lower priority task. */
 static void example_espnow_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
-    example_espnow_event_t evt;
-    example_espnow_event_send_cb_t *send_cb = &evt.info.send_cb;
+    tx_event_t evt;
+    example_espnow_event_send_cb_t *send_cb = &evt.info.done;
 
     if (mac_addr == NULL) {
         ESP_LOGE(TAG, "Send cb arg error");
         return;
     }
 
-    evt.id = EXAMPLE_ESPNOW_SEND_CB;
+    evt.id = TX_DONE;
     memcpy(send_cb->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
     send_cb->status = status;
-    if (xQueueSend(s_example_espnow_queue, &evt, ESPNOW_MAXDELAY) != pdTRUE) {
-        ESP_LOGW(TAG, "Send send queue fail");
+    if (xQueueSend(s_tx_queue, &evt, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Send send queue fail");
     }
 }
 
@@ -60,106 +140,480 @@ static void example_espnow_recv_cb(const esp_now_recv_info_t *recv_info, const u
         ESP_LOGE(TAG, "Receive cb arg error");
         return;
     }
+    stats_count(STATS_RX_FRAMES);
+#if CONFIG_DSDV_CAPTURE
+    capture_frame(CAPTURE_RX, mac_addr, recv_info->rx_ctrl->rssi, data, len);
+#endif
+    if (len < sizeof(example_espnow_data_t)) {
+        stats_count(STATS_RX_MALFORMED);
+        PACKET_LOGW(TAG, "Receive ESPNOW data too short, len:%d", len);
+        return;
+    }
+
+    bool is_userData = ((example_espnow_data_t *)data)->is_userData;
+    QueueHandle_t queue = is_userData ? s_data_queue : s_control_queue;
 
     evt.id = EXAMPLE_ESPNOW_RECV_CB;
     memcpy(recv_cb->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
-    recv_cb->data = malloc(len);
-    if (recv_cb->data == NULL) {
-        ESP_LOGE(TAG, "Malloc receive data fail");
+    recv_cb->rssi = recv_info->rx_ctrl->rssi;
+    recv_cb->frame = frame_alloc(is_userData);
+    if (recv_cb->frame == NULL) {
+        stats_count(STATS_RX_DROPPED_NO_FRAME);
+        PACKET_LOGW(TAG, "Frame pool exhausted, dropping received data");
         return;
     }
-    memcpy(recv_cb->data, data, len);
-    recv_cb->data_len = len;
-    if (xQueueSend(s_example_espnow_queue, &evt, ESPNOW_MAXDELAY) != pdTRUE) {
-        ESP_LOGW(TAG, "Send receive queue fail");
-        free(recv_cb->data);
+    // the only copy: the driver reuses its buffer once the callback returns
+    memcpy(recv_cb->frame->data, data, len);
+    recv_cb->frame->len = len;
+    recv_cb->frame->rx_time = esp_timer_get_time();
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+    duty_cycle_heard(recv_cb->frame);
+#endif
+    // never block the WiFi task: a full queue drops the frame
+    if (xQueueSend(queue, &evt, 0) != pdTRUE) {
+        stats_count(is_userData ? STATS_RX_DROPPED_DATA_QUEUE_FULL : STATS_RX_DROPPED_CONTROL_QUEUE_FULL);
+        PACKET_LOGW(TAG, "Send receive queue fail");
+        frame_release(recv_cb->frame);
+        return;
     }
+    stats_peak(is_userData ? STATS_PEAK_DATA_QUEUE : STATS_PEAK_CONTROL_QUEUE, uxQueueMessagesWaiting(queue));
 }
 
-static void add_peer(uint8_t* mac_addr, bool encrypt)
+/* A peer with frames in flight or waiting to be sent again must stay. */
+static bool peer_busy(const uint8_t *mac_addr)
 {
-    /* If MAC address does not exist in peer list, add it to peer list. */
-    if (esp_now_is_peer_exist(mac_addr) == false) {
-        esp_now_peer_info_t *peer = malloc(sizeof(esp_now_peer_info_t));
-        if (peer == NULL) {
-            ESP_LOGE(TAG, "Malloc peer information fail");
-            esp_now_deinit();
-            vTaskDelete(NULL);
-        }
-        memset(peer, 0, sizeof(esp_now_peer_info_t));
-        peer->channel = CONFIG_ESPNOW_CHANNEL;
-        peer->ifidx = ESPNOW_WIFI_IF;
-        peer->encrypt = encrypt;
-        if(encrypt){
-            memcpy(peer->lmk, CONFIG_ESPNOW_LMK, ESP_NOW_KEY_LEN);
+    for (int i = 0; i < s_in_flight_count; i++)
+        if (memcmp(s_in_flight[(s_in_flight_head + i) % TX_WINDOW].dest_mac, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+            return true;
+    for (int i = 0; i < s_tx_retries_count; i++)
+        if (memcmp(s_tx_retries[i].dest_mac, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+            return true;
+    return false;
+}
+
+static void remove_peer(int index)
+{
+    esp_now_del_peer(s_peers[index].mac_addr);
+    s_peers[index] = s_peers[--s_peers_count];
+}
+
+/* Least recently used peer that may be removed, an encrypted one if encrypted_only; -1 if there is none. */
+static int find_idle_peer(bool encrypted_only)
+{
+    int victim = -1;
+    for (int i = 0; i < s_peers_count; i++) {
+        if ((encrypted_only && !s_peers[i].encrypt) || IS_BROADCAST_ADDR(s_peers[i].mac_addr) || peer_busy(s_peers[i].mac_addr))
+            continue;
+        if (victim < 0 || s_peers[i].last_used < s_peers[victim].last_used)
+            victim = i;
+    }
+    return victim;
+}
+
+/* Makes mac_addr a peer, evicting an idle one if the driver's peer list is full. Returns false if all are busy,
+ * or if mac_addr is a busy peer with the other encryption setting. */
+static bool add_peer(const uint8_t *mac_addr, bool encrypt)
+{
+    int64_t current_time = esp_timer_get_time();
+    int encrypted = 0;
+    for (int i = 0; i < s_peers_count; i++) {
+        if (memcmp(s_peers[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            if (s_peers[i].encrypt == encrypt) {
+                s_peers[i].last_used = current_time;
+                return true;
+            }
+            // added again below with the other setting, once no frame to it is in flight
+            if (peer_busy(s_peers[i].mac_addr))
+                return false;
+            remove_peer(i--);
+            continue;
         }
-        memcpy(peer->peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
-        ESP_ERROR_CHECK( esp_now_add_peer(peer) );
-        ESP_LOGI(TAG, "See peer for the first time and add it to my list.");
-        free(peer);
-    } /*else {
-        ESP_LOGI(TAG, "Already known peer.");
-    }*/
-}
-
-esp_err_t transmit_data(uint8_t *mac_addr, uint8_t *data, int data_len, bool encrypt, bool is_userData)
-{
-    if (xSemaphoreTake(Mutex_send_param, portMAX_DELAY) == pdTRUE) { // critical because ´send_param´ shouldn't be accessed concurrently
-        /* Add peer information to peer list. */
-        add_peer(mac_addr, encrypt);
-            
-        /* prepare the data to be sent. */
-        memcpy(send_param->dest_mac, mac_addr, ESP_NOW_ETH_ALEN);
-        example_espnow_data_t *buf = (example_espnow_data_t *)send_param->buffer;
-        buf->is_userData = is_userData;
-        memcpy(buf->payload, data, data_len);
-        buf->crc = 0;
-        int len= data_len + sizeof(example_espnow_data_t);
-        buf->crc = esp_crc16_le(UINT16_MAX, (uint8_t const *)buf, len);
-        
-        /* send the data. */
-        //ESP_LOGI(TAG, "sending data to "MACSTR"", MAC2STR(send_param->dest_mac));
-        if (esp_now_send(send_param->dest_mac, send_param->buffer, len) != ESP_OK) {
-            ESP_LOGE(TAG, "Send error");
-            example_espnow_deinit();
-            xSemaphoreGive(Mutex_send_param);
-            return ESP_FAIL;
-            //vTaskDelete(NULL);////////////////////////////
+        encrypted += s_peers[i].encrypt;
+    }
+
+    bool need_encrypted_slot = encrypt && encrypted >= ESP_NOW_MAX_ENCRYPT_PEER_NUM;
+    if (need_encrypted_slot || s_peers_count >= ESP_NOW_MAX_TOTAL_PEER_NUM) {
+        int victim = find_idle_peer(need_encrypted_slot);
+        if (victim < 0)
+            return false;
+        PACKET_LOGI(TAG, "Evicting peer "MACSTR"", MAC2STR(s_peers[victim].mac_addr));
+        remove_peer(victim);
+        stats_count(STATS_PEER_EVICTIONS);
+    }
+
+    memset(&s_peer_info, 0, sizeof(s_peer_info));
+#if CONFIG_DSDV_MULTI_CHANNEL
+    s_peer_info.channel = 0;              // whichever channel the radio is on
+#else
+    s_peer_info.channel = CONFIG_ESPNOW_CHANNEL;
+#endif
+    s_peer_info.ifidx = ESPNOW_WIFI_IF;
+    s_peer_info.encrypt = encrypt;
+    if (encrypt)
+        memcpy(s_peer_info.lmk, CONFIG_ESPNOW_LMK, ESP_NOW_KEY_LEN);
+    memcpy(s_peer_info.peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    esp_err_t ret = esp_now_add_peer(&s_peer_info);
+    if (ret != ESP_OK && ret != ESP_ERR_ESPNOW_EXIST) {
+        ESP_LOGW(TAG, "Adding peer "MACSTR" failed: 0x%x", MAC2STR(mac_addr), ret);
+        return false;
+    }
+    peer_t *peer = &s_peers[s_peers_count++];
+    memcpy(peer->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    peer->encrypt = encrypt;
+    peer->last_used = current_time;
+    return true;
+}
+
+frame_buffer_t *frame_alloc(bool is_userData)
+{
+    frame_buffer_t *frame;
+    if (is_userData && uxQueueMessagesWaiting(s_free_frames) <= FRAME_POOL_RESERVE)
+        return NULL;
+    if (xQueueReceive(s_free_frames, &frame, 0) != pdTRUE)
+        return NULL;
+    atomic_store(&frame->refs, 1);
+    stats_peak(STATS_PEAK_FRAMES_IN_USE, FRAME_POOL_SIZE - uxQueueMessagesWaiting(s_free_frames));
+    frame->rx_time = 0;
+    frame->sealed = false;
+    example_espnow_data_t *buf = (example_espnow_data_t *)frame->data;
+    buf->is_userData = is_userData;
+    frame->len = sizeof(example_espnow_data_t);
+    return frame;
+}
+
+void frame_ref(frame_buffer_t *frame)
+{
+    atomic_fetch_add(&frame->refs, 1);
+}
+
+void frame_release(frame_buffer_t *frame)
+{
+    if (atomic_fetch_sub(&frame->refs, 1) == 1)
+        xQueueSend(s_free_frames, &frame, 0);
+}
+
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+/* Entry of the neighbour, replacing the least recently used one if it has none; new entries are zeroed. */
+static link_seq_t *find_link(link_seq_t *links, const uint8_t *mac_addr, int64_t current_time)
+{
+    link_seq_t *link = &links[0];
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+        if (memcmp(links[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0) {
+            link = &links[i];
+            link->last_used = current_time;
+            return link;
         }
-        xSemaphoreGive(Mutex_send_param);
-        return ESP_OK;
+        if (links[i].last_used < link->last_used)
+            link = &links[i];
     }
-    return ESP_FAIL;
+    memset(link, 0, sizeof(link_seq_t));
+    memcpy(link->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    link->last_used = current_time;
+    return link;
 }
 
-static int check_data_correctness(uint8_t *data, int data_len)
+/* Numbers a unicast before its first transmission; retransmissions keep the number. */
+static void number_frame(tx_request_t *request)
 {
-	example_espnow_data_t *buf = (example_espnow_data_t *)data;
-	uint16_t crc, crc_cal = 0;
+    link_seq_t *link = find_link(s_tx_links, request->dest_mac, esp_timer_get_time());
+    if (link->seq_num == 0)
+        link->seq_num = esp_random();     // after a reboot, numbers mustn't pick up where the neighbour last saw them
+    if (++link->seq_num == 0)
+        link->seq_num = 1;
+    ((example_espnow_data_t *)request->frame->data)->link_seq = link->seq_num;
+}
 
-	if (data_len < sizeof(example_espnow_data_t)) {
-		ESP_LOGE(TAG, "Receive ESPNOW data too short, len:%d", data_len);
-		return -1;
-	}
+/* A retransmission whose earlier transmission arrived although its acknowledgement didn't. */
+static bool is_duplicate(example_espnow_event_recv_cb_t *recv_cb)
+{
+    uint16_t seq_num = ((example_espnow_data_t *)recv_cb->frame->data)->link_seq;
+    if (seq_num == 0)
+        return false;
+    link_seq_t *link = find_link(s_rx_links, recv_cb->mac_addr, recv_cb->frame->rx_time);
+    int16_t diff = (int16_t)(seq_num - link->seq_num);
+    if (link->window == 0 || diff <= -32) {
+        // first frame from the neighbour, or it rebooted
+        link->seq_num = seq_num;
+        link->window = 1;
+        return false;
+    }
+    if (diff > 0) {
+        link->window = diff < 32 ? link->window << diff | 1 : 1;
+        link->seq_num = seq_num;
+        return false;
+    }
+    uint32_t bit = 1u << -diff;
+    if (link->window & bit)
+        return true;
+    link->window |= bit;
+    return false;
+}
+#endif
 
-	crc = buf->crc;
-	buf->crc = 0;
-	crc_cal = esp_crc16_le(UINT16_MAX, (uint8_t const *)buf, data_len);
+esp_err_t transmit_frame(uint8_t *mac_addr, frame_buffer_t *frame, bool encrypt)
+{
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+    // unicasts are numbered by the TX task
+    ((example_espnow_data_t *)frame->data)->link_seq = 0;
+#endif
+    // in the caller's context, not the TX task's; a received frame forwarded unchanged is sealed already
+    if (!frame->sealed)
+        frame_seal(frame);
+
+    tx_event_t evt;
+    tx_request_t *request = &evt.info.request;
+    evt.id = TX_REQUEST;
+    memcpy(request->dest_mac, mac_addr, ESP_NOW_ETH_ALEN);
+    request->frame = frame;
+    request->encrypt = encrypt;
+    request->attempts = 0;
+#if CONFIG_DSDV_MULTI_CHANNEL
+    // broadcasts and unicasts to neighbours whose data channel isn't known yet wait for the control window
+    request->channel = IS_BROADCAST_ADDR(mac_addr) ? 0 : channel_of(mac_addr);
+#endif
+    if (xSemaphoreTake(s_tx_credits, 0) != pdTRUE) {
+        stats_count(STATS_TX_QUEUE_FULL);
+        PACKET_LOGW(TAG, "TX queue full, dropping frame to "MACSTR"", MAC2STR(mac_addr));
+        frame_release(frame);
+        return ESP_ERR_NO_MEM;
+    }
+    xQueueSend(s_tx_queue, &evt, portMAX_DELAY);
+    return ESP_OK;
+}
 
-	if (crc_cal == crc) {
-		return 0;
-	}
+/* Hands a request to the driver and appends it to the in-flight window. */
+static void send_request(tx_request_t *request)
+{
+    request->attempts++;
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+    duty_cycle_stamp(request->frame);
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+    if (s_data_period)
+        channel_tune(request->channel);
+    else
+        request->channel = 0;             // a unicast that fails in the control window has had its last chance
+#endif
+#if CONFIG_DSDV_CAPTURE
+    capture_frame(CAPTURE_TX, request->dest_mac, 0, request->frame->data, request->frame->len);
+#endif
+    //ESP_LOGI(TAG, "sending data to "MACSTR"", MAC2STR(request->dest_mac));
+    if (esp_now_send(request->dest_mac, request->frame->data, request->frame->len) != ESP_OK) {
+        stats_count(STATS_TX_DRIVER_ERRORS);
+        PACKET_LOGW(TAG, "Send error");
+        frame_release(request->frame);
+        return;
+    }
+    s_in_flight[(s_in_flight_head + s_in_flight_count++) % TX_WINDOW] = *request;
+}
+
+/* Completions arrive in send order. A unicast that was not acknowledged is sent again up to TX_MAX_RETRIES
+ * times, each time TX_RETRY_BACKOFF later than the time before, while the frames behind it go on;
+ * the final outcome of a unicast is reported to the communication events task. */
+static void complete_request(example_espnow_event_send_cb_t *send_cb)
+{
+    if (s_in_flight_count == 0) {
+        ESP_LOGW(TAG, "Send completion without frame in flight");
+        return;
+    }
+    tx_request_t request = s_in_flight[s_in_flight_head];
+    s_in_flight_head = (s_in_flight_head + 1) % TX_WINDOW;
+    s_in_flight_count--;
 
-	return -1;
+    if (IS_BROADCAST_ADDR(request.dest_mac)) {
+        frame_release(request.frame);
+        return;
+    }
+    if (send_cb->status != ESP_NOW_SEND_SUCCESS && request.attempts <= TX_MAX_RETRIES) {
+        stats_count(STATS_TX_RETRIES);
+        // the random half keeps neighbours that lost each other's frames from retrying in step
+        int64_t backoff = (int64_t)TX_RETRY_BACKOFF * 1000 << (request.attempts - 1);
+        request.retry_time = esp_timer_get_time() + backoff / 2 + (backoff > 0 ? esp_random() % (backoff / 2 + 1) : 0);
+        s_tx_retries[s_tx_retries_count++] = request;
+        return;
+    }
+#if CONFIG_DSDV_MULTI_CHANNEL
+    // the next hop may have been away sending on another channel: all nodes listen in the control window
+    if (send_cb->status != ESP_NOW_SEND_SUCCESS && request.channel != 0) {
+        stats_count(STATS_TX_RETRIES);
+        request.channel = 0;
+        request.retry_time = 0;
+        s_tx_retries[s_tx_retries_count++] = request;
+        return;
+    }
+#endif
+    if (send_cb->status != ESP_NOW_SEND_SUCCESS)
+        stats_count(STATS_TX_FAILURES);
+    else if (request.frame->rx_time != 0)
+        stats_forward_latency(esp_timer_get_time() - request.frame->rx_time);
+
+    example_espnow_event_t evt;
+    evt.id = EXAMPLE_ESPNOW_SEND_CB;
+    memcpy(evt.info.send_cb.mac_addr, request.dest_mac, ESP_NOW_ETH_ALEN);
+    evt.info.send_cb.status = send_cb->status;
+    evt.info.send_cb.attempts = request.attempts;
+    // an undelivered user message goes back to the routing layer, which may have another route for it
+    bool undelivered = send_cb->status != ESP_NOW_SEND_SUCCESS && ((example_espnow_data_t *)request.frame->data)->is_userData;
+    evt.info.send_cb.frame = undelivered ? request.frame : NULL;
+    if (xQueueSend(s_control_queue, &evt, 0) != pdTRUE) {
+        PACKET_LOGD(TAG, "Event queue full, send status of "MACSTR" not reported", MAC2STR(request.dest_mac));
+        frame_release(request.frame);
+    }
+    else if (!undelivered)
+        frame_release(request.frame);
+}
+
+static TickType_t ticks_until(int64_t time, int64_t current_time)
+{
+    int64_t delay_us = time - current_time;
+    return delay_us > 0 ? (delay_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000) : 0;
 }
 
-void handle_communication_events(void *pvParameter)
+#if CONFIG_DSDV_MULTI_CHANNEL
+/* Whether the request has to wait: outside the control window for it, or until the frames in flight on
+ * another data channel are done. */
+static bool waits_for_channel(const tx_request_t *request)
+{
+    if (!s_data_period)
+        return false;
+    return request->channel == 0 || (s_in_flight_count > 0 && request->channel != channel_current());
+}
+#endif
+
+/* Adds the destination as a peer, numbers the frame and sends it. */
+static void start_request(tx_request_t *request)
 {
-    event_handler_t *event_handler= (event_handler_t*) pvParameter;
+    if (!add_peer(request->dest_mac, request->encrypt)) {
+        stats_count(STATS_TX_NO_PEER);
+        PACKET_LOGW(TAG, "No peer slot for "MACSTR", dropping frame", MAC2STR(request->dest_mac));
+        frame_release(request->frame);
+        return;
+    }
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+    if (!IS_BROADCAST_ADDR(request->dest_mac))
+        number_frame(request);
+#endif
+    send_request(request);
+}
+
+/* With duty cycling, frames are only sent while the wake window is open; the others wait in the backlog
+ * and the retransmissions until then. With multiple channels, the unicasts whose next hop's data channel is
+ * known are sent outside the control window as well, on that channel. */
+static void tx_task(void *pvParameter)
+{
+    tx_event_t evt;
+    bool may_send = true;
+
+    for (;;) {
+        // sleep until the next event, the next retransmission or the next change of the wake window
+        TickType_t wait = portMAX_DELAY;
+        int64_t current_time = esp_timer_get_time();
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+        wait = ticks_until(duty_cycle_update(current_time, &may_send), current_time);
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+        s_data_period = !duty_cycle_radio_on();
+        may_send |= s_data_period;
+#endif
+        for (int i = 0; may_send && i < s_tx_retries_count; i++) {
+#if CONFIG_DSDV_MULTI_CHANNEL
+            if (waits_for_channel(&s_tx_retries[i]))
+                continue;
+#endif
+            TickType_t ticks = ticks_until(s_tx_retries[i].retry_time, current_time);
+            if (ticks < wait)
+                wait = ticks;
+        }
+        if (xQueueReceive(s_tx_queue, &evt, wait) == pdTRUE) {
+            switch (evt.id) {
+            case TX_REQUEST:
+                s_tx_backlog[(s_tx_backlog_head + s_tx_backlog_count++) % TX_QUEUE_SIZE] = evt.info.request;
+                stats_peak(STATS_PEAK_TX_BACKLOG, s_tx_backlog_count);
+                break;
+            case TX_DONE:
+                complete_request(&evt.info.done);
+                break;
+            default:
+                ESP_LOGE(TAG, "TX event type error: %d", evt.id);
+                break;
+            }
+        }
+
+        current_time = esp_timer_get_time();
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+        duty_cycle_update(current_time, &may_send);
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+        s_data_period = !duty_cycle_radio_on();
+        may_send |= s_data_period;
+#endif
+        if (!may_send)
+            continue;
+
+        // retransmissions that are due go first
+        for (int i = 0; i < s_tx_retries_count; ) {
+#if CONFIG_DSDV_MULTI_CHANNEL
+            if (waits_for_channel(&s_tx_retries[i])) {
+                i++;
+                continue;
+            }
+#endif
+            if (s_tx_retries[i].retry_time <= current_time) {
+                tx_request_t request = s_tx_retries[i];
+                s_tx_retries[i] = s_tx_retries[--s_tx_retries_count];
+                send_request(&request);
+            }
+            else
+                i++;
+        }
+
+#if CONFIG_DSDV_MULTI_CHANNEL
+        // then the frames that waited for the control window
+        while (!s_data_period && s_tx_deferred_count > 0 && s_in_flight_count + s_tx_retries_count < TX_WINDOW) {
+            tx_request_t *request = &s_tx_deferred[s_tx_deferred_head];
+            s_tx_deferred_head = (s_tx_deferred_head + 1) % TX_QUEUE_SIZE;
+            s_tx_deferred_count--;
+            xSemaphoreGive(s_tx_credits);
+            start_request(request);
+        }
+#endif
+
+        // keep the window full
+        while (s_tx_backlog_count > 0 && s_in_flight_count + s_tx_retries_count < TX_WINDOW) {
+            tx_request_t *request = &s_tx_backlog[s_tx_backlog_head];
+#if CONFIG_DSDV_MULTI_CHANNEL
+            if (s_data_period && request->channel == 0) {
+                s_tx_deferred[(s_tx_deferred_head + s_tx_deferred_count++) % TX_QUEUE_SIZE] = *request;
+                s_tx_backlog_head = (s_tx_backlog_head + 1) % TX_QUEUE_SIZE;
+                s_tx_backlog_count--;
+                continue;
+            }
+            if (waits_for_channel(request))
+                break;
+#endif
+            s_tx_backlog_head = (s_tx_backlog_head + 1) % TX_QUEUE_SIZE;
+            s_tx_backlog_count--;
+            xSemaphoreGive(s_tx_credits);
+            start_request(request);
+        }
+
+#if CONFIG_DSDV_MULTI_CHANNEL
+        // listen on the own data channel again once nothing is in flight on another one
+        if (s_data_period && s_in_flight_count == 0)
+            channel_tune(channel_home());
+#endif
+    }
+}
+
+/* Consumer task of one of the receive queues. */
+static void handle_communication_events(void *pvParameter)
+{
+    QueueHandle_t queue = (QueueHandle_t) pvParameter;
+    event_handler_t *event_handler = &s_event_handler;
 
 	example_espnow_event_t evt;
 
-	while (xQueueReceive(s_example_espnow_queue, &evt, portMAX_DELAY) == pdTRUE) {
+	while (xQueueReceive(queue, &evt, portMAX_DELAY) == pdTRUE) {
 		switch (evt.id) {
 		case EXAMPLE_ESPNOW_SEND_CB:
 		{
@@ -170,11 +624,19 @@ void handle_communication_events(void *pvParameter)
 		case EXAMPLE_ESPNOW_RECV_CB:
 		{
 			example_espnow_event_recv_cb_t *recv_cb = &evt.info.recv_cb;
-            if(check_data_correctness(recv_cb->data, recv_cb->data_len))
-				ESP_LOGI(TAG, "Receive error data from: "MACSTR"", MAC2STR(recv_cb->mac_addr));
+            if (!frame_verify(recv_cb->frame)) {
+				stats_count(STATS_RX_CRC_ERRORS);
+				PACKET_LOGI(TAG, "Receive error data from: "MACSTR"", MAC2STR(recv_cb->mac_addr));
+			}
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+			else if (is_duplicate(recv_cb)) {
+				stats_count(STATS_RX_DUPLICATES);
+				PACKET_LOGI(TAG, "Receive duplicate from: "MACSTR"", MAC2STR(recv_cb->mac_addr));
+			}
+#endif
 			else
 				event_handler->do_on_receive_event(recv_cb);
-			free(recv_cb->data);
+			frame_release(recv_cb->frame);
 			break;
 		}
 		default:
@@ -185,15 +647,43 @@ void handle_communication_events(void *pvParameter)
 }
 
 
+void start_event_handlers(const event_handler_t *event_handler)
+{
+    s_event_handler = *event_handler;
+    xTaskCreate(handle_communication_events, "dsdv_control", 4096, s_control_queue, CONTROL_TASK_PRIORITY, NULL);
+    xTaskCreatePinnedToCore(handle_communication_events, "dsdv_data", 4096, s_data_queue, DATA_TASK_PRIORITY, NULL, DATA_TASK_CORE);
+}
+
+
 static esp_err_t example_espnow_init(void)
 {
-    s_example_espnow_queue = xQueueCreate(ESPNOW_QUEUE_SIZE, sizeof(example_espnow_event_t));
-    if (s_example_espnow_queue == NULL) {
-        ESP_LOGE(TAG, "Create mutex fail");
+    s_control_queue = xQueueCreate(CONTROL_QUEUE_SIZE, sizeof(example_espnow_event_t));
+    s_data_queue = xQueueCreate(DATA_QUEUE_SIZE, sizeof(example_espnow_event_t));
+    if (s_control_queue == NULL || s_data_queue == NULL) {
+        ESP_LOGE(TAG, "Create event queues fail");
+        return ESP_FAIL;
+    }
+
+    s_tx_queue = xQueueCreate(TX_QUEUE_SIZE + TX_WINDOW, sizeof(tx_event_t));
+    s_tx_credits = xSemaphoreCreateCounting(TX_QUEUE_SIZE, TX_QUEUE_SIZE);
+    if (s_tx_queue == NULL || s_tx_credits == NULL) {
+        ESP_LOGE(TAG, "Create TX queue fail");
+        vQueueDelete(s_control_queue);
+        vQueueDelete(s_data_queue);
         return ESP_FAIL;
     }
 
-    Mutex_send_param=  xSemaphoreCreateMutex();
+    s_free_frames = xQueueCreate(FRAME_POOL_SIZE, sizeof(frame_buffer_t *));
+    if (s_free_frames == NULL) {
+        ESP_LOGE(TAG, "Create frame pool fail");
+        vQueueDelete(s_control_queue);
+        vQueueDelete(s_data_queue);
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) {
+        frame_buffer_t *frame = &s_frame_pool[i];
+        xQueueSend(s_free_frames, &frame, 0);
+    }
 
     /* Initialize ESPNOW and register sending and receiving callback function. */
     ESP_ERROR_CHECK( esp_now_init() );
@@ -201,38 +691,22 @@ static esp_err_t example_espnow_init(void)
     ESP_ERROR_CHECK( esp_now_register_recv_cb(example_espnow_recv_cb) );
 #if CONFIG_ESP_WIFI_STA_DISCONNECTED_PM_ENABLE
     ESP_ERROR_CHECK( esp_now_set_wake_window(65535) );
+#endif
+#if CONFIG_DSDV_MULTI_CHANNEL
+    channel_init();
+#endif
+#if CONFIG_DSDV_CAPTURE
+    capture_init();
+#endif
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+    duty_cycle_init();
 #endif
     /* Set primary master key. */
     ESP_ERROR_CHECK( esp_now_set_pmk((uint8_t *)CONFIG_ESPNOW_PMK) );
-              
-    /* Initialize sending parameters. */
-	send_param = malloc(sizeof(example_espnow_send_param_t));
-	if (send_param == NULL) {
-		ESP_LOGE(TAG, "Malloc send parameter fail");
-		vSemaphoreDelete(s_example_espnow_queue);
-		esp_now_deinit();
-		return ESP_FAIL;
-	}
-	memset(send_param, 0, sizeof(example_espnow_send_param_t));
-	send_param->buffer = malloc(ESP_NOW_MAX_DATA_LEN);
-	if (send_param->buffer == NULL) {
-		ESP_LOGE(TAG, "Malloc send buffer fail");
-		free(send_param);
-		vSemaphoreDelete(s_example_espnow_queue);
-		esp_now_deinit();
-		return ESP_FAIL;
-	}
 
-    return ESP_OK;
-}
+    xTaskCreate(tx_task, "tx_task", 3072, NULL, 5, NULL);
 
-static void example_espnow_deinit()
-{
-    free(send_param->buffer);
-    free(send_param);
-    vSemaphoreDelete(s_example_espnow_queue);
-    vSemaphoreDelete(Mutex_send_param);
-    esp_now_deinit();
+    return ESP_OK;
 }
 
 void setup_connectivity()
@@ -5,6 +5,7 @@
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/timers.h"
@@ -17,6 +18,9 @@
 #include "esp_mac.h"
 #include "esp_now.h"
 #include "esp_crc.h"
+#include "esp_timer.h"
+
+#include "stats.h"
 
 /* ESPNOW can work in both station and softap mode. It is configured in menuconfig. */
 #if CONFIG_ESPNOW_WIFI_MODE_STATION
@@ -27,22 +31,68 @@
 #define ESPNOW_WIFI_IF   ESP_IF_WIFI_AP
 #endif
 
-#define ESPNOW_QUEUE_SIZE           6
+#define CONTROL_QUEUE_SIZE          CONFIG_DSDV_CONTROL_QUEUE_SIZE
+#define DATA_QUEUE_SIZE             CONFIG_DSDV_DATA_QUEUE_SIZE
+#define CONTROL_TASK_PRIORITY       6    // above the forwarding and routing tasks
+#define DATA_TASK_PRIORITY          4
+#define DATA_TASK_CORE              (CONFIG_DSDV_DATA_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_DSDV_DATA_TASK_CORE)
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+#define FRAME_POOL_SIZE             64   // frames wait for the next wake or control window
+#define TX_QUEUE_SIZE               48
+#else
+#define FRAME_POOL_SIZE             32
+#define TX_QUEUE_SIZE               16   // frames waiting for the TX task
+#endif
+#define FRAME_POOL_RESERVE          4    // buffers user messages can't take, kept for routing advertisements
+#define TX_WINDOW                   CONFIG_DSDV_TX_WINDOW // frames handed to the driver or waiting to be sent again
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+#define TX_MAX_RETRIES              CONFIG_DSDV_RELIABLE_RETRIES
+#define TX_RETRY_BACKOFF            CONFIG_DSDV_RELIABLE_BACKOFF // [ms] before the first retransmission, doubled for each further one
+#define LINK_TABLE_SIZE             16   // neighbours whose link sequence numbers are tracked, least recently used ones are replaced
+#else
+#define TX_MAX_RETRIES              2    // retransmissions of a unicast the driver reports as failed
+#define TX_RETRY_BACKOFF            0
+#endif
+
+/* Logs about single frames, compiled in with CONFIG_DSDV_PACKET_LOG only. */
+#if CONFIG_DSDV_PACKET_LOG
+#define PACKET_LOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define PACKET_LOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define PACKET_LOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+#else
+#define PACKET_LOGW(tag, format, ...) do {} while (0)
+#define PACKET_LOGI(tag, format, ...) do {} while (0)
+#define PACKET_LOGD(tag, format, ...) do {} while (0)
+#endif
+
+#define IS_BROADCAST_ADDR(addr) (memcmp(addr, "\xFF\xFF\xFF\xFF\xFF\xFF", ESP_NOW_ETH_ALEN) == 0)
 
 typedef enum {
     EXAMPLE_ESPNOW_SEND_CB,
     EXAMPLE_ESPNOW_RECV_CB,
 } example_espnow_event_id_t;
 
+/* Fixed-size frame buffer from the frame pool. data holds a complete ESPNOW frame
+ * (example_espnow_data_t and payload) of len bytes. Returned to the pool when the last reference is released. */
+typedef struct {
+    atomic_int refs;
+    int64_t rx_time;                      // arrival of a received frame, 0 for frames built by this node
+    int len;
+    bool sealed;                          // the CRC matches the contents, cleared by whoever changes them
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} frame_buffer_t;
+
 typedef struct {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
     esp_now_send_status_t status;
+    uint8_t attempts;                     // transmissions of the frame, retries included.
+    frame_buffer_t *frame;                // undelivered user message, handed over to the handler; NULL otherwise
 } example_espnow_event_send_cb_t;
 
 typedef struct {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
-    uint8_t *data;
-    int data_len;
+    int8_t rssi;                          // [dBm] signal strength of the frame
+    frame_buffer_t *frame;
 } example_espnow_event_recv_cb_t;
 
 typedef union {
@@ -65,22 +115,25 @@ enum {
 typedef struct {
     uint8_t is_userData;                  // user data or routing entry.
     uint16_t crc;                         //CRC16 value of ESPNOW data.
+#if CONFIG_DSDV_RELIABLE_DELIVERY
+    uint16_t link_seq;                    // per-hop sequence number of a unicast, 0 for broadcasts
+#endif
+#if CONFIG_DSDV_DUTY_CYCLE || CONFIG_DSDV_MULTI_CHANNEL
+    uint32_t mesh_time;                   // [ms] sender's mesh time when the frame went out, see duty_cycle.c
+#endif
     uint8_t payload[0];                   //Real payload of ESPNOW data.
 } __attribute__((packed)) example_espnow_data_t;
 
-/* Parameters of sending ESPNOW data. */
-typedef struct {
-    uint8_t *buffer;                      //Buffer pointing to ESPNOW data.
-    uint8_t dest_mac[ESP_NOW_ETH_ALEN];   //MAC address of destination device.
-} example_espnow_send_param_t;
-
 typedef struct {
     void (*do_on_send_event)(example_espnow_event_send_cb_t*);
     void (*do_on_receive_event)(example_espnow_event_recv_cb_t*);
 } event_handler_t;
 
 void setup_connectivity();
-void handle_communication_events(void *pvParameter); // event_handler_t
-esp_err_t transmit_data(uint8_t *mac_addr, uint8_t *data, int data_len, bool encrypt, bool is_userData);
+void start_event_handlers(const event_handler_t *event_handler);
+frame_buffer_t *frame_alloc(bool is_userData); // NULL when the pool is exhausted
+void frame_ref(frame_buffer_t *frame);
+void frame_release(frame_buffer_t *frame);
+esp_err_t transmit_frame(uint8_t *mac_addr, frame_buffer_t *frame, bool encrypt); // consumes a reference to frame, doesn't block
 
 #endif
@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "reassembly.h"
+
+/* A handful of slots, each as large as the largest message, searched linearly. Only the task that
+ * receives user messages touches them. */
+static reassembly_t slots[REASSEMBLY_SLOTS];
+
+
+static reassembly_t *find_slot(const uint8_t *src_addr, uint16_t msg_id)
+{
+    reassembly_t *free_slot= NULL;
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++)
+    {
+        if (slots[i].frag_count == 0)
+        {
+            if (free_slot == NULL)
+                free_slot= &slots[i];
+        }
+        else if (slots[i].msg_id == msg_id && memcmp(slots[i].src_addr, src_addr, ESP_NOW_ETH_ALEN) == 0)
+            return &slots[i];
+    }
+    return free_slot;
+}
+
+/* Copies the fragment into place. offset is where it starts in the message; only the last fragment
+ * may be shorter than the others. On REASSEMBLY_COMPLETE, *msg is the message, to be released by the caller. */
+reassembly_status_t reassembly_add(const uint8_t *src_addr, uint16_t msg_id, int frag_index, int frag_count,
+                                   int offset, const uint8_t *data, int len, int64_t current_time, reassembly_t **msg)
+{
+    if (frag_count < 1 || frag_index >= frag_count || offset + len > MAX_MESSAGE_SIZE)
+        return REASSEMBLY_INVALID;
+
+    reassembly_t *slot= find_slot(src_addr, msg_id);
+    if (slot == NULL)
+        return REASSEMBLY_FULL;
+    if (slot->frag_count == 0)
+    {
+        memcpy(slot->src_addr, src_addr, ESP_NOW_ETH_ALEN);
+        slot->msg_id= msg_id;
+        slot->frag_count= frag_count;
+        slot->frags_received= 0;
+        slot->len= -1;
+        slot->first_fragment_time= current_time;
+        memset(slot->received, 0, sizeof(slot->received));
+    }
+    else if (slot->frag_count != frag_count)
+        return REASSEMBLY_INVALID;
+
+    uint32_t bit= 1u << (frag_index % 32);
+    if (slot->received[frag_index / 32] & bit)
+        return REASSEMBLY_DUPLICATE;
+    slot->received[frag_index / 32] |= bit;
+    slot->frags_received++;
+    memcpy(slot->data + offset, data, len);
+    if (frag_index == frag_count - 1)
+        slot->len= offset + len;
+
+    if (slot->frags_received < slot->frag_count)
+        return REASSEMBLY_PENDING;
+    *msg= slot;
+    return REASSEMBLY_COMPLETE;
+}
+
+void reassembly_release(reassembly_t *msg)
+{
+    msg->frag_count= 0;
+}
+
+/* Drop the messages whose first fragment arrived more than max_age ago. Returns the number dropped. */
+int reassembly_expire(int64_t current_time, int64_t max_age)
+{
+    int expired= 0;
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++)
+        if (slots[i].frag_count != 0 && current_time - slots[i].first_fragment_time > max_age)
+        {
+            reassembly_release(&slots[i]);
+            expired++;
+        }
+    return expired;
+}
@@ -0,0 +1,39 @@
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_now.h"
+
+#define REASSEMBLY_SLOTS    CONFIG_DSDV_REASSEMBLY_SLOTS
+#define MAX_MESSAGE_SIZE    CONFIG_DSDV_MAX_MESSAGE_SIZE
+#define MAX_FRAGMENTS       UINT8_MAX
+
+
+/* Message being put together from its fragments. A slot is free while frag_count is 0. */
+typedef struct {
+    uint8_t src_addr[ESP_NOW_ETH_ALEN];
+    uint16_t msg_id;
+    uint8_t frag_count;
+    uint8_t frags_received;
+    int len;                              // known once the last fragment arrived
+    int64_t first_fragment_time;
+    uint32_t received[(MAX_FRAGMENTS + 31) / 32]; // bitmap of the fragments received
+    uint8_t data[MAX_MESSAGE_SIZE];
+} reassembly_t;
+
+/* Result of reassembly_add(). */
+typedef enum {
+    REASSEMBLY_PENDING,                   // stored, more fragments to come
+    REASSEMBLY_COMPLETE,                  // the message is complete
+    REASSEMBLY_DUPLICATE,
+    REASSEMBLY_INVALID,                   // inconsistent with the other fragments or larger than MAX_MESSAGE_SIZE
+    REASSEMBLY_FULL,                      // no free slot for a new message
+} reassembly_status_t;
+
+reassembly_status_t reassembly_add(const uint8_t *src_addr, uint16_t msg_id, int frag_index, int frag_count,
+                                   int offset, const uint8_t *data, int len, int64_t current_time, reassembly_t **msg);
+void reassembly_release(reassembly_t *msg);
+int reassembly_expire(int64_t current_time, int64_t max_age);
+
+#endif
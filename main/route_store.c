@@ -0,0 +1,73 @@
+#include "esp_log.h"
+
+#include "route_store.h"
+
+/* The own sequence number and the reachable routes, in the NVS namespace ROUTE_STORE_NAMESPACE.
+ * Both are written rarely: NVS appends every write to the current flash page and erases pages as
+ * they fill up, so the number of writes is what wears the flash. */
+#define SEQ_NUM_KEY         "seq_limit"
+#define ROUTES_KEY          "routes_v1"   // array of StoredRoute_t, renamed when the layout changes
+
+static const char *TAG = "route_store";
+
+static nvs_handle_t handle;
+static bool is_open= false;
+
+
+esp_err_t route_store_open()
+{
+    esp_err_t ret= nvs_open(ROUTE_STORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Opening NVS failed: 0x%x, routing state is not kept over restarts", ret);
+    is_open= ret == ESP_OK;
+    return ret;
+}
+
+/* The stored value is above every sequence number the node advertised before, so it's where the node
+ * goes on after a restart. */
+esp_err_t route_store_load_seq_num(uint16_t *seq_num)
+{
+    if (!is_open)
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    return nvs_get_u16(handle, SEQ_NUM_KEY, seq_num);
+}
+
+esp_err_t route_store_save_seq_num(uint16_t seq_num)
+{
+    if (!is_open)
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    esp_err_t ret= nvs_set_u16(handle, SEQ_NUM_KEY, seq_num);
+    if (ret == ESP_OK)
+        ret= nvs_commit(handle);
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Saving the sequence number failed: 0x%x", ret);
+    return ret;
+}
+
+/* Returns the number of routes read into routes, 0 if there are none or they don't fit. */
+int route_store_load_routes(StoredRoute_t *routes, int max_routes)
+{
+    if (!is_open)
+        return 0;
+    size_t len= max_routes * sizeof(StoredRoute_t);
+    esp_err_t ret= nvs_get_blob(handle, ROUTES_KEY, routes, &len);
+    if (ret != ESP_OK || len % sizeof(StoredRoute_t) != 0)
+    {
+        if (ret != ESP_ERR_NVS_NOT_FOUND)
+            ESP_LOGW(TAG, "Stored routes unusable: 0x%x, len %d", ret, (int)len);
+        return 0;
+    }
+    return len / sizeof(StoredRoute_t);
+}
+
+esp_err_t route_store_save_routes(const StoredRoute_t *routes, int routes_nbr)
+{
+    if (!is_open)
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    esp_err_t ret= nvs_set_blob(handle, ROUTES_KEY, routes, routes_nbr * sizeof(StoredRoute_t));
+    if (ret == ESP_OK)
+        ret= nvs_commit(handle);
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Saving %d routes failed: 0x%x", routes_nbr, ret);
+    return ret;
+}
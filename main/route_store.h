@@ -0,0 +1,28 @@
+#ifndef ROUTE_STORE_H
+#define ROUTE_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nvs.h"
+#include "esp_now.h"
+
+#define ROUTE_STORE_NAMESPACE "dsdv"
+#define SEQ_NUM_RESERVE     128  // own sequence numbers reserved by one write, even
+
+
+/* Stored form of a reachable routing entry. */
+typedef struct {
+    uint8_t destination_addr[ESP_NOW_ETH_ALEN];
+    uint8_t next_hop_addr[ESP_NOW_ETH_ALEN];
+    uint8_t hop_count;
+    uint16_t seq_num;
+    uint16_t metric;
+} __attribute__((packed)) StoredRoute_t;
+
+esp_err_t route_store_open();
+esp_err_t route_store_load_seq_num(uint16_t *seq_num);
+esp_err_t route_store_save_seq_num(uint16_t seq_num);
+int route_store_load_routes(StoredRoute_t *routes, int max_routes);
+esp_err_t route_store_save_routes(const StoredRoute_t *routes, int routes_nbr);
+
+#endif
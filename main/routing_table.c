@@ -0,0 +1,237 @@
+#include <string.h>
+
+#include "routing_table.h"
+
+/* Open addressing with linear probing over a slot array of about twice the table capacity.
+ * A slot holds the index of an entry in routing_table, so lookups cost one hash plus, on
+ * average, one or two 6-byte compares regardless of the number of destinations. */
+#define HASH_SLOTS          (MAX_NODES * 2 + 1)
+#define EMPTY_SLOT          UINT16_MAX
+#define NO_NEIGHBOUR        UINT8_MAX
+
+_Static_assert(MAX_NODES < EMPTY_SLOT, "routing table indexes must fit into a hash slot");
+
+RoutingEntry_t routing_table[MAX_NODES];
+RoutingEntryInfo_t routing_info[MAX_NODES];
+int entries_nbr= 0;
+
+static uint16_t hash_slots[HASH_SLOTS];
+
+// next hops of the routes, shared by all routes through the same neighbour
+static uint8_t neighbour_addr[MAX_NEIGHBOURS][ESP_NOW_ETH_ALEN];
+static uint16_t neighbour_refs[MAX_NEIGHBOURS];
+static NeighbourStats_t neighbour_stats[MAX_NEIGHBOURS];
+static int neighbours_nbr= 0;
+
+
+static uint32_t hash_mac(const uint8_t *mac_addr)
+{
+    // FNV-1a
+    uint32_t hash= 2166136261u;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        hash= (hash ^ mac_addr[i]) * 16777619u;
+    return hash % HASH_SLOTS;
+}
+
+static uint32_t find_slot(const uint8_t *mac_addr)
+{
+    uint32_t slot= hash_mac(mac_addr);
+    while (hash_slots[slot] != EMPTY_SLOT && memcmp(routing_table[hash_slots[slot]].destination_addr, mac_addr, ESP_NOW_ETH_ALEN) != 0)
+        slot= (slot + 1) % HASH_SLOTS;
+    return slot;
+}
+
+void routing_table_init()
+{
+    memset(routing_table, 0, sizeof(routing_table));
+    memset(routing_info, 0, sizeof(routing_info));
+    memset(hash_slots, 0xFF, sizeof(hash_slots));
+    entries_nbr= 0;
+    memset(neighbour_refs, 0, sizeof(neighbour_refs));
+    neighbours_nbr= 0;
+}
+
+int routing_table_find(const uint8_t *mac_addr)
+{
+    uint16_t index= hash_slots[find_slot(mac_addr)];
+    return index == EMPTY_SLOT ? -1 : index;
+}
+
+/* Evict the unreachable entry that has not been updated for the longest time. */
+static bool evict_unreachable()
+{
+    int victim= -1;
+    for (int i = 1; i < entries_nbr; i++)
+        if (routing_table[i].hop_count == UINT8_MAX)
+            if (victim < 0 || routing_info[i].last_update_time < routing_info[victim].last_update_time)
+                victim= i;
+    if (victim < 0)
+        return false;
+    routing_table_remove(victim);
+    return true;
+}
+
+/* Returns the index of a new, zeroed entry for mac_addr, or -1 if the table is full of reachable destinations. */
+int routing_table_add(const uint8_t *mac_addr)
+{
+    if (entries_nbr == MAX_NODES && !evict_unreachable())
+        return -1;
+
+    int index= entries_nbr++;
+    memset(&routing_table[index], 0, sizeof(RoutingEntry_t));
+    memset(&routing_info[index], 0, sizeof(RoutingEntryInfo_t));
+    memcpy(routing_table[index].destination_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    routing_table[index].next_hop= NO_NEIGHBOUR;
+    hash_slots[find_slot(mac_addr)]= index;
+    return index;
+}
+
+/* The last entry takes the place of the removed one. The own entry (index 0) is never removed. */
+void routing_table_remove(int index)
+{
+    if (index <= 0 || index >= entries_nbr)
+        return;
+
+    if (routing_table[index].next_hop != NO_NEIGHBOUR)
+        neighbour_refs[routing_table[index].next_hop]--;
+    for (int i = 0; i < routing_info[index].alternates_nbr; i++)
+        neighbour_refs[routing_info[index].alternates[i].next_hop]--;
+
+    // backward-shift deletion keeps probe sequences intact without tombstones
+    uint32_t hole= find_slot(routing_table[index].destination_addr);
+    hash_slots[hole]= EMPTY_SLOT;
+    for (uint32_t slot = (hole + 1) % HASH_SLOTS; hash_slots[slot] != EMPTY_SLOT; slot = (slot + 1) % HASH_SLOTS)
+    {
+        uint32_t home= hash_mac(routing_table[hash_slots[slot]].destination_addr);
+        bool movable= hole <= slot ? (home <= hole || home > slot) : (home <= hole && home > slot);
+        if (movable)
+        {
+            hash_slots[hole]= hash_slots[slot];
+            hash_slots[slot]= EMPTY_SLOT;
+            hole= slot;
+        }
+    }
+
+    int last= --entries_nbr;
+    if (index != last)
+    {
+        hash_slots[find_slot(routing_table[last].destination_addr)]= index;
+        memcpy(&routing_table[index], &routing_table[last], sizeof(RoutingEntry_t));
+        memcpy(&routing_info[index], &routing_info[last], sizeof(RoutingEntryInfo_t));
+    }
+}
+
+/* Drop unreachable entries that have not been updated within max_age. Returns the number removed. */
+int routing_table_expire(int64_t current_time, int64_t max_age)
+{
+    int removed= 0;
+    for (int i = entries_nbr - 1; i > 0; i--)
+        if (routing_table[i].hop_count == UINT8_MAX && current_time - routing_info[i].last_update_time > max_age)
+        {
+            routing_table_remove(i);
+            removed++;
+        }
+    return removed;
+}
+
+/* Returns the neighbour table index of mac_addr, reusing a slot no route refers to if mac_addr is new,
+ * or -1 if every slot is in use. */
+int routing_table_neighbour(const uint8_t *mac_addr)
+{
+    for (int i = 0; i < neighbours_nbr; i++)
+        if (memcmp(neighbour_addr[i], mac_addr, ESP_NOW_ETH_ALEN) == 0)
+            return i;
+
+    int neighbour= -1;
+    if (neighbours_nbr < MAX_NEIGHBOURS)
+        neighbour= neighbours_nbr++;
+    else
+        for (int i = 0; i < neighbours_nbr && neighbour < 0; i++)
+            if (neighbour_refs[i] == 0)
+                neighbour= i;
+    if (neighbour >= 0)
+    {
+        memcpy(neighbour_addr[neighbour], mac_addr, ESP_NOW_ETH_ALEN);
+        memset(&neighbour_stats[neighbour], 0, sizeof(NeighbourStats_t));
+    }
+    return neighbour;
+}
+
+/* The new next hop stops being an alternate of the route. */
+void routing_table_set_next_hop(int index, int neighbour)
+{
+    routing_table_remove_alternate(index, neighbour);
+    if (routing_table[index].next_hop != NO_NEIGHBOUR)
+        neighbour_refs[routing_table[index].next_hop]--;
+    routing_table[index].next_hop= neighbour;
+    neighbour_refs[neighbour]++;
+}
+
+/* Records or updates the route through the neighbour. When all MAX_ALTERNATES places are taken, it replaces
+ * the alternate with the oldest sequence number, or the largest metric among those, if it is better. */
+void routing_table_set_alternate(int index, int neighbour, uint8_t hop_count, uint16_t seq_num, uint16_t metric)
+{
+    if (neighbour == routing_table[index].next_hop)
+        return;
+
+    RoutingEntryInfo_t *info= &routing_info[index];
+    int slot= -1;
+    for (int i = 0; i < info->alternates_nbr && slot < 0; i++)
+        if (info->alternates[i].next_hop == neighbour)
+            slot= i;
+    if (slot < 0)
+    {
+        if (info->alternates_nbr < MAX_ALTERNATES)
+            slot= info->alternates_nbr++;
+        else
+        {
+            int worst= 0;
+            for (int i = 1; i < MAX_ALTERNATES; i++)
+                if (SEQ_NUM_NEWER(info->alternates[worst].seq_num, info->alternates[i].seq_num)
+                        || (info->alternates[i].seq_num == info->alternates[worst].seq_num && info->alternates[i].metric > info->alternates[worst].metric))
+                    worst= i;
+            if (SEQ_NUM_NEWER(info->alternates[worst].seq_num, seq_num) || (seq_num == info->alternates[worst].seq_num && metric >= info->alternates[worst].metric))
+                return;
+            neighbour_refs[info->alternates[worst].next_hop]--;
+            slot= worst;
+        }
+        neighbour_refs[neighbour]++;
+    }
+    info->alternates[slot].next_hop= neighbour;
+    info->alternates[slot].hop_count= hop_count;
+    info->alternates[slot].seq_num= seq_num;
+    info->alternates[slot].metric= metric;
+}
+
+void routing_table_remove_alternate(int index, int neighbour)
+{
+    RoutingEntryInfo_t *info= &routing_info[index];
+    for (int i = 0; i < info->alternates_nbr; i++)
+        if (info->alternates[i].next_hop == neighbour)
+        {
+            neighbour_refs[neighbour]--;
+            info->alternates[i]= info->alternates[--info->alternates_nbr];
+            return;
+        }
+}
+
+void routing_table_remove_alternates_via(int neighbour)
+{
+    for (int i = 0; i < entries_nbr; i++)
+        routing_table_remove_alternate(i, neighbour);
+}
+
+const uint8_t *routing_table_next_hop(int index)
+{
+    return neighbour_addr[routing_table[index].next_hop];
+}
+
+const uint8_t *routing_table_neighbour_addr(int neighbour)
+{
+    return neighbour_addr[neighbour];
+}
+
+NeighbourStats_t *routing_table_neighbour_stats(int neighbour)
+{
+    return &neighbour_stats[neighbour];
+}
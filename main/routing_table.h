@@ -0,0 +1,87 @@
+#ifndef ROUTING_TABLE_H
+#define ROUTING_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_now.h"
+#include "link_quality.h"
+
+#ifndef MAX_NODES
+#define MAX_NODES           CONFIG_DSDV_MAX_NODES
+#endif
+#define MAX_NEIGHBOURS      (MAX_NODES < UINT8_MAX ? MAX_NODES : UINT8_MAX)
+#define METRIC_INFINITY     UINT16_MAX
+#define MAX_ALTERNATES      CONFIG_DSDV_MAX_ALTERNATES
+
+/* Sequence numbers wrap around: a is newer than b if it is less than half the number space ahead of it. */
+#define SEQ_NUM_NEWER(a, b) ((int16_t)(uint16_t)((a) - (b)) > 0)
+
+
+/* Fields used on every lookup and advertisement. The next hop is an index into the neighbour table. */
+typedef struct {
+    uint8_t destination_addr[ESP_NOW_ETH_ALEN];
+    uint8_t next_hop;
+    uint8_t hop_count;
+    uint16_t seq_num;
+    uint16_t metric;                      // hop count, or ETX [1/ETX_ONE] with CONFIG_DSDV_METRIC_ETX
+} RoutingEntry_t;
+
+/* Route to a destination through another neighbour than the next hop, as that neighbour advertised it. */
+typedef struct {
+    uint8_t next_hop;
+    uint8_t hop_count;
+    uint16_t seq_num;
+    uint16_t metric;
+} RouteAlternate_t;
+
+/* Bookkeeping that is only touched by the periodic maintenance, advertisements and failover. */
+typedef struct {
+    int64_t last_update_time;
+    int64_t first_heard_time;             // arrival of the first route with the current sequence number
+    int64_t advertise_after;              // changes are not advertised incrementally before this
+    uint32_t settling_time;               // [us] weighted average delay from the first to the best route of a sequence number
+    uint16_t advertised_seq_num;          // state of the entry in the last advertisement
+    uint8_t advertised_hop_count;
+    bool provisional;                     // restored after a restart, no advert has confirmed it yet
+#if CONFIG_DSDV_ZONE_ROUTING
+    bool head;                            // the destination is a cluster head
+    bool advertised_head;
+    uint8_t previous_hop_count;           // hop count the previous sequence number settled at
+#endif
+    uint8_t alternates_nbr;
+    RouteAlternate_t alternates[MAX_ALTERNATES];
+} RoutingEntryInfo_t;
+
+/* Statistics of a neighbour, fed by the send completions and its adverts. */
+typedef struct {
+    uint32_t tx_frames;                   // frames whose transmission completed
+    uint32_t tx_attempts;                 // transmissions of these frames, retries included
+    uint32_t tx_failures;                 // frames that were not acknowledged after all retries
+#if CONFIG_DSDV_ADAPTIVE_PERIOD
+    uint16_t advert_period;               // [ms] announced in its last advert, 0 before the first one
+#endif
+    LinkQuality_t link;
+} NeighbourStats_t;
+
+/* Entries are kept densely in routing_table[0 .. entries_nbr-1]; routing_info holds the cold
+ * fields of the entry with the same index. Indexes change when entries are removed. */
+extern RoutingEntry_t routing_table[MAX_NODES];
+extern RoutingEntryInfo_t routing_info[MAX_NODES];
+extern int entries_nbr;
+
+void routing_table_init();
+int routing_table_find(const uint8_t *mac_addr);
+int routing_table_add(const uint8_t *mac_addr);
+void routing_table_remove(int index);
+int routing_table_expire(int64_t current_time, int64_t max_age);
+
+int routing_table_neighbour(const uint8_t *mac_addr);
+void routing_table_set_next_hop(int index, int neighbour);
+void routing_table_set_alternate(int index, int neighbour, uint8_t hop_count, uint16_t seq_num, uint16_t metric);
+void routing_table_remove_alternate(int index, int neighbour);
+void routing_table_remove_alternates_via(int neighbour);
+const uint8_t *routing_table_next_hop(int index);
+const uint8_t *routing_table_neighbour_addr(int neighbour);
+NeighbourStats_t *routing_table_neighbour_stats(int neighbour);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_timer.h"
+#include "esp_system.h"
+
+#include "stats.h"
+
+#define STATS_BINARY_VERSION 13
+
+static atomic_uint counters[STATS_COUNTERS_NBR];
+static atomic_uint peaks[STATS_PEAKS_NBR];
+static atomic_uint forward_latency[STATS_LATENCY_BUCKETS];
+
+static const char *const counter_names[STATS_COUNTERS_NBR] = {
+    [STATS_RX_FRAMES]              = "rx_frames",
+    [STATS_RX_DROPPED_NO_FRAME]    = "rx_dropped_no_frame",
+    [STATS_RX_DROPPED_CONTROL_QUEUE_FULL] = "rx_dropped_control_queue_full",
+    [STATS_RX_DROPPED_DATA_QUEUE_FULL] = "rx_dropped_data_queue_full",
+    [STATS_RX_CRC_ERRORS]          = "rx_crc_errors",
+    [STATS_RX_DUPLICATES]          = "rx_duplicates",
+    [STATS_RX_MALFORMED]           = "rx_malformed",
+    [STATS_RX_FULL_DUMPS]          = "rx_full_dumps",
+    [STATS_RX_UPDATES]             = "rx_updates",
+    [STATS_RX_USER]                = "rx_user",
+    [STATS_RX_FRAGMENTS]           = "rx_fragments",
+    [STATS_RX_REASSEMBLY_TIMEOUTS] = "rx_reassembly_timeouts",
+    [STATS_RX_REASSEMBLY_FULL]     = "rx_reassembly_full",
+    [STATS_RX_FLOODS]              = "rx_floods",
+    [STATS_RX_FLOOD_DUPLICATES]    = "rx_flood_duplicates",
+    [STATS_RX_ZONE_SUMMARIES]      = "rx_zone_summaries",
+    [STATS_TX_FULL_DUMPS]          = "tx_full_dumps",
+    [STATS_TX_UPDATES]             = "tx_updates",
+    [STATS_TX_TRIGGERED]           = "tx_triggered",
+    [STATS_TX_USER]                = "tx_user",
+    [STATS_TX_FRAGMENTS]           = "tx_fragments",
+    [STATS_TX_COMPRESSED]          = "tx_compressed",
+    [STATS_TX_FORWARDED]           = "tx_forwarded",
+    [STATS_TX_BUNDLES]             = "tx_bundles",
+    [STATS_TX_BUNDLED]             = "tx_bundled",
+    [STATS_TX_FLOODS]              = "tx_floods",
+    [STATS_TX_FLOOD_RELAYS]        = "tx_flood_relays",
+    [STATS_TX_FLOOD_SUPPRESSED]    = "tx_flood_suppressed",
+    [STATS_TX_ZONE_SUMMARIES]      = "tx_zone_summaries",
+    [STATS_TX_ZONE_SUMMARY_RELAYS] = "tx_zone_summary_relays",
+    [STATS_TX_QUEUE_FULL]          = "tx_queue_full",
+    [STATS_TX_DRIVER_ERRORS]       = "tx_driver_errors",
+    [STATS_TX_NO_PEER]             = "tx_no_peer",
+    [STATS_PEER_EVICTIONS]         = "peer_evictions",
+    [STATS_CHANNEL_SWITCHES]       = "channel_switches",
+    [STATS_TX_RETRIES]             = "tx_retries",
+    [STATS_TX_FAILURES]            = "tx_failures",
+    [STATS_TX_SALVAGED]            = "tx_salvaged",
+    [STATS_NO_ROUTE]               = "no_route",
+    [STATS_ROUTE_CHANGES]          = "route_changes",
+    [STATS_ROUTE_BREAKS]           = "route_breaks",
+    [STATS_ROUTE_REPAIRS]          = "route_repairs",
+    [STATS_ROUTE_FAILOVERS]        = "route_failovers",
+    [STATS_NEIGHBOUR_TABLE_FULL]   = "neighbour_table_full",
+    [STATS_ROUTING_TABLE_FULL]     = "routing_table_full",
+    [STATS_ROUTES_RESTORED]        = "routes_restored",
+    [STATS_ROUTES_UNCONFIRMED]     = "routes_unconfirmed",
+    [STATS_ROUTES_LEFT_ZONE]       = "routes_left_zone",
+    [STATS_NVS_WRITES]             = "nvs_writes",
+    [STATS_CAPTURE_DROPPED]        = "capture_dropped",
+};
+
+static const char *const peak_names[STATS_PEAKS_NBR] = {
+    [STATS_PEAK_CONTROL_QUEUE]     = "control_queue",
+    [STATS_PEAK_DATA_QUEUE]        = "data_queue",
+    [STATS_PEAK_TX_BACKLOG]        = "tx_backlog",
+    [STATS_PEAK_FRAMES_IN_USE]     = "frames_in_use",
+    [STATS_PEAK_ROUTING_ENTRIES]   = "routing_entries",
+};
+
+
+void stats_count(stats_counter_t counter)
+{
+    atomic_fetch_add_explicit(&counters[counter], 1, memory_order_relaxed);
+}
+
+void stats_peak(stats_peak_t peak, uint32_t value)
+{
+    unsigned int seen= atomic_load_explicit(&peaks[peak], memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(&peaks[peak], &seen, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void stats_forward_latency(int64_t latency_us)
+{
+    int bucket= 0;
+    for (int64_t limit = (int64_t)1 << (STATS_LATENCY_MIN_LOG2 + 1); latency_us >= limit && bucket < STATS_LATENCY_BUCKETS - 1; limit <<= 1)
+        bucket++;
+    atomic_fetch_add_explicit(&forward_latency[bucket], 1, memory_order_relaxed);
+}
+
+uint32_t stats_get(stats_counter_t counter)
+{
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+void stats_snapshot(stats_snapshot_t *snapshot)
+{
+    snapshot->uptime_us= esp_timer_get_time();
+    snapshot->free_heap= esp_get_free_heap_size();
+    snapshot->min_free_heap= esp_get_minimum_free_heap_size();
+    for (int i = 0; i < STATS_COUNTERS_NBR; i++)
+        snapshot->counters[i]= atomic_load_explicit(&counters[i], memory_order_relaxed);
+    for (int i = 0; i < STATS_PEAKS_NBR; i++)
+        snapshot->peaks[i]= atomic_load_explicit(&peaks[i], memory_order_relaxed);
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+        snapshot->forward_latency[i]= atomic_load_explicit(&forward_latency[i], memory_order_relaxed);
+}
+
+void stats_reset()
+{
+    for (int i = 0; i < STATS_COUNTERS_NBR; i++)
+        atomic_store(&counters[i], 0);
+    for (int i = 0; i < STATS_PEAKS_NBR; i++)
+        atomic_store(&peaks[i], 0);
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+        atomic_store(&forward_latency[i], 0);
+}
+
+/* snprintf into buf at *used, keeping track of the space left. */
+static bool append(char *buf, size_t len, size_t *used, const char *format, ...) __attribute__((format(printf, 4, 5)));
+static bool append(char *buf, size_t len, size_t *used, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n= vsnprintf(buf + *used, len - *used, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= len - *used)
+        return false;
+    *used += n;
+    return true;
+}
+
+int stats_to_json(const stats_snapshot_t *snapshot, char *buf, size_t len)
+{
+    size_t used= 0;
+    bool ok= len > 0 && append(buf, len, &used, "{\"uptime_us\":%lld,\"free_heap\":%lu,\"min_free_heap\":%lu,\"counters\":{",
+                                   (long long)snapshot->uptime_us, (unsigned long)snapshot->free_heap, (unsigned long)snapshot->min_free_heap);
+    for (int i = 0; ok && i < STATS_COUNTERS_NBR; i++)
+        ok= append(buf, len, &used, "%s\"%s\":%lu", i ? "," : "", counter_names[i], (unsigned long)snapshot->counters[i]);
+    ok= ok && append(buf, len, &used, "},\"peaks\":{");
+    for (int i = 0; ok && i < STATS_PEAKS_NBR; i++)
+        ok= append(buf, len, &used, "%s\"%s\":%lu", i ? "," : "", peak_names[i], (unsigned long)snapshot->peaks[i]);
+    ok= ok && append(buf, len, &used, "},\"forward_latency_log2_us\":{\"min_log2\":%d,\"buckets\":[", STATS_LATENCY_MIN_LOG2);
+    for (int i = 0; ok && i < STATS_LATENCY_BUCKETS; i++)
+        ok= append(buf, len, &used, "%s%lu", i ? "," : "", (unsigned long)snapshot->forward_latency[i]);
+    ok= ok && append(buf, len, &used, "]}}");
+    return ok ? (int)used : -1;
+}
+
+int stats_to_binary(const stats_snapshot_t *snapshot, uint8_t *buf, size_t len)
+{
+    size_t size= 4 + sizeof(snapshot->uptime_us) + sizeof(snapshot->free_heap) + sizeof(snapshot->min_free_heap)
+               + sizeof(snapshot->counters) + sizeof(snapshot->peaks) + sizeof(snapshot->forward_latency);
+    if (len < size)
+        return -1;
+
+    // the targets are little-endian: the fields are copied as they are
+    buf[0]= STATS_BINARY_VERSION;
+    buf[1]= STATS_COUNTERS_NBR;
+    buf[2]= STATS_PEAKS_NBR;
+    buf[3]= STATS_LATENCY_BUCKETS;
+    uint8_t *p= buf + 4;
+    memcpy(p, &snapshot->uptime_us, sizeof(snapshot->uptime_us));              p += sizeof(snapshot->uptime_us);
+    memcpy(p, &snapshot->free_heap, sizeof(snapshot->free_heap));              p += sizeof(snapshot->free_heap);
+    memcpy(p, &snapshot->min_free_heap, sizeof(snapshot->min_free_heap));      p += sizeof(snapshot->min_free_heap);
+    memcpy(p, snapshot->counters, sizeof(snapshot->counters));                 p += sizeof(snapshot->counters);
+    memcpy(p, snapshot->peaks, sizeof(snapshot->peaks));                       p += sizeof(snapshot->peaks);
+    memcpy(p, snapshot->forward_latency, sizeof(snapshot->forward_latency));
+    return size;
+}
@@ -0,0 +1,101 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Counters of the routing and forwarding paths. They are updated lock-free from the WiFi callbacks
+ * and the DSDV tasks and only ever grow, until stats_reset(). */
+typedef enum {
+    STATS_RX_FRAMES,                      // frames handed over by the driver
+    STATS_RX_DROPPED_NO_FRAME,            // ... dropped because the frame pool was exhausted
+    STATS_RX_DROPPED_CONTROL_QUEUE_FULL,  // ... dropped because the control queue was full
+    STATS_RX_DROPPED_DATA_QUEUE_FULL,     // ... dropped because the data queue was full
+    STATS_RX_CRC_ERRORS,
+    STATS_RX_DUPLICATES,                  // retransmitted unicasts received before, with CONFIG_DSDV_RELIABLE_DELIVERY
+    STATS_RX_MALFORMED,
+    STATS_RX_FULL_DUMPS,
+    STATS_RX_UPDATES,                     // incremental and triggered updates
+    STATS_RX_USER,                        // user messages for this node, broadcasts included
+    STATS_RX_FRAGMENTS,                   // fragments of user messages for this node
+    STATS_RX_REASSEMBLY_TIMEOUTS,         // messages dropped with fragments missing after REASSEMBLY_TIMEOUT
+    STATS_RX_REASSEMBLY_FULL,             // fragments dropped for want of a reassembly slot
+    STATS_RX_FLOODS,                      // flooded frames received for the first time
+    STATS_RX_FLOOD_DUPLICATES,            // further copies of them, and own frames relayed back
+    STATS_RX_ZONE_SUMMARIES,              // parts of cluster head summaries heard for the first time
+    STATS_TX_FULL_DUMPS,                  // frames of full dumps
+    STATS_TX_UPDATES,                     // frames of periodic incremental updates
+    STATS_TX_TRIGGERED,                   // frames of triggered updates
+    STATS_TX_USER,                        // user messages originated by this node
+    STATS_TX_FRAGMENTS,                   // frames of the messages among them too large for one frame
+    STATS_TX_COMPRESSED,                  // ... messages sent compressed, with CONFIG_DSDV_COMPRESSION
+    STATS_TX_FORWARDED,                   // user messages forwarded for other nodes
+    STATS_TX_BUNDLES,                     // frames carrying several user messages, with CONFIG_DSDV_AGGREGATION
+    STATS_TX_BUNDLED,                     // ... messages sent in them, own and forwarded
+    STATS_TX_FLOODS,                      // frames of messages flooded by this node
+    STATS_TX_FLOOD_RELAYS,                // flooded frames of other nodes relayed
+    STATS_TX_FLOOD_SUPPRESSED,            // ... not relayed because enough neighbours did
+    STATS_TX_ZONE_SUMMARIES,              // summary frames sent as a cluster head
+    STATS_TX_ZONE_SUMMARY_RELAYS,         // summary frames of other heads passed on
+    STATS_TX_QUEUE_FULL,                  // frames rejected by transmit_frame()
+    STATS_TX_DRIVER_ERRORS,               // frames esp_now_send() refused
+    STATS_TX_NO_PEER,                     // frames dropped because every peer slot was taken by frames in flight
+    STATS_PEER_EVICTIONS,                 // idle peers removed from the driver to make room for another
+    STATS_CHANNEL_SWITCHES,               // radio tuned to another channel, with CONFIG_DSDV_MULTI_CHANNEL
+    STATS_TX_RETRIES,                     // retransmissions of unacknowledged unicasts
+    STATS_TX_FAILURES,                    // unicasts not acknowledged after all retries
+    STATS_TX_SALVAGED,                    // undelivered user messages sent again over a route that replaced the failed one
+    STATS_NO_ROUTE,                       // user messages dropped for want of a route, forwarded or own
+    STATS_ROUTE_CHANGES,                  // next hop of a reachable destination changed
+    STATS_ROUTE_BREAKS,
+    STATS_ROUTE_REPAIRS,
+    STATS_ROUTE_FAILOVERS,                // route moved to a loop-free alternate instead of breaking
+    STATS_NEIGHBOUR_TABLE_FULL,
+    STATS_ROUTING_TABLE_FULL,
+    STATS_ROUTES_RESTORED,                // routes restored from NVS after a restart
+    STATS_ROUTES_UNCONFIRMED,             // ... dropped because no advert confirmed them
+    STATS_ROUTES_LEFT_ZONE,               // routes given up as their destination moved out of the zone
+    STATS_NVS_WRITES,                     // writes of the sequence number reservation and the routes
+    STATS_CAPTURE_DROPPED,                // frames not captured for want of buffer space, with CONFIG_DSDV_CAPTURE
+    STATS_COUNTERS_NBR
+} stats_counter_t;
+
+/* Largest values seen. */
+typedef enum {
+    STATS_PEAK_CONTROL_QUEUE,             // events waiting for the control consumer task
+    STATS_PEAK_DATA_QUEUE,                // user messages waiting for the data consumer task
+    STATS_PEAK_TX_BACKLOG,                // frames waiting for a place in the TX window
+    STATS_PEAK_FRAMES_IN_USE,             // frame pool buffers allocated at the same time
+    STATS_PEAK_ROUTING_ENTRIES,           // routing table entries, the own one included
+    STATS_PEAKS_NBR
+} stats_peak_t;
+
+/* Forwarding latency from the arrival of a frame to the acknowledgement of its next hop.
+ * Bucket 0 counts latencies below 2^(STATS_LATENCY_MIN_LOG2+1) us, bucket i those in
+ * [2^(STATS_LATENCY_MIN_LOG2+i), 2^(STATS_LATENCY_MIN_LOG2+i+1)) us, the last one everything above. */
+#define STATS_LATENCY_BUCKETS   16
+#define STATS_LATENCY_MIN_LOG2  6
+
+typedef struct {
+    int64_t uptime_us;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t counters[STATS_COUNTERS_NBR];
+    uint32_t peaks[STATS_PEAKS_NBR];
+    uint32_t forward_latency[STATS_LATENCY_BUCKETS];
+} stats_snapshot_t;
+
+void stats_count(stats_counter_t counter);
+void stats_peak(stats_peak_t peak, uint32_t value);
+void stats_forward_latency(int64_t latency_us);
+uint32_t stats_get(stats_counter_t counter);
+void stats_snapshot(stats_snapshot_t *snapshot);
+void stats_reset();
+
+/* Both return the length of the snapshot in bytes, or -1 if it doesn't fit into buf.
+ * The binary form is a version byte, the sizes of the three arrays as bytes, then uptime_us and
+ * every field of stats_snapshot_t in order, little-endian. */
+int stats_to_json(const stats_snapshot_t *snapshot, char *buf, size_t len);
+int stats_to_binary(const stats_snapshot_t *snapshot, uint8_t *buf, size_t len);
+
+#endif
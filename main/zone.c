@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "zone.h"
+#include "routing_table.h"
+
+#if CONFIG_DSDV_ZONE_ROUTING
+/* Both tables are searched linearly. They are only touched with the routing table lock held. */
+static zone_member_t members[ZONE_MAP_SIZE];
+static int members_nbr= 0;
+static zone_summary_t summaries[ZONE_SUMMARY_SOURCES];
+static int summaries_nbr= 0;
+
+
+void zone_init()
+{
+    members_nbr= 0;
+    summaries_nbr= 0;
+}
+
+static uint32_t addr_hash(const uint8_t *addr)
+{
+    // FNV-1a, then mixed so that addresses that differ in the last bytes only end up far apart
+    uint32_t hash= 2166136261u;
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        hash= (hash ^ addr[i]) * 16777619u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+/* Order in which nodes defer to each other as heads. By address, the heads would line up along the addresses
+ * handed out in sequence, as to the boards of a batch, and each one would be elected only after the previous one. */
+bool zone_precedes(const uint8_t *addr, const uint8_t *other_addr)
+{
+    uint32_t hash= addr_hash(addr);
+    uint32_t other_hash= addr_hash(other_addr);
+    if (hash != other_hash)
+        return hash < other_hash;
+    return memcmp(addr, other_addr, ESP_NOW_ETH_ALEN) < 0;
+}
+
+/* True the first time a part of a head's summary is heard. A summary with a newer sequence number
+ * than the last one starts over. */
+bool zone_summary_fresh(const uint8_t *head_addr, uint16_t seq_num, int part, int64_t current_time)
+{
+    zone_summary_t *summary= NULL;
+    for (int i = 0; i < summaries_nbr; i++)
+        if (memcmp(summaries[i].head_addr, head_addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            summary= &summaries[i];
+            break;
+        }
+
+    uint32_t bit= 1u << part;
+    if (summary != NULL)
+    {
+        if (SEQ_NUM_NEWER(summary->seq_num, seq_num) || (seq_num == summary->seq_num && (summary->parts & bit)))
+            return false;
+        if (SEQ_NUM_NEWER(seq_num, summary->seq_num))
+            summary->parts= 0;
+    }
+    else
+    {
+        if (summaries_nbr < ZONE_SUMMARY_SOURCES)
+            summary= &summaries[summaries_nbr++];
+        else
+        {
+            summary= &summaries[0];
+            for (int i = 1; i < summaries_nbr; i++)
+                if (summaries[i].last_update_time < summary->last_update_time)
+                    summary= &summaries[i];
+        }
+        memcpy(summary->head_addr, head_addr, ESP_NOW_ETH_ALEN);
+        summary->parts= 0;
+    }
+    summary->seq_num= seq_num;
+    summary->parts |= bit;
+    summary->last_update_time= current_time;
+    return true;
+}
+
+/* Zones overlap, so several heads announce the same destination. All nodes must pick the same one, or messages
+ * could go back and forth between two heads: the head with the smallest address wins. Another head replaces it
+ * only once it hasn't announced the destination for hold_time. */
+void zone_set_head(const uint8_t *member_addr, const uint8_t *head_addr, int64_t current_time, int64_t hold_time)
+{
+    zone_member_t *member= NULL;
+    for (int i = 0; i < members_nbr; i++)
+        if (memcmp(members[i].member_addr, member_addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            member= &members[i];
+            break;
+        }
+    if (member == NULL)
+    {
+        if (members_nbr < ZONE_MAP_SIZE)
+            member= &members[members_nbr++];
+        else
+        {
+            member= &members[0];
+            for (int i = 1; i < members_nbr; i++)
+                if (members[i].last_update_time < member->last_update_time)
+                    member= &members[i];
+        }
+        memcpy(member->member_addr, member_addr, ESP_NOW_ETH_ALEN);
+    }
+    else if (memcmp(head_addr, member->head_addr, ESP_NOW_ETH_ALEN) > 0 && current_time - member->last_update_time <= hold_time)
+        return;
+    memcpy(member->head_addr, head_addr, ESP_NOW_ETH_ALEN);
+    member->last_update_time= current_time;
+}
+
+/* Head that last announced the destination, NULL if none did. */
+const uint8_t *zone_find_head(const uint8_t *member_addr)
+{
+    for (int i = 0; i < members_nbr; i++)
+        if (memcmp(members[i].member_addr, member_addr, ESP_NOW_ETH_ALEN) == 0)
+            return members[i].head_addr;
+    return NULL;
+}
+
+/* Forget the destinations and summaries not announced for more than max_age. Returns the number of destinations dropped. */
+int zone_expire(int64_t current_time, int64_t max_age)
+{
+    int expired= 0;
+    for (int i = members_nbr - 1; i >= 0; i--)
+        if (current_time - members[i].last_update_time > max_age)
+        {
+            members[i]= members[--members_nbr];
+            expired++;
+        }
+    for (int i = summaries_nbr - 1; i >= 0; i--)
+        if (current_time - summaries[i].last_update_time > max_age)
+            summaries[i]= summaries[--summaries_nbr];
+    return expired;
+}
+#endif
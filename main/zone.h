@@ -0,0 +1,38 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_now.h"
+
+#define ZONE_RADIUS         CONFIG_DSDV_ZONE_RADIUS
+#define ZONE_MAP_SIZE       CONFIG_DSDV_ZONE_MAP_SIZE
+#define ZONE_SUMMARY_SOURCES 64  // heads whose last summary is remembered, the least recently heard one is replaced
+
+#define IS_UNSET_ADDR(addr) (memcmp(addr, "\0\0\0\0\0\0", ESP_NOW_ETH_ALEN) == 0)
+
+
+/* Destination beyond the zone and the cluster head that last announced it. */
+typedef struct {
+    uint8_t member_addr[ESP_NOW_ETH_ALEN];
+    uint8_t head_addr[ESP_NOW_ETH_ALEN];
+    int64_t last_update_time;
+} zone_member_t;
+
+/* Parts of a head's latest summary that were heard, to pass each part on once. */
+typedef struct {
+    uint8_t head_addr[ESP_NOW_ETH_ALEN];
+    uint16_t seq_num;
+    uint32_t parts;                       // bitmap of the parts heard
+    int64_t last_update_time;
+} zone_summary_t;
+
+void zone_init();
+bool zone_precedes(const uint8_t *addr, const uint8_t *other_addr);
+bool zone_summary_fresh(const uint8_t *head_addr, uint16_t seq_num, int part, int64_t current_time);
+void zone_set_head(const uint8_t *member_addr, const uint8_t *head_addr, int64_t current_time, int64_t hold_time);
+const uint8_t *zone_find_head(const uint8_t *member_addr);
+int zone_expire(int64_t current_time, int64_t max_age);
+
+#endif